@@ -0,0 +1,540 @@
+// Analyzer.cpp
+#include "analyzer.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <unordered_set>
+
+namespace {
+
+enum : uint32_t {
+    FLAG_UNICODE = 1,
+    FLAG_SPLIT_IDENTIFIERS = 2,
+    FLAG_STOP_WORDS = 4,
+    FLAG_STEM = 8,
+    KNOWN_FLAGS = 15
+};
+
+// What a byte (or a decoded code point) is to the tokenizer
+enum CharClass : uint8_t {
+    SEPARATOR,
+    LOWER,     // also letters without case, and bytes that aren't UTF-8
+    UPPER,
+    DIGIT,
+    CONNECTOR, // '_'
+    MULTIBYTE  // the lead or continuation byte of a UTF-8 sequence
+};
+
+struct AsciiTables {
+    uint8_t classes[256];
+    char folded[256];
+
+    AsciiTables() {
+        for (int c = 0; c < 256; ++c) {
+            folded[c] = static_cast<char>(c);
+            if (c >= 0x80) classes[c] = MULTIBYTE;
+            else if (c >= 'a' && c <= 'z') classes[c] = LOWER;
+            else if (c >= 'A' && c <= 'Z') {
+                classes[c] = UPPER;
+                folded[c] = static_cast<char>(c + 32);
+            } else if (c >= '0' && c <= '9') classes[c] = DIGIT;
+            else if (c == '_') classes[c] = CONNECTOR;
+            else classes[c] = SEPARATOR;
+        }
+    }
+};
+
+const AsciiTables ASCII;
+
+// Length of the valid UTF-8 sequence at p, or 0 (overlong forms, surrogates
+// and code points past U+10FFFF are invalid)
+size_t decodeUtf8(const unsigned char* p, size_t available, uint32_t& cp) {
+    unsigned char c = p[0];
+    size_t length;
+    uint32_t min;
+    if (c >= 0xC2 && c <= 0xDF) { length = 2; cp = c & 0x1F; min = 0x80; }
+    else if (c >= 0xE0 && c <= 0xEF) { length = 3; cp = c & 0x0F; min = 0x800; }
+    else if (c >= 0xF0 && c <= 0xF4) { length = 4; cp = c & 0x07; min = 0x10000; }
+    else return 0;
+
+    if (available < length) return 0;
+    for (size_t k = 1; k < length; ++k) {
+        if ((p[k] & 0xC0) != 0x80) return 0;
+        cp = cp << 6 | (p[k] & 0x3F);
+    }
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+    return length;
+}
+
+void appendUtf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | cp >> 6));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | cp >> 12));
+        out.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | cp >> 18));
+        out.push_back(static_cast<char>(0x80 | (cp >> 12 & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp >> 6 & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Non-ASCII punctuation, spaces and symbols; every other code point is part of a word
+const uint32_t SEPARATOR_RANGES[][2] = {
+    {0x0080, 0x00A9}, {0x00AB, 0x00B4}, {0x00B6, 0x00B9}, {0x00BB, 0x00BF}, // Latin-1 punctuation
+    {0x00D7, 0x00D7}, {0x00F7, 0x00F7},                                     // multiplication, division
+    {0x2000, 0x206F},                                                       // general punctuation
+    {0x20A0, 0x20CF},                                                       // currency
+    {0x2190, 0x2BFF},                                                       // arrows, operators, box drawing, dingbats
+    {0x2E00, 0x2E7F},                                                       // supplemental punctuation
+    {0x3000, 0x3004}, {0x3008, 0x3020},                                     // CJK punctuation
+    {0xFE10, 0xFE1F}, {0xFE30, 0xFE6F},                                     // vertical, compatibility and small forms
+    {0xFEFF, 0xFEFF},                                                       // byte order mark
+    {0xFF01, 0xFF0F}, {0xFF1A, 0xFF20}, {0xFF3B, 0xFF40}, {0xFF5B, 0xFF65}, // fullwidth punctuation
+    {0xFFF0, 0xFFFF},                                                       // specials
+    {0x1F000, 0x1FAFF},                                                     // emoji and pictographs
+};
+
+bool isWordCodePoint(uint32_t cp) {
+    auto range = std::upper_bound(std::begin(SEPARATOR_RANGES), std::end(SEPARATOR_RANGES), cp,
+                                  [](uint32_t value, const uint32_t* r) { return value < r[0]; });
+    return range == std::begin(SEPARATOR_RANGES) || cp > (*(range - 1))[1];
+}
+
+// In blocks where upper and lower case alternate, the upper case letter has the given parity
+inline uint32_t foldPair(uint32_t cp, uint32_t upperParity) {
+    return (cp & 1) == upperParity ? cp + 1 : cp;
+}
+
+// Simple case folding (one code point to one) for the scripts with case that
+// text files mostly use
+uint32_t foldCase(uint32_t cp) {
+    if (cp < 0x100) {
+        if (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) return cp + 32;
+        if (cp == 0xB5) return 0x3BC; // micro sign -> Greek mu
+        return cp;
+    }
+    if (cp < 0x180) {
+        if (cp == 0x130) return 'i';
+        if (cp == 0x131 || cp == 0x138 || cp == 0x149) return cp;
+        if (cp == 0x178) return 0xFF;
+        if (cp == 0x17F) return 's';
+        if ((cp >= 0x139 && cp <= 0x148) || cp >= 0x179) return foldPair(cp, 1);
+        return foldPair(cp, 0);
+    }
+    if (cp < 0x250) {
+        if (cp >= 0x1CD && cp <= 0x1DC) return foldPair(cp, 1);
+        if ((cp >= 0x1DE && cp <= 0x1EF) || (cp >= 0x1F8 && cp <= 0x21F) || (cp >= 0x222 && cp <= 0x233)) {
+            return foldPair(cp, 0);
+        }
+        return cp;
+    }
+    if (cp >= 0x370 && cp < 0x400) {
+        if (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2) return cp + 32;
+        if (cp == 0x386) return 0x3AC;
+        if (cp >= 0x388 && cp <= 0x38A) return cp + 37;
+        if (cp == 0x38C) return 0x3CC;
+        if (cp == 0x38E || cp == 0x38F) return cp + 63;
+        if (cp == 0x3C2) return 0x3C3; // final sigma
+        return cp;
+    }
+    if (cp >= 0x400 && cp < 0x530) {
+        if (cp < 0x410) return cp + 80;
+        if (cp < 0x430) return cp + 32;
+        if (cp == 0x4C0) return 0x4CF;
+        if (cp >= 0x4C1 && cp <= 0x4CE) return foldPair(cp, 1);
+        if ((cp >= 0x460 && cp <= 0x481) || (cp >= 0x48A && cp <= 0x4BF) || cp >= 0x4D0) return foldPair(cp, 0);
+        return cp;
+    }
+    if (cp >= 0x531 && cp <= 0x556) return cp + 48;                 // Armenian
+    if (cp >= 0x10A0 && cp <= 0x10C5) return cp + 0x1C60;           // Georgian
+    if (cp >= 0x1E00 && cp <= 0x1EFF) {                             // Latin extended additional
+        if (cp == 0x1E9E) return 0xDF;
+        if (cp <= 0x1E95 || cp >= 0x1EA0) return foldPair(cp, 0);
+        return cp;
+    }
+    if (cp >= 0xFF21 && cp <= 0xFF3A) return cp + 32;               // fullwidth Latin
+    if (cp >= 0x10400 && cp <= 0x10427) return cp + 40;             // Deseret
+    return cp;
+}
+
+// Porter's algorithm over b[0..k], following his reference implementation
+class PorterStemmer {
+public:
+    explicit PorterStemmer(std::string& word) : b(word), k(static_cast<int>(word.size()) - 1) {}
+
+    void run() {
+        if (k <= 1) return; // words of one or two letters are left alone
+        step1ab();
+        if (k > 0) {
+            step1c();
+            step2();
+            step3();
+            step4();
+            step5();
+        }
+        b.resize(static_cast<size_t>(k) + 1);
+    }
+
+private:
+    std::string& b;
+    int k;
+    int j{0};
+
+    bool consonant(int i) const {
+        switch (b[i]) {
+        case 'a': case 'e': case 'i': case 'o': case 'u': return false;
+        case 'y': return i == 0 || !consonant(i - 1);
+        default: return true;
+        }
+    }
+
+    // The number of vowel-consonant sequences in b[0..j]
+    int measure() const {
+        int n = 0;
+        int i = 0;
+        for (;; ++i) {
+            if (i > j) return n;
+            if (!consonant(i)) break;
+        }
+        for (++i;; ++i) {
+            for (;; ++i) {
+                if (i > j) return n;
+                if (consonant(i)) break;
+            }
+            n++;
+            for (++i;; ++i) {
+                if (i > j) return n;
+                if (!consonant(i)) break;
+            }
+        }
+    }
+
+    bool vowelInStem() const {
+        for (int i = 0; i <= j; ++i) {
+            if (!consonant(i)) return true;
+        }
+        return false;
+    }
+
+    bool doubleConsonant(int i) const {
+        return i >= 1 && b[i] == b[i - 1] && consonant(i);
+    }
+
+    // consonant-vowel-consonant ending at i, where the last isn't w, x or y
+    bool cvc(int i) const {
+        if (i < 2 || !consonant(i) || consonant(i - 1) || !consonant(i - 2)) return false;
+        return b[i] != 'w' && b[i] != 'x' && b[i] != 'y';
+    }
+
+    // Whether b[0..k] ends with s; if so j marks the end of the stem before it
+    bool ends(const char* s) {
+        int length = static_cast<int>(std::strlen(s));
+        if (length > k + 1 || b.compare(k - length + 1, length, s) != 0) return false;
+        j = k - length;
+        return true;
+    }
+
+    // Replaces b[j+1..k] with s
+    void setTo(const char* s) {
+        int length = static_cast<int>(std::strlen(s));
+        b.replace(j + 1, k - j, s);
+        k = j + length;
+    }
+
+    void replaceIfMeasured(const char* s) {
+        if (measure() > 0) setTo(s);
+    }
+
+    // Plurals and -ed / -ing
+    void step1ab() {
+        if (b[k] == 's') {
+            if (ends("sses")) k -= 2;
+            else if (ends("ies")) setTo("i");
+            else if (b[k - 1] != 's') k--;
+        }
+        if (ends("eed")) {
+            if (measure() > 0) k--;
+        } else if ((ends("ed") || ends("ing")) && vowelInStem()) {
+            k = j;
+            if (ends("at")) setTo("ate");
+            else if (ends("bl")) setTo("ble");
+            else if (ends("iz")) setTo("ize");
+            else if (doubleConsonant(k)) {
+                k--;
+                if (b[k] == 'l' || b[k] == 's' || b[k] == 'z') k++;
+            } else if (measure() == 1 && cvc(k)) {
+                j = k;
+                setTo("e");
+            }
+        }
+    }
+
+    // Terminal y to i when there is another vowel in the stem
+    void step1c() {
+        if (ends("y") && vowelInStem()) b[k] = 'i';
+    }
+
+    // Double suffixes to single ones: -ization to -ize and so on
+    void step2() {
+        static const char* const RULES[][2] = {
+            {"ational", "ate"}, {"tional", "tion"}, {"enci", "ence"}, {"anci", "ance"}, {"izer", "ize"},
+            {"bli", "ble"}, {"alli", "al"}, {"entli", "ent"}, {"eli", "e"}, {"ousli", "ous"},
+            {"ization", "ize"}, {"ation", "ate"}, {"ator", "ate"}, {"alism", "al"}, {"iveness", "ive"},
+            {"fulness", "ful"}, {"ousness", "ous"}, {"aliti", "al"}, {"iviti", "ive"}, {"biliti", "ble"},
+            {"logi", "log"},
+        };
+        applyFirst(RULES, sizeof(RULES) / sizeof(RULES[0]));
+    }
+
+    // -ic-, -full, -ness and the like
+    void step3() {
+        static const char* const RULES[][2] = {
+            {"icate", "ic"}, {"ative", ""}, {"alize", "al"}, {"iciti", "ic"}, {"ical", "ic"},
+            {"ful", ""}, {"ness", ""},
+        };
+        applyFirst(RULES, sizeof(RULES) / sizeof(RULES[0]));
+    }
+
+    // The first rule whose suffix matches decides, whether or not the stem is long enough
+    void applyFirst(const char* const rules[][2], size_t count) {
+        for (size_t r = 0; r < count; ++r) {
+            if (ends(rules[r][0])) {
+                replaceIfMeasured(rules[r][1]);
+                return;
+            }
+        }
+    }
+
+    // -ant, -ence and the like, in context <c>vcvc<v>
+    void step4() {
+        static const char* const SUFFIXES[] = {
+            "al", "ance", "ence", "er", "ic", "able", "ible", "ant", "ement", "ment", "ent",
+            "ion", "ou", "ism", "ate", "iti", "ous", "ive", "ize",
+        };
+        bool found = false;
+        for (const char* suffix : SUFFIXES) {
+            if (!ends(suffix)) continue;
+            // -ion only after s or t
+            if (std::strcmp(suffix, "ion") == 0 && !(j >= 0 && (b[j] == 's' || b[j] == 't'))) continue;
+            found = true;
+            break;
+        }
+        if (found && measure() > 1) k = j;
+    }
+
+    // A final -e, and -ll to -l
+    void step5() {
+        j = k;
+        if (b[k] == 'e') {
+            int m = measure();
+            if (m > 1 || (m == 1 && !cvc(k - 1))) k--;
+        }
+        if (b[k] == 'l' && doubleConsonant(k) && measure() > 1) k--;
+    }
+};
+
+} // namespace
+
+uint32_t analyzerFlags(const AnalyzerOptions& options) {
+    uint32_t flags = 0;
+    if (!options.legacy) flags |= FLAG_UNICODE;
+    if (options.splitIdentifiers) flags |= FLAG_SPLIT_IDENTIFIERS;
+    if (options.stopWords) flags |= FLAG_STOP_WORDS;
+    if (options.stem) flags |= FLAG_STEM;
+    return flags;
+}
+
+bool analyzerFromFlags(uint32_t flags, AnalyzerOptions& options) {
+    if (flags & ~uint32_t(KNOWN_FLAGS)) return false;
+    options.legacy = (flags & FLAG_UNICODE) == 0;
+    options.splitIdentifiers = (flags & FLAG_SPLIT_IDENTIFIERS) != 0;
+    options.stopWords = (flags & FLAG_STOP_WORDS) != 0;
+    options.stem = (flags & FLAG_STEM) != 0;
+    return true;
+}
+
+std::string describeAnalyzer(const AnalyzerOptions& options) {
+    if (options.legacy) return "legacy";
+    std::string text = "unicode";
+    if (options.splitIdentifiers) text += ", identifiers";
+    if (options.stopWords) text += ", stop words";
+    if (options.stem) text += ", stemming";
+    return text;
+}
+
+bool StopWordFilter::apply(std::string& term) const {
+    static const std::unordered_set<std::string> STOP_WORDS = {
+        "a", "an", "and", "are", "as", "at", "be", "but", "by", "for", "if", "in", "into", "is", "it",
+        "no", "not", "of", "on", "or", "such", "that", "the", "their", "then", "there", "these",
+        "they", "this", "to", "was", "will", "with",
+    };
+    // Every stop word is short, which rules out most terms before hashing
+    return term.size() > 5 || STOP_WORDS.count(term) == 0;
+}
+
+bool PorterStemFilter::apply(std::string& term) const {
+    for (char c : term) {
+        if (c < 'a' || c > 'z') return true;
+    }
+    PorterStemmer(term).run();
+    return true;
+}
+
+Analyzer::Analyzer(const AnalyzerOptions& options) : m_options(options) {
+    // Stop words are matched before stemming changes them
+    if (options.stopWords) m_filters.push_back(std::make_shared<StopWordFilter>());
+    if (options.stem) m_filters.push_back(std::make_shared<PorterStemFilter>());
+}
+
+void Analyzer::addFilter(std::shared_ptr<const TokenFilter> filter) {
+    m_filters.push_back(std::move(filter));
+}
+
+void Analyzer::emit(std::string term, size_t begin, size_t end, std::vector<Token>& tokens) const {
+    for (const auto& filter : m_filters) {
+        if (!filter->apply(term) || term.empty()) return;
+    }
+    tokens.push_back({std::move(term), begin, end});
+}
+
+void Analyzer::analyzeLegacy(const std::string& text, std::vector<Token>& tokens) const {
+    const size_t n = text.size();
+    std::string word;
+    size_t i = 0;
+    while (i < n) {
+        while (i < n && std::isspace(static_cast<unsigned char>(text[i]))) i++;
+        size_t begin = i;
+        word.clear();
+        for (; i < n && !std::isspace(static_cast<unsigned char>(text[i])); ++i) {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            if (!std::ispunct(c)) {
+                word.push_back(static_cast<char>(std::tolower(c)));
+            }
+        }
+        if (!word.empty()) {
+            emit(word, begin, i, tokens);
+        }
+    }
+}
+
+void Analyzer::analyze(const std::string& text, std::vector<Token>& tokens, bool query) const {
+    if (m_options.legacy) {
+        analyzeLegacy(text, tokens);
+        return;
+    }
+
+    // A word's letters and digits between underscores and case changes
+    struct Part {
+        size_t termBegin, termEnd;
+        size_t textBegin, textEnd;
+    };
+
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(text.data());
+    const size_t n = text.size();
+    const bool split = m_options.splitIdentifiers;
+
+    std::string term; // the current word, folded
+    std::vector<Part> parts;
+    bool partOpen = false;
+    uint8_t previous = SEPARATOR, beforePrevious = SEPARATOR;
+    size_t previousTerm = 0, previousText = 0; // where the previous character starts
+
+    auto openPart = [&](size_t termAt, size_t textAt) {
+        parts.push_back({termAt, termAt, textAt, textAt});
+        partOpen = true;
+    };
+    auto closePart = [&](size_t termAt, size_t textAt) {
+        if (!partOpen) return;
+        parts.back().termEnd = termAt;
+        parts.back().textEnd = textAt;
+        partOpen = false;
+    };
+    auto finishWord = [&](size_t textAt) {
+        closePart(term.size(), textAt);
+        if (!parts.empty()) {
+            const Part& first = parts.front();
+            const Part& last = parts.back();
+            bool splits = split && parts.size() > 1;
+            if (!(splits && query)) {
+                emit(term.substr(first.termBegin, last.termEnd - first.termBegin), first.textBegin, last.textEnd,
+                     tokens);
+            }
+            if (splits) {
+                for (const Part& part : parts) {
+                    emit(term.substr(part.termBegin, part.termEnd - part.termBegin), part.textBegin, part.textEnd,
+                         tokens);
+                }
+            }
+        }
+        term.clear();
+        parts.clear();
+        previous = beforePrevious = SEPARATOR;
+    };
+
+    size_t i = 0;
+    while (i < n) {
+        unsigned char c = data[i];
+        uint8_t cls = ASCII.classes[c];
+        size_t length = 1;
+        uint32_t cp = 0;
+
+        if (cls == MULTIBYTE) {
+            length = decodeUtf8(data + i, n - i, cp);
+            if (length == 0) {
+                length = 1;
+                cls = LOWER; // kept byte for byte
+            } else if (!isWordCodePoint(cp)) {
+                cls = SEPARATOR;
+            } else {
+                uint32_t folded = foldCase(cp);
+                cls = folded != cp ? UPPER : LOWER;
+                cp = folded;
+            }
+        }
+
+        if (cls == SEPARATOR) {
+            if (!term.empty()) finishWord(i);
+            i += length;
+            continue;
+        }
+        if (cls == CONNECTOR) {
+            closePart(term.size(), i);
+            term.push_back('_');
+            previous = beforePrevious = SEPARATOR;
+            i++;
+            continue;
+        }
+
+        if (!partOpen) {
+            openPart(term.size(), i);
+        } else if (split) {
+            if (cls == UPPER && (previous == LOWER || previous == DIGIT)) {
+                // parse|Query, utf8|Decode
+                closePart(term.size(), i);
+                openPart(term.size(), i);
+            } else if (cls == LOWER && previous == UPPER && beforePrevious == UPPER) {
+                // HTTP|Server: the last capital of a run starts the next part
+                closePart(previousTerm, previousText);
+                openPart(previousTerm, previousText);
+            }
+        }
+
+        beforePrevious = previous;
+        previous = cls;
+        previousTerm = term.size();
+        previousText = i;
+        if (length == 1) {
+            term.push_back(ASCII.folded[c]);
+        } else {
+            appendUtf8(term, cp);
+        }
+        i += length;
+    }
+    if (!term.empty()) finishWord(n);
+}
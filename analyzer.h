@@ -0,0 +1,89 @@
+// Analyzer.h
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// What an Analyzer does besides splitting and case folding. An index only
+// answers queries analyzed the same way as its content, so these are stored
+// in the cache along with the terms.
+struct AnalyzerOptions {
+    // The whitespace tokenizer of caches before version 6: lowercases ASCII,
+    // drops ASCII punctuation and leaves other bytes alone
+    bool legacy = false;
+    // Also index the parts of camelCase and snake_case identifiers
+    bool splitIdentifiers = true;
+    bool stopWords = false; // drop common English words
+    bool stem = false;      // reduce English words to their Porter stem
+};
+
+// The options as a bit set for the cache; false on bits this version doesn't know
+uint32_t analyzerFlags(const AnalyzerOptions& options);
+bool analyzerFromFlags(uint32_t flags, AnalyzerOptions& options);
+// e.g. "unicode, identifiers, stemming"
+std::string describeAnalyzer(const AnalyzerOptions& options);
+
+// A term and the bytes [begin, end) of the text it came from
+struct Token {
+    std::string term;
+    size_t begin;
+    size_t end;
+};
+
+// One stage of the chain after tokenizing and case folding
+class TokenFilter {
+public:
+    virtual ~TokenFilter() = default;
+    // Rewrites term in place; false drops the token
+    virtual bool apply(std::string& term) const = 0;
+};
+
+// The English stop words of Lucene's default list
+class StopWordFilter : public TokenFilter {
+public:
+    bool apply(std::string& term) const override;
+};
+
+// Porter's 1980 suffix-stripping algorithm, so "indexes" and "indexing" both
+// become "index". Terms that aren't plain ASCII letters are left alone.
+class PorterStemFilter : public TokenFilter {
+public:
+    bool apply(std::string& term) const override;
+};
+
+// Turns text into terms in a single pass over its bytes. ASCII is classified
+// and lowercased through 256-entry tables; anything else is decoded as UTF-8
+// and case folded (Latin, Greek, Cyrillic, Armenian, Georgian and fullwidth
+// forms; other scripts have no case or pass through unchanged). Bytes that
+// aren't valid UTF-8 are kept as word characters rather than dropped.
+//
+// A word is a run of letters, digits and underscores. Leading and trailing
+// underscores are trimmed, and with splitIdentifiers a word like "parseHTTPHeader"
+// or "max_file_size" yields its parts after the whole word ("parsehttpheader",
+// "parse", "http", "header"). Every term then runs through the filters in order.
+class Analyzer {
+public:
+    explicit Analyzer(const AnalyzerOptions& options = AnalyzerOptions());
+
+    const AnalyzerOptions& options() const { return m_options; }
+    // Runs after the filters the options ask for
+    void addFilter(std::shared_ptr<const TokenFilter> filter);
+
+    // Appends text's tokens in the order they occur; safe to call concurrently.
+    // For a query, an identifier that splits yields only its parts, so
+    // "parseQuery" also finds "parseQueryNode", which has the same parts.
+    void analyze(const std::string& text, std::vector<Token>& tokens, bool query = false) const;
+
+private:
+    AnalyzerOptions m_options;
+    std::vector<std::shared_ptr<const TokenFilter>> m_filters;
+
+    void analyzeLegacy(const std::string& text, std::vector<Token>& tokens) const;
+    void emit(std::string term, size_t begin, size_t end, std::vector<Token>& tokens) const;
+};
+
+#endif
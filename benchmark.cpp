@@ -0,0 +1,397 @@
+// benchmark.cpp
+// Generates a reproducible synthetic tree, indexes it and reports indexing
+// throughput, peak memory, cache size/load time and per-query latency.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "index.h"
+#include "indexer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct BenchConfig {
+    std::string dir = "./bench_corpus";
+    std::string cacheFile = "./bench_cache.bin";
+    size_t files = 10000;
+    size_t vocabulary = 50000;
+    double zipf = 1.1;
+    size_t meanSize = 4096;
+    size_t maxSize = 512 * 1024;
+    size_t filesPerDir = 64;
+    size_t queries = 2000;
+    uint64_t seed = 42;
+    bool reuse = false;
+    bool json = false;
+    IndexerOptions indexing;
+};
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+uint64_t peakRssBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Samples ranks 0..n-1 with P(rank) proportional to 1 / (rank + 1)^s
+class ZipfSampler {
+public:
+    ZipfSampler(size_t n, double s) : m_cdf(n) {
+        double total = 0;
+        for (size_t i = 0; i < n; ++i) {
+            total += 1.0 / std::pow(static_cast<double>(i + 1), s);
+            m_cdf[i] = total;
+        }
+        for (double& value : m_cdf) {
+            value /= total;
+        }
+    }
+
+    template <typename Rng>
+    size_t operator()(Rng& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return std::min(static_cast<size_t>(std::lower_bound(m_cdf.begin(), m_cdf.end(), u) - m_cdf.begin()),
+                        m_cdf.size() - 1);
+    }
+
+private:
+    std::vector<double> m_cdf;
+};
+
+// Deterministic pseudo-word for a vocabulary rank: 0 -> "ba", 1 -> "be", ...
+std::string makeWord(size_t rank) {
+    static const char* syllables[] = {"ba", "be", "bi", "bo", "ku", "la", "me", "ni", "po", "ra",
+                                      "se", "ti", "vo", "xa", "ye", "zu"};
+    std::string word;
+    do {
+        word += syllables[rank % 16];
+        rank /= 16;
+    } while (rank > 0);
+    return word;
+}
+
+struct Corpus {
+    size_t files = 0;
+    uint64_t bytes = 0;
+    std::vector<std::string> words;
+};
+
+Corpus generateCorpus(const BenchConfig& config) {
+    Corpus corpus;
+    corpus.words.reserve(config.vocabulary);
+    for (size_t i = 0; i < config.vocabulary; ++i) {
+        corpus.words.push_back(makeWord(i));
+    }
+
+    if (config.reuse && fs::exists(config.dir)) {
+        for (const auto& entry : fs::recursive_directory_iterator(config.dir)) {
+            if (entry.is_regular_file()) {
+                corpus.files++;
+                corpus.bytes += entry.file_size();
+            }
+        }
+        return corpus;
+    }
+
+    fs::remove_all(config.dir);
+    fs::create_directories(config.dir);
+
+    std::mt19937_64 rng(config.seed);
+    ZipfSampler zipf(config.vocabulary, config.zipf);
+    // Log-normal sizes with the requested mean: mean = exp(mu + sigma^2 / 2)
+    const double sigma = 1.0;
+    std::lognormal_distribution<double> sizeDist(std::log(static_cast<double>(config.meanSize)) - sigma * sigma / 2,
+                                                 sigma);
+    static const char* extensions[] = {"txt", "cpp", "h", "md", "py", "json", "log", "bin"};
+    std::discrete_distribution<int> extDist({30, 20, 10, 10, 10, 8, 7, 5});
+
+    for (size_t i = 0; i < config.files; ++i) {
+        // Two levels of directories, filled in order, so the tree has realistic shared prefixes
+        size_t dirIndex = i / config.filesPerDir;
+        fs::path dir = fs::path(config.dir) / ("d" + std::to_string(dirIndex / 32)) / ("s" + std::to_string(dirIndex % 32));
+        if (i % config.filesPerDir == 0) {
+            fs::create_directories(dir);
+        }
+
+        const char* ext = extensions[extDist(rng)];
+        size_t target = static_cast<size_t>(std::clamp(sizeDist(rng), 16.0, static_cast<double>(config.maxSize)));
+
+        std::string content;
+        content.reserve(target + 16);
+        while (content.size() < target) {
+            content += corpus.words[zipf(rng)];
+            content += (content.size() % 80 < 8) ? '\n' : ' ';
+        }
+
+        std::ofstream out(dir / ("f" + std::to_string(i) + "." + ext), std::ios::binary);
+        out.write(content.data(), static_cast<std::streamsize>(content.size()));
+        corpus.files++;
+        corpus.bytes += content.size();
+    }
+    return corpus;
+}
+
+struct LatencyStats {
+    std::vector<double> micros;
+
+    double percentile(double p) const {
+        if (micros.empty()) return 0;
+        std::vector<double> sorted = micros;
+        size_t rank = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size()))) - 1;
+        rank = std::min(rank, sorted.size() - 1);
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        return sorted[rank];
+    }
+};
+
+std::vector<std::pair<std::string, std::string>> makeQueries(const BenchConfig& config, const Corpus& corpus) {
+    std::mt19937_64 rng(config.seed + 1);
+    ZipfSampler zipf(config.vocabulary, config.zipf);
+    std::uniform_int_distribution<size_t> anyWord(0, corpus.words.size() - 1);
+    auto word = [&]() { return corpus.words[zipf(rng)]; };
+
+    std::vector<std::pair<std::string, std::string>> queries;
+    for (size_t i = 0; i < config.queries; ++i) {
+        switch (i % 6) {
+        case 0: queries.push_back({"term", word()}); break;
+        case 1: queries.push_back({"and", word() + " " + word()}); break;
+        case 2: queries.push_back({"or", word() + " OR " + word()}); break;
+        case 3: queries.push_back({"not", word() + " -" + word()}); break;
+        case 4: queries.push_back({"filter", word() + " ext:cpp size:>4K"}); break;
+        case 5: queries.push_back({"rare", corpus.words[anyWord(rng)]}); break;
+        }
+    }
+    return queries;
+}
+
+// Queries whose result follows from the query language alone, so a mismatch
+// is a planner bug rather than a slow query
+bool checkQuerySemantics(const Index& index, const Corpus& corpus) {
+    const std::string& common = corpus.words[0];
+    size_t all = index.search(common).size();
+    const std::pair<std::string, size_t> expected[] = {
+        {common + " -*", 0},        // excluding a term with no words excludes everything
+        {"-*", 0},
+        {common + " -(-*)", all},
+    };
+    for (const auto& check : expected) {
+        size_t count = index.search(check.first).size();
+        if (count != check.second) {
+            std::cerr << "Query '" << check.first << "' returned " << count << " results, expected "
+                      << check.second << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// The index the indexer built must answer like the cache it saved, even when
+// postings were spilled under --memory-budget and merged back at the end
+bool checkIndexMatchesCache(const Index& index, const Index& loaded,
+                            const std::vector<std::pair<std::string, std::string>>& queries) {
+    if (index.spilledRunCount() != 0) {
+        std::cerr << "Indexing left " << index.spilledRunCount() << " spilled runs unmerged" << std::endl;
+        return false;
+    }
+    for (const auto& query : queries) {
+        std::string error;
+        auto built = index.search(query.second, SortBy::RELEVANCE, 20, &error);
+        auto cached = loaded.search(query.second, SortBy::RELEVANCE, 20);
+        bool same = error.empty() && built.size() == cached.size();
+        for (size_t i = 0; same && i < built.size(); ++i) {
+            same = built[i].path == cached[i].path;
+        }
+        if (!same) {
+            std::cerr << "Query '" << query.second << "' differs between the built index and its cache"
+                      << (error.empty() ? "" : ": " + error) << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool parseArgs(int argc, char** argv, BenchConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                std::exit(2);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--dir") config.dir = value();
+        else if (arg == "--cache") config.cacheFile = value();
+        else if (arg == "--files") config.files = std::stoull(value());
+        else if (arg == "--vocab") config.vocabulary = std::stoull(value());
+        else if (arg == "--zipf") config.zipf = std::stod(value());
+        else if (arg == "--mean-size") config.meanSize = std::stoull(value());
+        else if (arg == "--max-size") config.maxSize = std::stoull(value());
+        else if (arg == "--files-per-dir") config.filesPerDir = std::max<size_t>(1, std::stoull(value()));
+        else if (arg == "--queries") config.queries = std::stoull(value());
+        else if (arg == "--seed") config.seed = std::stoull(value());
+        else if (arg == "--memory-budget") config.indexing.memoryBudget = std::stoull(value());
+        else if (arg == "--no-content") config.indexing.storeContent = false;
+        else if (arg == "--read-order") {
+            std::string order = value();
+            if (order == "walk") config.indexing.readOrder = ReadOrder::WALK;
+            else if (order == "physical") config.indexing.readOrder = ReadOrder::PHYSICAL;
+            else if (order == "inode") config.indexing.readOrder = ReadOrder::INODE;
+            else {
+                std::cerr << "Unknown read order: " << order << std::endl;
+                return false;
+            }
+        }
+        else if (arg == "--read-ahead") config.indexing.readAhead = std::stoull(value());
+        else if (arg == "--reuse") config.reuse = true;
+        else if (arg == "--json") config.json = true;
+        else {
+            std::cout << "Usage: FileSearchBench [--files N] [--vocab N] [--zipf S] [--mean-size BYTES]\n"
+                         "                       [--max-size BYTES] [--files-per-dir N] [--queries N]\n"
+                         "                       [--seed N] [--dir PATH] [--cache FILE] [--reuse] [--json]\n"
+                         "                       [--memory-budget BYTES] [--no-content]\n"
+                         "                       [--read-order walk|inode|physical] [--read-ahead N]\n";
+            return false;
+        }
+    }
+    return config.vocabulary > 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        return 2;
+    }
+
+    auto start = Clock::now();
+    Corpus corpus = generateCorpus(config);
+    double generateSeconds = secondsSince(start);
+
+    // Indexer progress goes to stdout; keep the report readable
+    std::ostringstream indexerLog;
+    std::streambuf* originalCout = std::cout.rdbuf(indexerLog.rdbuf());
+
+    Index index;
+    Indexer indexer(index);
+    indexer.setRootPath(config.dir);
+    indexer.setOptions(config.indexing);
+    indexer.setProgressInterval(std::chrono::milliseconds(0));
+    start = Clock::now();
+    indexer.run();
+    double indexSeconds = secondsSince(start);
+    std::cout.rdbuf(originalCout);
+
+    start = Clock::now();
+    bool saved = index.saveToFile(config.cacheFile);
+    double saveSeconds = secondsSince(start);
+    uint64_t cacheBytes = saved ? fs::file_size(config.cacheFile) : 0;
+
+    Index loaded;
+    start = Clock::now();
+    bool loadedOk = loaded.loadFromFile(config.cacheFile);
+    double loadSeconds = secondsSince(start);
+    if (!saved || !loadedOk) {
+        std::cerr << "Cache round trip failed" << std::endl;
+        return 1;
+    }
+
+    if (!checkQuerySemantics(loaded, corpus) || !checkIndexMatchesCache(index, loaded, makeQueries(config, corpus))) {
+        return 1;
+    }
+
+    // Measure the query work itself, not the result cache
+    loaded.setQueryCacheCapacity(0);
+    std::map<std::string, LatencyStats> latencies;
+    size_t totalHits = 0;
+    for (const auto& query : makeQueries(config, corpus)) {
+        auto queryStart = Clock::now();
+        auto results = loaded.search(query.second, SortBy::RELEVANCE, 20);
+        latencies[query.first].micros.push_back(secondsSince(queryStart) * 1e6);
+        totalHits += results.size();
+    }
+
+    const double mb = static_cast<double>(corpus.bytes) / (1024.0 * 1024.0);
+    const double filesPerSecond = indexSeconds > 0 ? static_cast<double>(index.fileCount()) / indexSeconds : 0;
+    const double mbPerSecond = indexSeconds > 0 ? mb / indexSeconds : 0;
+
+    if (config.json) {
+        std::cout << std::fixed << std::setprecision(3);
+        std::cout << "{\"files\":" << index.fileCount() << ",\"bytes\":" << corpus.bytes
+                  << ",\"seed\":" << config.seed << ",\"generate_s\":" << generateSeconds
+                  << ",\"index_s\":" << indexSeconds << ",\"files_per_s\":" << filesPerSecond
+                  << ",\"mb_per_s\":" << mbPerSecond << ",\"peak_rss_bytes\":" << peakRssBytes()
+                  << ",\"cache_bytes\":" << cacheBytes << ",\"save_s\":" << saveSeconds
+                  << ",\"load_s\":" << loadSeconds << ",\"queries\":{";
+        bool first = true;
+        for (const auto& entry : latencies) {
+            std::cout << (first ? "" : ",") << "\"" << entry.first << "\":{\"count\":" << entry.second.micros.size()
+                      << ",\"p50_us\":" << entry.second.percentile(0.50)
+                      << ",\"p99_us\":" << entry.second.percentile(0.99) << "}";
+            first = false;
+        }
+        std::cout << "},\"indexer\":" << indexer.metrics().toJson() << "}" << std::endl;
+        return 0;
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Corpus:     " << corpus.files << " files, " << mb << " MB (seed " << config.seed
+              << ", generated in " << generateSeconds << " s)" << std::endl;
+    std::cout << "Indexing:   " << indexSeconds << " s, " << filesPerSecond << " files/s, " << mbPerSecond
+              << " MB/s" << std::endl;
+    MetricsSnapshot stages = indexer.metrics().snapshot();
+    std::cout << "Stages:    ";
+    for (size_t i = 0; i < stages.stages.size(); ++i) {
+        std::cout << " " << stageName(static_cast<Stage>(i)) << "="
+                  << static_cast<double>(stages.stages[i].sum) / 1e6 << "ms";
+    }
+    std::cout << std::endl;
+    std::cout << "Peak RSS:   " << static_cast<double>(peakRssBytes()) / (1024.0 * 1024.0) << " MB" << std::endl;
+    std::cout << "Cache:      " << static_cast<double>(cacheBytes) / (1024.0 * 1024.0) << " MB, saved in "
+              << saveSeconds << " s, loaded in " << loadSeconds << " s" << std::endl;
+    std::cout << "Queries:    (top 20, result cache disabled, " << totalHits << " hits total)" << std::endl;
+    for (const auto& entry : latencies) {
+        std::cout << "  " << std::left << std::setw(8) << entry.first << std::right << " n=" << std::setw(5)
+                  << entry.second.micros.size() << "  p50=" << std::setw(9) << entry.second.percentile(0.50)
+                  << " us  p99=" << std::setw(9) << entry.second.percentile(0.99) << " us" << std::endl;
+    }
+    return 0;
+}
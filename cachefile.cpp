@@ -0,0 +1,477 @@
+// CacheFile.cpp
+#include "cachefile.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "compression.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define FILESEARCH_CRC_SSE42 1
+#elif defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <nmmintrin.h>
+#define FILESEARCH_CRC_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define FILESEARCH_CRC_ARM 1
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const size_t HEADER_BYTES = 8 + 4 + 4 + 4;
+const size_t TABLE_ENTRY_BYTES = 4 + 4 + 8 + 8;
+const uint32_t MAX_SECTIONS = 64;
+const size_t BLOCK_ENTRY_BYTES = 1 + 4 + 4 + 4;
+const size_t MAX_BLOCK_BYTES = size_t(1) << 30;
+
+enum BlockCodec : uint8_t {
+    STORED = 0,
+    LZ = 1
+};
+
+std::array<uint32_t, 256> makeCrcTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+uint32_t crc32cTable(const uint8_t* p, size_t length, uint32_t crc) {
+    static const std::array<uint32_t, 256> table = makeCrcTable();
+    while (length--) {
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(FILESEARCH_CRC_SSE42)
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sse4.2")))
+#endif
+uint32_t crc32cHardware(const uint8_t* p, size_t length, uint32_t crc) {
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+bool hasHardwareCrc() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#elif defined(FILESEARCH_CRC_ARM)
+uint32_t crc32cHardware(const uint8_t* p, size_t length, uint32_t crc) {
+    while (length >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+        p += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+bool hasHardwareCrc() {
+    return true;
+}
+#endif
+
+void throwIoError(const std::string& filename, const char* what) {
+    throw CacheFormatError(filename + ": " + what + " (" + std::strerror(errno) + ")");
+}
+
+uint32_t loadU32(const char* p) {
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint32_t>(b[0]) | static_cast<uint32_t>(b[1]) << 8 | static_cast<uint32_t>(b[2]) << 16 |
+           static_cast<uint32_t>(b[3]) << 24;
+}
+
+uint64_t loadU64(const char* p) {
+    return static_cast<uint64_t>(loadU32(p)) | static_cast<uint64_t>(loadU32(p + 4)) << 32;
+}
+
+size_t checkedCount(uint64_t n, size_t minElementBytes, size_t remaining) {
+    if (minElementBytes == 0) minElementBytes = 1;
+    if (n > remaining / minElementBytes) {
+        throw CacheFormatError("count " + std::to_string(n) + " exceeds the remaining " +
+                               std::to_string(remaining) + " bytes");
+    }
+    return static_cast<size_t>(n);
+}
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t length, uint32_t crc) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+#if defined(FILESEARCH_CRC_SSE42) || defined(FILESEARCH_CRC_ARM)
+    static const bool hardware = hasHardwareCrc();
+    if (hardware) {
+        return ~crc32cHardware(p, length, crc);
+    }
+#endif
+    return ~crc32cTable(p, length, crc);
+}
+
+void BinaryWriter::u32(uint32_t value) {
+    char bytes[4];
+    for (int i = 0; i < 4; ++i) {
+        bytes[i] = static_cast<char>(value >> (8 * i));
+    }
+    m_data.append(bytes, sizeof(bytes));
+}
+
+void BinaryWriter::u64(uint64_t value) {
+    u32(static_cast<uint32_t>(value));
+    u32(static_cast<uint32_t>(value >> 32));
+}
+
+void BinaryWriter::varint(uint64_t value) {
+    while (value >= 0x80) {
+        m_data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    m_data.push_back(static_cast<char>(value));
+}
+
+void BinaryWriter::string(const std::string& value) {
+    varint(value.size());
+    m_data.append(value);
+}
+
+void BinaryReader::need(size_t length) const {
+    if (length > m_size - m_offset) {
+        throw CacheFormatError("truncated data: need " + std::to_string(length) + " bytes, " +
+                               std::to_string(m_size - m_offset) + " left");
+    }
+}
+
+uint8_t BinaryReader::u8() {
+    need(1);
+    return static_cast<uint8_t>(m_data[m_offset++]);
+}
+
+uint32_t BinaryReader::u32() {
+    need(4);
+    uint32_t value = loadU32(m_data + m_offset);
+    m_offset += 4;
+    return value;
+}
+
+uint64_t BinaryReader::u64() {
+    need(8);
+    uint64_t value = loadU64(m_data + m_offset);
+    m_offset += 8;
+    return value;
+}
+
+uint64_t BinaryReader::varint() {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = u8();
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    throw CacheFormatError("varint longer than 10 bytes");
+}
+
+std::string BinaryReader::string() {
+    size_t length = count(1);
+    return std::string(bytes(length), length);
+}
+
+size_t BinaryReader::count(size_t minElementBytes) {
+    uint64_t n = varint();
+    return checkedCount(n, minElementBytes, remaining());
+}
+
+size_t BinaryReader::fixedCount(size_t minElementBytes) {
+    uint64_t n = u64();
+    return checkedCount(n, minElementBytes, remaining());
+}
+
+const char* BinaryReader::bytes(size_t length) {
+    need(length);
+    const char* p = m_data + m_offset;
+    m_offset += length;
+    return p;
+}
+
+void BlockWriter::endRecord() {
+    m_records++;
+    if (m_block.data().size() >= m_target) {
+        flush();
+    }
+}
+
+void BlockWriter::flush() {
+    if (m_records == 0) return;
+
+    const std::string& raw = m_block.data();
+    if (raw.size() > MAX_BLOCK_BYTES) {
+        throw CacheFormatError("a single block of " + std::to_string(raw.size()) + " bytes is too large");
+    }
+    std::string compressed = lzCompress(raw.data(), raw.size());
+    bool useLz = compressed.size() < raw.size();
+    const std::string& stored = useLz ? compressed : raw;
+
+    m_table.u8(useLz ? LZ : STORED);
+    m_table.u32(static_cast<uint32_t>(raw.size()));
+    m_table.u32(static_cast<uint32_t>(stored.size()));
+    m_table.u32(m_records);
+    m_stored += stored;
+
+    m_blockCount++;
+    m_records = 0;
+    m_block.data().clear();
+}
+
+std::string BlockWriter::finish() {
+    flush();
+    BinaryWriter section;
+    section.u32(m_blockCount);
+    section.data() += m_table.data();
+    section.data() += m_stored;
+    m_table.data().clear();
+    m_stored.clear();
+    m_blockCount = 0;
+    return std::move(section.data());
+}
+
+std::vector<CacheBlock> readBlockTable(const std::string& section) {
+    BinaryReader in(section.data(), section.size());
+    size_t blockCount = checkedCount(in.u32(), BLOCK_ENTRY_BYTES, in.remaining());
+
+    std::vector<CacheBlock> blocks(blockCount);
+    for (auto& block : blocks) {
+        block.codec = in.u8();
+        block.rawSize = in.u32();
+        block.storedSize = in.u32();
+        block.records = in.u32();
+        if (block.codec != STORED && block.codec != LZ) {
+            throw CacheFormatError("unknown block codec " + std::to_string(block.codec));
+        }
+        // Every record takes at least a byte, and a match token can expand to at most ~255 bytes
+        if (block.rawSize > MAX_BLOCK_BYTES || block.records > block.rawSize ||
+            (block.codec == STORED && block.storedSize != block.rawSize) ||
+            (block.codec == LZ && block.rawSize > block.storedSize * 256 + 16)) {
+            throw CacheFormatError("bad block size");
+        }
+    }
+    for (auto& block : blocks) {
+        block.data = in.bytes(block.storedSize);
+    }
+    if (!in.atEnd()) {
+        throw CacheFormatError("unexpected data after the last block");
+    }
+    return blocks;
+}
+
+std::string decodeBlock(const CacheBlock& block) {
+    if (block.codec == STORED) {
+        return std::string(block.data, block.storedSize);
+    }
+    std::string raw(block.rawSize, '\0');
+    if (!lzDecompress(block.data, block.storedSize, &raw[0], raw.size())) {
+        throw CacheFormatError("corrupt compressed block");
+    }
+    return raw;
+}
+
+const char cachefile::MAGIC[8] = {'F', 'S', 'I', 'D', 'X', '\0', '\r', '\n'};
+
+void CacheFileWriter::addSection(uint32_t id, std::string data) {
+    m_sections.emplace_back(id, std::move(data));
+}
+
+bool CacheFileWriter::commit(const std::string& filename, std::string* error) const {
+    BinaryWriter header;
+    header.bytes(cachefile::MAGIC, sizeof(cachefile::MAGIC));
+    header.u32(cachefile::VERSION);
+    header.u32(cachefile::BYTE_ORDER_TAG);
+    header.u32(static_cast<uint32_t>(m_sections.size()));
+
+    uint64_t offset = HEADER_BYTES + m_sections.size() * TABLE_ENTRY_BYTES + 4;
+    for (const auto& section : m_sections) {
+        header.u32(section.first);
+        header.u32(crc32c(section.second.data(), section.second.size()));
+        header.u64(offset);
+        header.u64(section.second.size());
+        offset += section.second.size();
+    }
+    header.u32(crc32c(header.data().data(), header.data().size()));
+
+#ifdef _WIN32
+    std::string temp = filename + ".tmp" + std::to_string(_getpid());
+#else
+    std::string temp = filename + ".tmp" + std::to_string(getpid());
+#endif
+
+    auto fail = [&](const char* what) {
+        if (error) *error = temp + ": " + what + " (" + std::strerror(errno) + ")";
+        std::error_code ec;
+        fs::remove(temp, ec);
+        return false;
+    };
+
+    FILE* file = std::fopen(temp.c_str(), "wb");
+    if (!file) return fail("cannot create");
+
+    bool written = std::fwrite(header.data().data(), 1, header.data().size(), file) == header.data().size();
+    for (const auto& section : m_sections) {
+        if (!written) break;
+        written = std::fwrite(section.second.data(), 1, section.second.size(), file) == section.second.size();
+    }
+    written = written && std::fflush(file) == 0;
+#ifdef _WIN32
+    written = written && _commit(_fileno(file)) == 0;
+#else
+    written = written && fsync(fileno(file)) == 0;
+#endif
+    if (std::fclose(file) != 0 || !written) return fail("write failed");
+
+    std::error_code ec;
+    fs::rename(temp, filename, ec);
+    if (ec) {
+        errno = ec.value();
+        return fail("cannot rename over the cache");
+    }
+
+#ifndef _WIN32
+    // Make the rename itself durable
+    fs::path directory = fs::path(filename).parent_path();
+    int dirFd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        ::close(dirFd);
+    }
+#endif
+    return true;
+}
+
+bool CacheFileReader::open(const std::string& filename) {
+    m_filename = filename;
+    m_sections.clear();
+
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) throwIoError(filename, "cannot open");
+
+    char header[HEADER_BYTES];
+    in.read(header, sizeof(header));
+    if (in.gcount() < static_cast<std::streamsize>(sizeof(cachefile::MAGIC)) ||
+        std::memcmp(header, cachefile::MAGIC, sizeof(cachefile::MAGIC)) != 0) {
+        return false;
+    }
+    if (in.gcount() != static_cast<std::streamsize>(sizeof(header))) {
+        throw CacheFormatError(filename + ": truncated header");
+    }
+
+    m_version = loadU32(header + 8);
+    // Version 3 came from a short-lived build before blocks were compressed;
+    // its files aren't worth a reader of their own, but say what to do about them
+    if (m_version < cachefile::MIN_VERSION) {
+        throw CacheFormatError(filename + ": cache version " + std::to_string(m_version) +
+                               " was written by an older build and can't be read; run 'index' (or 'update') to rebuild it");
+    }
+    if (m_version > cachefile::VERSION) {
+        throw CacheFormatError(filename + ": cache version " + std::to_string(m_version) +
+                               " was written by a newer build; this one reads up to version " +
+                               std::to_string(cachefile::VERSION));
+    }
+    if (loadU32(header + 12) != cachefile::BYTE_ORDER_TAG) {
+        throw CacheFormatError(filename + ": bad byte-order tag");
+    }
+    uint32_t sectionCount = loadU32(header + 16);
+    if (sectionCount > MAX_SECTIONS) {
+        throw CacheFormatError(filename + ": implausible section count " + std::to_string(sectionCount));
+    }
+
+    std::string table(sectionCount * TABLE_ENTRY_BYTES + 4, '\0');
+    in.read(&table[0], static_cast<std::streamsize>(table.size()));
+    if (in.gcount() != static_cast<std::streamsize>(table.size())) {
+        throw CacheFormatError(filename + ": truncated section table");
+    }
+
+    uint32_t crc = crc32c(header, sizeof(header));
+    crc = crc32c(table.data(), table.size() - 4, crc);
+    if (crc != loadU32(table.data() + table.size() - 4)) {
+        throw CacheFormatError(filename + ": header checksum mismatch");
+    }
+
+    in.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+    for (uint32_t i = 0; i < sectionCount; ++i) {
+        const char* entry = table.data() + i * TABLE_ENTRY_BYTES;
+        cachefile::Section section{loadU32(entry), loadU32(entry + 4), loadU64(entry + 8), loadU64(entry + 16)};
+        if (section.offset > fileSize || section.length > fileSize - section.offset) {
+            throw CacheFormatError(filename + ": section " + std::to_string(section.id) + " runs past the end of the file");
+        }
+        m_sections.push_back(section);
+    }
+    return true;
+}
+
+bool CacheFileReader::hasSection(uint32_t id) const {
+    for (const auto& section : m_sections) {
+        if (section.id == id) return true;
+    }
+    return false;
+}
+
+std::string CacheFileReader::readSection(uint32_t id) const {
+    for (const auto& section : m_sections) {
+        if (section.id != id) continue;
+
+        std::ifstream in(m_filename, std::ios::binary);
+        if (!in) throwIoError(m_filename, "cannot reopen");
+        in.seekg(static_cast<std::streamoff>(section.offset));
+
+        std::string data(static_cast<size_t>(section.length), '\0');
+        in.read(&data[0], static_cast<std::streamsize>(data.size()));
+        if (in.gcount() != static_cast<std::streamsize>(data.size())) {
+            throw CacheFormatError(m_filename + ": short read in section " + std::to_string(id));
+        }
+        if (crc32c(data.data(), data.size()) != section.crc) {
+            throw CacheFormatError(m_filename + ": checksum mismatch in section " + std::to_string(id));
+        }
+        return data;
+    }
+    throw CacheFormatError(m_filename + ": missing section " + std::to_string(id));
+}
@@ -0,0 +1,174 @@
+// CacheFile.h
+#ifndef CACHEFILE_H
+#define CACHEFILE_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 / ARMv8 CRC instructions when the CPU
+// has them and a lookup table otherwise; pass the previous result to continue a running CRC.
+uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
+
+// Thrown for truncated, oversized or otherwise malformed cache data
+class CacheFormatError : public std::runtime_error {
+public:
+    explicit CacheFormatError(const std::string& what) : std::runtime_error(what) {}
+};
+
+// Appends little-endian fixed-width values and LEB128 varints to a byte buffer,
+// independent of host byte order
+class BinaryWriter {
+public:
+    void u8(uint8_t value) { m_data.push_back(static_cast<char>(value)); }
+    void u32(uint32_t value);
+    void u64(uint64_t value);
+    void i64(int64_t value) { u64(static_cast<uint64_t>(value)); }
+    void varint(uint64_t value);
+    void string(const std::string& value); // varint length + bytes
+    void bytes(const void* data, size_t length) { m_data.append(static_cast<const char*>(data), length); }
+
+    const std::string& data() const { return m_data; }
+    std::string& data() { return m_data; }
+
+private:
+    std::string m_data;
+};
+
+// Reads what BinaryWriter wrote. Every read is checked against the end of the
+// buffer, and counts are checked against the bytes left before anything is
+// allocated, so corrupt input throws CacheFormatError instead of over-reading
+// or reserving gigabytes.
+class BinaryReader {
+public:
+    BinaryReader(const char* data, size_t size) : m_data(data), m_size(size) {}
+
+    uint8_t u8();
+    uint32_t u32();
+    uint64_t u64();
+    int64_t i64() { return static_cast<int64_t>(u64()); }
+    uint64_t varint();
+    std::string string();
+    // A varint element count, rejected if the remaining bytes can't hold count * minElementBytes
+    size_t count(size_t minElementBytes);
+    // Same check for a u64 count, as written by caches before version 4
+    size_t fixedCount(size_t minElementBytes);
+    // Raw bytes; the pointer stays valid as long as the underlying buffer
+    const char* bytes(size_t length);
+
+    size_t remaining() const { return m_size - m_offset; }
+    bool atEnd() const { return m_offset == m_size; }
+
+private:
+    const char* m_data;
+    size_t m_size;
+    size_t m_offset{0};
+
+    void need(size_t length) const;
+};
+
+// Cache file layout (all integers little-endian):
+//
+//   header   magic "FSIDX\0\r\n", u32 version, u32 byte-order tag, u32 section count
+//   table    per section: u32 id, u32 CRC-32C, u64 offset, u64 length
+//   u32      CRC-32C of header + table
+//   sections at their offsets, each written by BlockWriter
+//
+// The magic's "\r\n" catches text-mode transfers that rewrite line endings.
+namespace cachefile {
+
+extern const char MAGIC[8];
+const uint32_t VERSION = 7;
+// Oldest version in this layout; version 5 added term offsets to the postings,
+// version 6 the analyzer section, version 7 per-file term counts
+const uint32_t MIN_VERSION = 4;
+const uint32_t BYTE_ORDER_TAG = 0x01020304;
+
+enum SectionId : uint32_t {
+    DIRECTORIES = 1,
+    EXTENSIONS = 2,
+    FILES = 3,
+    POSTINGS = 4,
+    HASHES = 5,  // optional: content hashes of the files that were hashed
+    ANALYZER = 6 // version 6 on: the options the terms were analyzed with
+};
+
+struct Section {
+    uint32_t id;
+    uint32_t crc;
+    uint64_t offset;
+    uint64_t length;
+};
+
+} // namespace cachefile
+
+// Builds a section out of blocks that hold whole records and are compressed
+// independently, so a reader can decompress and parse them in parallel.
+// Section layout: u32 block count, then per block u8 codec, u32 raw size,
+// u32 stored size and u32 record count, then the stored blocks back to back.
+class BlockWriter {
+public:
+    explicit BlockWriter(size_t targetBlockBytes = 256 * 1024) : m_target(targetBlockBytes) {}
+
+    // Write one record here, then call endRecord()
+    BinaryWriter& out() { return m_block; }
+    void endRecord();
+    std::string finish();
+
+private:
+    size_t m_target;
+    BinaryWriter m_block;
+    uint32_t m_records{0};
+    uint32_t m_blockCount{0};
+    BinaryWriter m_table;
+    std::string m_stored;
+
+    void flush();
+};
+
+struct CacheBlock {
+    const char* data;
+    size_t storedSize;
+    size_t rawSize;
+    size_t records;
+    uint8_t codec;
+};
+
+// Splits a BlockWriter section into its blocks; pointers refer into `section`
+std::vector<CacheBlock> readBlockTable(const std::string& section);
+// Decompresses one block; throws CacheFormatError if it doesn't decode to its recorded size
+std::string decodeBlock(const CacheBlock& block);
+
+// Collects sections and writes them with a checksummed header. The file is
+// written to a temporary name, flushed to disk and then renamed over the
+// target, so readers see either the old cache or the complete new one.
+class CacheFileWriter {
+public:
+    void addSection(uint32_t id, std::string data);
+    bool commit(const std::string& filename, std::string* error) const;
+
+private:
+    std::vector<std::pair<uint32_t, std::string>> m_sections;
+};
+
+// Opens a cache file and checks the header and section table up front (a few
+// dozen bytes), so a wrong or truncated file is rejected before any section
+// is read. Each section's CRC is checked only when that section is read.
+class CacheFileReader {
+public:
+    // False if the file isn't in this format at all (e.g. an older cache); throws on corruption
+    bool open(const std::string& filename);
+
+    uint32_t version() const { return m_version; }
+    bool hasSection(uint32_t id) const;
+    // Reads and verifies one section; throws CacheFormatError on a bad CRC or I/O error
+    std::string readSection(uint32_t id) const;
+
+private:
+    std::string m_filename;
+    uint32_t m_version{0};
+    std::vector<cachefile::Section> m_sections;
+};
+
+#endif
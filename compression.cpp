@@ -0,0 +1,133 @@
+// Compression.cpp
+#include "compression.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+const unsigned HASH_BITS = 14;
+
+inline uint32_t read32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t hash4(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths of 15 or more spill into extra bytes of up to 255 each
+void writeLength(std::string& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+bool readLength(const unsigned char*& in, const unsigned char* end, size_t& length) {
+    unsigned char byte;
+    do {
+        if (in == end) return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+void emitSequence(std::string& out, const char* literals, size_t literalCount, size_t matchLength,
+                  size_t offset, bool last) {
+    size_t matchCode = last ? 0 : matchLength - MIN_MATCH;
+    unsigned token = static_cast<unsigned>((literalCount < 15 ? literalCount : 15) << 4 |
+                                           (matchCode < 15 ? matchCode : 15));
+    out.push_back(static_cast<char>(token));
+    if (literalCount >= 15) writeLength(out, literalCount - 15);
+    out.append(literals, literalCount);
+    if (last) return;
+
+    out.push_back(static_cast<char>(offset & 0xFF));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (matchCode >= 15) writeLength(out, matchCode - 15);
+}
+
+} // namespace
+
+std::string lzCompress(const char* data, size_t size) {
+    std::string out;
+    out.reserve(size / 2 + 16);
+
+    // Position + 1 of the last occurrence of each hashed 4-byte sequence; 0 is empty
+    std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    while (pos + MIN_MATCH <= size) {
+        uint32_t sequence = read32(data + pos);
+        uint32_t& slot = table[hash4(sequence)];
+        size_t candidate = slot;
+        slot = static_cast<uint32_t>(pos + 1);
+
+        if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET || read32(data + candidate - 1) != sequence) {
+            pos++;
+            continue;
+        }
+
+        size_t match = candidate - 1;
+        size_t length = MIN_MATCH;
+        while (pos + length < size && data[match + length] == data[pos + length]) {
+            length++;
+        }
+
+        emitSequence(out, data + anchor, pos - anchor, length, pos - match, false);
+        pos += length;
+        anchor = pos;
+    }
+
+    emitSequence(out, data + anchor, size - anchor, 0, 0, true);
+    return out;
+}
+
+bool lzDecompress(const char* data, size_t size, char* out, size_t rawSize) {
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = in + size;
+    size_t written = 0;
+
+    while (in < end) {
+        unsigned token = *in++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(in, end, literals)) return false;
+        if (literals > static_cast<size_t>(end - in) || literals > rawSize - written) return false;
+        std::memcpy(out + written, in, literals);
+        in += literals;
+        written += literals;
+
+        // The final sequence is literals only
+        if (in == end) break;
+
+        if (end - in < 2) return false;
+        size_t offset = static_cast<size_t>(in[0]) | static_cast<size_t>(in[1]) << 8;
+        in += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(in, end, length)) return false;
+        length += MIN_MATCH;
+        if (offset == 0 || offset > written || length > rawSize - written) return false;
+
+        char* dst = out + written;
+        const char* src = dst - offset;
+        if (offset >= length) {
+            std::memcpy(dst, src, length);
+        } else {
+            // Overlapping copy repeats the last `offset` bytes
+            for (size_t i = 0; i < length; ++i) {
+                dst[i] = src[i];
+            }
+        }
+        written += length;
+    }
+    return written == rawSize;
+}
@@ -0,0 +1,25 @@
+// Compression.h
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <cstddef>
+#include <string>
+
+// Small byte-oriented LZ77 codec in the spirit of LZ4: greedy matching through
+// a single-entry hash table, with offsets of up to 64 KiB. Favours decode speed
+// over ratio, which suits cache files that are written once and loaded often.
+//
+// A compressed buffer is a series of sequences:
+//   token     high nibble literal count, low nibble match length - 4; a nibble
+//             of 15 continues in extra bytes (after the token for literals,
+//             after the offset for matches), each adding up to 255
+//   literals
+//   offset    u16 little-endian
+// The final sequence stops after its literals.
+std::string lzCompress(const char* data, size_t size);
+
+// Decodes exactly rawSize bytes into out; false on malformed input, never reads
+// or writes out of bounds
+bool lzDecompress(const char* data, size_t size, char* out, size_t rawSize);
+
+#endif
@@ -0,0 +1,171 @@
+// ContentHash.cpp
+#include "contenthash.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FILESEARCH_HASH_SSE2 1
+#endif
+
+namespace {
+
+const uint64_t PRIME32_1 = 0x9E3779B1U;
+const uint64_t PRIME32_2 = 0x85EBCA77U;
+const uint64_t PRIME32_3 = 0xC2B2AE3DU;
+const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+// Like xxHash3's secret: stripe n of a block is keyed with words [n, n + 8),
+// and the block scramble uses the last eight
+const uint64_t SECRET[24] = {
+    0xD79D7B3158CCA253ULL, 0x34DF4113D10BE5DCULL, 0xE4BA8B712048E194ULL, 0x4B8EE2CE410FE538ULL,
+    0x02C8F1F48564DDB5ULL, 0xC818A04D3ACB44ABULL, 0x4C26901F4E89253CULL, 0x766DBF7BF3D78143ULL,
+    0x92C5C35C7FA5D21CULL, 0x43711ACFD4CA7565ULL, 0x1D2E0AA6FF673ACCULL, 0xD7BFB7A0B88C2E05ULL,
+    0xB875D768D7395D14ULL, 0xA405E8FBF0101702ULL, 0x68DA9A18DE3184EBULL, 0x73D92D7B3B8ECEC8ULL,
+    0x644871D08DA41E28ULL, 0x7028E193118E975FULL, 0x8631CF17C8D34B8CULL, 0x08EDA4071A8540C7ULL,
+    0xEAD08BB2CB35B0D1ULL, 0x0EA338DB51858977ULL, 0xC9FCFBE1835E1E7CULL, 0x2B4AC7EA7627EE3CULL,
+};
+
+inline uint64_t load64(const unsigned char* p) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = value << 8 | p[i];
+    }
+    return value;
+}
+
+// acc[i] += lo32(data ^ key) * hi32(data ^ key); the neighbouring lane also
+// takes the raw word so no input bit is lost to the multiply
+inline void accumulate(uint64_t* acc, const unsigned char* stripe, const uint64_t* key) {
+#if defined(FILESEARCH_HASH_SSE2)
+    __m128i* lanes = reinterpret_cast<__m128i*>(acc);
+    for (int i = 0; i < 4; ++i) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stripe) + i);
+        __m128i keyed = _mm_xor_si128(data, _mm_loadu_si128(reinterpret_cast<const __m128i*>(key) + i));
+        __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+        __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, swapped));
+    }
+#else
+    for (int i = 0; i < 8; ++i) {
+        uint64_t data = load64(stripe + 8 * i);
+        uint64_t keyed = data ^ key[i];
+        acc[i ^ 1] += data;
+        acc[i] += (keyed & 0xFFFFFFFFULL) * (keyed >> 32);
+    }
+#endif
+}
+
+inline void scramble(uint64_t* acc) {
+    const uint64_t* key = SECRET + 16;
+    for (int i = 0; i < 8; ++i) {
+        uint64_t lane = acc[i];
+        lane ^= lane >> 47;
+        lane ^= key[i];
+        acc[i] = lane * PRIME32_1;
+    }
+}
+
+// Low 64 bits xor high 64 bits of the 128-bit product
+uint64_t mulFold64(uint64_t a, uint64_t b) {
+    uint64_t aLo = a & 0xFFFFFFFFULL, aHi = a >> 32;
+    uint64_t bLo = b & 0xFFFFFFFFULL, bHi = b >> 32;
+    uint64_t loLo = aLo * bLo;
+    uint64_t hiLo = aHi * bLo;
+    uint64_t loHi = aLo * bHi;
+    uint64_t hiHi = aHi * bHi;
+    uint64_t cross = (loLo >> 32) + (hiLo & 0xFFFFFFFFULL) + loHi;
+    uint64_t upper = (hiLo >> 32) + (cross >> 32) + hiHi;
+    uint64_t lower = (cross << 32) | (loLo & 0xFFFFFFFFULL);
+    return lower ^ upper;
+}
+
+uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace
+
+ContentHasher::ContentHasher()
+    : m_acc{PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1} {}
+
+void ContentHasher::consumeStripe(const unsigned char* stripe) {
+    accumulate(m_acc, stripe, SECRET + m_stripesInBlock);
+    if (++m_stripesInBlock == STRIPES_PER_BLOCK) {
+        scramble(m_acc);
+        m_stripesInBlock = 0;
+    }
+}
+
+void ContentHasher::update(const void* data, size_t length) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    m_length += length;
+
+    if (m_buffered > 0) {
+        size_t take = std::min(length, STRIPE - m_buffered);
+        std::memcpy(m_buffer + m_buffered, p, take);
+        m_buffered += take;
+        p += take;
+        length -= take;
+        if (m_buffered < STRIPE) return;
+        consumeStripe(m_buffer);
+        m_buffered = 0;
+    }
+
+    while (length >= STRIPE) {
+        consumeStripe(p);
+        p += STRIPE;
+        length -= STRIPE;
+    }
+
+    std::memcpy(m_buffer, p, length);
+    m_buffered = length;
+}
+
+uint64_t ContentHasher::digest() const {
+    alignas(16) uint64_t acc[8];
+    std::memcpy(acc, m_acc, sizeof(acc));
+
+    // A partial final stripe is zero-padded; the length mixed in below tells the padding apart
+    if (m_buffered > 0) {
+        unsigned char last[STRIPE] = {};
+        std::memcpy(last, m_buffer, m_buffered);
+        accumulate(acc, last, SECRET + m_stripesInBlock);
+    }
+
+    uint64_t result = m_length * PRIME64_1;
+    for (int i = 0; i < 4; ++i) {
+        result += mulFold64(acc[2 * i] ^ SECRET[2 * i + 3], acc[2 * i + 1] ^ SECRET[2 * i + 4]);
+    }
+    return avalanche(result);
+}
+
+uint64_t hashContent(const void* data, size_t length) {
+    ContentHasher hasher;
+    hasher.update(data, length);
+    return hasher.digest();
+}
+
+bool hashFile(const std::filesystem::path& path, uint64_t& hash) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+
+    ContentHasher hasher;
+    char chunk[64 * 1024];
+    while (file) {
+        file.read(chunk, sizeof(chunk));
+        hasher.update(chunk, static_cast<size_t>(file.gcount()));
+    }
+    if (file.bad()) return false;
+
+    hash = hasher.digest();
+    return true;
+}
@@ -0,0 +1,38 @@
+// ContentHash.h
+#ifndef CONTENTHASH_H
+#define CONTENTHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// 64-bit non-cryptographic content hash built like xxHash3's long-input path:
+// eight 64-bit lanes each take one 8-byte word per 64-byte stripe with a
+// 32x32->64 multiply, and the lanes are scrambled every 1 KiB. The lane loop
+// is written with SSE2 where available (and is auto-vectorizable elsewhere).
+// Values are stable across platforms but are not xxHash3-compatible.
+class ContentHasher {
+public:
+    ContentHasher();
+
+    void update(const void* data, size_t length);
+    uint64_t digest() const;
+
+private:
+    static const size_t STRIPE = 64;
+    static const size_t STRIPES_PER_BLOCK = 16;
+
+    alignas(16) uint64_t m_acc[8];
+    unsigned char m_buffer[STRIPE];
+    size_t m_buffered{0};
+    size_t m_stripesInBlock{0};
+    uint64_t m_length{0};
+
+    void consumeStripe(const unsigned char* stripe);
+};
+
+uint64_t hashContent(const void* data, size_t length);
+// Streams the file in chunks; false if it can't be read completely
+bool hashFile(const std::filesystem::path& path, uint64_t& hash);
+
+#endif
@@ -0,0 +1,309 @@
+// Ignore.cpp
+#include "ignore.h"
+#include <algorithm>
+#include <fstream>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+inline size_t lowestBit(uint64_t bits) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return index;
+#else
+    return static_cast<size_t>(__builtin_ctzll(bits));
+#endif
+}
+
+inline void setState(uint64_t* states, size_t state) {
+    states[state >> 6] |= uint64_t(1) << (state & 63);
+}
+
+inline bool hasState(const uint64_t* states, size_t state) {
+    return (states[state >> 6] >> (state & 63)) & 1;
+}
+
+bool hasWildcard(const std::string& glob) {
+    return glob.find_first_of("*?[\\") != std::string::npos;
+}
+
+} // namespace
+
+GlobPattern::GlobPattern(const std::string& glob) {
+    const size_t n = glob.size();
+    auto push = [this](Kind kind, unsigned char ch = 0, uint16_t classIndex = 0) {
+        m_tokens.push_back({kind, ch, classIndex});
+        if (kind == Kind::LITERAL) {
+            m_literal.push_back(static_cast<char>(ch));
+        } else {
+            m_isLiteral = false;
+        }
+    };
+
+    size_t i = 0;
+    while (i < n) {
+        char c = glob[i];
+        if (c == '*') {
+            // "**" is special only as a whole path component
+            bool componentStart = i == 0 || glob[i - 1] == '/';
+            if (componentStart && i + 1 < n && glob[i + 1] == '*') {
+                if (i + 2 == n) {
+                    push(Kind::ANY_PATH);
+                    i += 2;
+                    continue;
+                }
+                if (glob[i + 2] == '/') {
+                    push(Kind::DIRS);
+                    push(Kind::DIRS_LOOP);
+                    i += 3;
+                    continue;
+                }
+            }
+            while (i < n && glob[i] == '*') i++;
+            push(Kind::STAR);
+        } else if (c == '?') {
+            push(Kind::ANY);
+            i++;
+        } else if (c == '\\') {
+            push(Kind::LITERAL, static_cast<unsigned char>(i + 1 < n ? glob[i + 1] : '\\'));
+            i += 2;
+        } else if (c == '[') {
+            size_t j = i + 1;
+            bool negate = j < n && (glob[j] == '!' || glob[j] == '^');
+            if (negate) j++;
+
+            std::array<uint64_t, 4> members{};
+            bool closed = false;
+            for (bool first = true; j < n; first = false) {
+                if (glob[j] == ']' && !first) {
+                    closed = true;
+                    j++;
+                    break;
+                }
+                if (glob[j] == '\\' && j + 1 < n) j++;
+                unsigned char low = static_cast<unsigned char>(glob[j++]);
+                unsigned char high = low;
+                if (j + 1 < n && glob[j] == '-' && glob[j + 1] != ']') {
+                    if (glob[j + 1] == '\\' && j + 2 < n) j++;
+                    high = static_cast<unsigned char>(glob[j + 1]);
+                    j += 2;
+                }
+                for (unsigned value = low; value <= high; ++value) {
+                    members[value >> 6] |= uint64_t(1) << (value & 63);
+                }
+            }
+
+            // An unterminated class is just a '['
+            if (!closed || m_classes.size() == UINT16_MAX) {
+                push(Kind::LITERAL, '[');
+                i++;
+                continue;
+            }
+            if (negate) {
+                for (auto& word : members) word = ~word;
+            }
+            members['/' >> 6] &= ~(uint64_t(1) << ('/' & 63));
+            m_classes.push_back(members);
+            push(Kind::CLASS, 0, static_cast<uint16_t>(m_classes.size() - 1));
+            i = j;
+        } else {
+            push(Kind::LITERAL, static_cast<unsigned char>(c));
+            i++;
+        }
+    }
+}
+
+void GlobPattern::closure(uint64_t* states) const {
+    for (size_t s = 0; s < m_tokens.size(); ++s) {
+        if (!hasState(states, s)) continue;
+        switch (m_tokens[s].kind) {
+        case Kind::DIRS:
+            setState(states, s + 2);
+            setState(states, s + 1);
+            break;
+        case Kind::STAR:
+        case Kind::ANY_PATH:
+            setState(states, s + 1);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+bool GlobPattern::matches(std::string_view text) const {
+    if (m_isLiteral) return text == m_literal;
+
+    // State s means "token s is next"; the state after the last token accepts
+    const size_t accept = m_tokens.size();
+    const size_t words = accept / 64 + 1;
+    uint64_t local[8];
+    std::vector<uint64_t> heap;
+    uint64_t* current = local;
+    if (words * 2 > sizeof(local) / sizeof(local[0])) {
+        heap.resize(words * 2);
+        current = heap.data();
+    }
+    uint64_t* next = current + words;
+
+    std::fill(current, current + words, 0);
+    setState(current, 0);
+    closure(current);
+
+    for (char ch : text) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        std::fill(next, next + words, 0);
+        for (size_t w = 0; w < words; ++w) {
+            for (uint64_t bits = current[w]; bits; bits &= bits - 1) {
+                size_t s = w * 64 + lowestBit(bits);
+                if (s == accept) continue;
+
+                const Token& token = m_tokens[s];
+                switch (token.kind) {
+                case Kind::LITERAL:
+                    if (c == token.ch) setState(next, s + 1);
+                    break;
+                case Kind::ANY:
+                    if (c != '/') setState(next, s + 1);
+                    break;
+                case Kind::CLASS:
+                    if ((m_classes[token.classIndex][c >> 6] >> (c & 63)) & 1) setState(next, s + 1);
+                    break;
+                case Kind::STAR:
+                    if (c != '/') setState(next, s);
+                    break;
+                case Kind::ANY_PATH:
+                    setState(next, s);
+                    break;
+                case Kind::DIRS:
+                    break;
+                case Kind::DIRS_LOOP:
+                    setState(next, s);
+                    if (c == '/') setState(next, s + 1);
+                    break;
+                }
+            }
+        }
+        closure(next);
+        std::swap(current, next);
+
+        if (std::all_of(current, current + words, [](uint64_t word) { return word == 0; })) {
+            return false;
+        }
+    }
+    return hasState(current, accept);
+}
+
+void IgnoreRules::addLine(std::string line) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    // Trailing spaces don't count unless escaped with a backslash
+    while (!line.empty() && line.back() == ' ' && !(line.size() >= 2 && line[line.size() - 2] == '\\')) {
+        line.pop_back();
+    }
+    if (line.empty() || line[0] == '#') return;
+
+    bool negated = line[0] == '!';
+    if (negated) line.erase(0, 1);
+
+    bool directoryOnly = !line.empty() && line.back() == '/';
+    if (directoryOnly) line.pop_back();
+
+    bool nameOnly = line.find('/') == std::string::npos;
+    if (!nameOnly && line[0] == '/') line.erase(0, 1);
+    if (line.empty()) return;
+
+    uint32_t index = static_cast<uint32_t>(m_rules.size());
+    if (nameOnly && !hasWildcard(line)) {
+        m_names[line].push_back(index);
+    } else if (nameOnly && line[0] == '*' && line.size() > 1 && !hasWildcard(line.substr(1))) {
+        std::string suffix = line.substr(1);
+        if (std::find(m_suffixLengths.begin(), m_suffixLengths.end(), suffix.size()) == m_suffixLengths.end()) {
+            m_suffixLengths.push_back(suffix.size());
+        }
+        m_suffixes[suffix].push_back(index);
+    } else {
+        m_globs.push_back(index);
+    }
+    m_rules.push_back({GlobPattern(line), negated, directoryOnly, nameOnly});
+}
+
+bool IgnoreRules::loadFile(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    std::string line;
+    for (bool first = true; std::getline(in, line); first = false) {
+        if (first && line.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+            line.erase(0, 3);
+        }
+        addLine(line);
+    }
+    return true;
+}
+
+void IgnoreRules::consider(const std::vector<uint32_t>& ids, bool isDirectory, int64_t& best) const {
+    for (auto it = ids.rbegin(); it != ids.rend() && static_cast<int64_t>(*it) > best; ++it) {
+        if (m_rules[*it].directoryOnly && !isDirectory) continue;
+        best = *it;
+        return;
+    }
+}
+
+IgnoreRules::Match IgnoreRules::match(std::string_view relative, const std::string& name, bool isDirectory) const {
+    if (m_rules.empty()) return Match::NONE;
+
+    int64_t best = -1;
+    if (!m_names.empty()) {
+        auto it = m_names.find(name);
+        if (it != m_names.end()) consider(it->second, isDirectory, best);
+    }
+    for (size_t length : m_suffixLengths) {
+        if (name.size() < length) continue;
+        auto it = m_suffixes.find(name.substr(name.size() - length));
+        if (it != m_suffixes.end()) consider(it->second, isDirectory, best);
+    }
+
+    // Only rules after the best hit so far could change the outcome
+    for (auto it = m_globs.rbegin(); it != m_globs.rend() && static_cast<int64_t>(*it) > best; ++it) {
+        const Rule& rule = m_rules[*it];
+        if (rule.directoryOnly && !isDirectory) continue;
+        if (rule.glob.matches(rule.nameOnly ? std::string_view(name) : relative)) {
+            best = *it;
+            break;
+        }
+    }
+
+    if (best < 0) return Match::NONE;
+    return m_rules[best].negated ? Match::INCLUDE : Match::IGNORE;
+}
+
+void IgnoreStack::push(const std::string& relative, IgnoreRules rules) {
+    m_levels.push_back({relative.empty() ? 0 : relative.size() + 1, std::move(rules)});
+}
+
+void IgnoreStack::pop() {
+    m_levels.pop_back();
+}
+
+void IgnoreStack::clear() {
+    m_overrides = IgnoreRules();
+    m_defaults = IgnoreRules();
+    m_levels.clear();
+}
+
+bool IgnoreStack::isIgnored(const std::string& relative, const std::string& name, bool isDirectory) const {
+    IgnoreRules::Match match = m_overrides.match(relative, name, isDirectory);
+    if (match != IgnoreRules::Match::NONE) return match == IgnoreRules::Match::IGNORE;
+
+    for (auto level = m_levels.rbegin(); level != m_levels.rend(); ++level) {
+        std::string_view below(relative);
+        below.remove_prefix(std::min(level->prefixLength, below.size()));
+        match = level->rules.match(below, name, isDirectory);
+        if (match != IgnoreRules::Match::NONE) return match == IgnoreRules::Match::IGNORE;
+    }
+    return m_defaults.match(relative, name, isDirectory) == IgnoreRules::Match::IGNORE;
+}
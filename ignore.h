@@ -0,0 +1,121 @@
+// Ignore.h
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// A gitignore glob compiled to a small NFA: one state per token, simulated
+// with a bit set of active states, so matching is a single pass over the text
+// with no backtracking however many stars the pattern has.
+//
+//   *      any run of characters except '/'
+//   ?      any one character except '/'
+//   [a-z]  character class ('!' or '^' negates); never matches '/'
+//   **/    zero or more whole directories (at the start or after a '/')
+//   /**    everything inside (at the end)
+//   \x     literal x
+class GlobPattern {
+public:
+    explicit GlobPattern(const std::string& glob);
+
+    bool matches(std::string_view text) const;
+
+private:
+    enum class Kind : uint8_t {
+        LITERAL,
+        ANY,      // ?
+        CLASS,    // [...]
+        STAR,     // *: loops on anything but '/'
+        ANY_PATH, // trailing **: loops on anything
+        DIRS,     // **/: enters DIRS_LOOP, or skips it to match zero directories
+        DIRS_LOOP // loops on anything, leaves after a '/'
+    };
+
+    struct Token {
+        Kind kind;
+        unsigned char ch;    // LITERAL
+        uint16_t classIndex; // CLASS
+    };
+
+    std::vector<Token> m_tokens;
+    std::vector<std::array<uint64_t, 4>> m_classes; // 256-bit membership sets
+    std::string m_literal;  // the whole pattern when it has no wildcards
+    bool m_isLiteral{true};
+
+    // Follows the epsilon edges of the star tokens, which only ever point ahead
+    void closure(uint64_t* states) const;
+};
+
+// The rules of one .gitignore / .ignore file. The last rule that matches
+// decides, and a '!' rule re-includes what an earlier rule excluded.
+// Patterns without a '/' (other than a trailing one) match the name at any
+// depth; the rest are anchored to the directory holding the file.
+//
+// Plain names ("node_modules") and "*.ext" patterns, which are most rules in
+// practice, are answered by hash lookups; only the remaining rules run their
+// automaton, and only those later in the file than the best lookup hit.
+class IgnoreRules {
+public:
+    enum class Match { NONE, IGNORE, INCLUDE };
+
+    void addLine(std::string line);
+    // False if the file can't be read
+    bool loadFile(const std::filesystem::path& path);
+    bool empty() const { return m_rules.empty(); }
+
+    // relative: '/'-separated path below the rules' directory; name: its last component
+    Match match(std::string_view relative, const std::string& name, bool isDirectory) const;
+
+private:
+    struct Rule {
+        GlobPattern glob;
+        bool negated;
+        bool directoryOnly;
+        bool nameOnly; // matched against the last component only
+    };
+
+    std::vector<Rule> m_rules;
+    // Rule indices in ascending order
+    std::unordered_map<std::string, std::vector<uint32_t>> m_names;
+    std::unordered_map<std::string, std::vector<uint32_t>> m_suffixes; // "*.o" -> ".o"
+    std::vector<size_t> m_suffixLengths;
+    std::vector<uint32_t> m_globs;
+
+    // Updates best with the highest index in ids that applies, if it beats best
+    void consider(const std::vector<uint32_t>& ids, bool isDirectory, int64_t& best) const;
+};
+
+// The ignore files in effect at one point of a directory walk. Files in
+// deeper directories take precedence over shallower ones, and .ignore over
+// .gitignore in the same directory; overrides beat all of them and defaults
+// lose to all of them.
+class IgnoreStack {
+public:
+    IgnoreRules& overrides() { return m_overrides; }
+    IgnoreRules& defaults() { return m_defaults; }
+
+    // rules apply below the directory at `relative` ("" for the walk root)
+    void push(const std::string& relative, IgnoreRules rules);
+    void pop();
+    void clear();
+
+    bool isIgnored(const std::string& relative, const std::string& name, bool isDirectory) const;
+
+private:
+    struct Level {
+        size_t prefixLength; // characters of the walk-relative path that precede paths below it
+        IgnoreRules rules;
+    };
+
+    IgnoreRules m_overrides;
+    IgnoreRules m_defaults;
+    std::vector<Level> m_levels;
+};
+
+#endif
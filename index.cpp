@@ -1,21 +1,32 @@
 // Index.cpp
-#include "Index.h"
+#include "index.h"
 #include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
 #include <cctype>
+#include <future>
 #include <iostream>
+#include <thread>
+#include <type_traits>
+#include "cachefile.h"
+#include "spill.h"
 #include "utils.h"
 
 namespace fs = std::filesystem;
 
+namespace {
+
+const char* const SPILLED_ERROR = "the index has spilled postings to disk; merge them back before searching";
+
+} // namespace
+
 Index::Index() {
   
 }
 
 Index::~Index() {
-  
+    removeSpilledRuns();
 }
 
 
@@ -25,27 +36,24 @@ std::string Index::toLowerCase(const std::string& str) const {
     return result;
 }
 
+// Distinct query terms in order of first appearance
 std::vector<std::string> Index::extractWords(const std::string& text) const {
-    std::vector<std::string> words;
-    std::stringstream ss(text);
-    std::string word;
-
-    while (ss >> word) {
+    std::vector<Token> tokens;
+    m_analyzer.analyze(text, tokens, true);
 
-        word.erase(std::remove_if(word.begin(), word.end(),
-                                  [](unsigned char c) { return std::ispunct(c); }), word.end());
-        if (!word.empty()) {
-            words.push_back(toLowerCase(word));
+    std::vector<std::string> words;
+    std::unordered_set<std::string> seen;
+    for (auto& token : tokens) {
+        if (seen.insert(token.term).second) {
+            words.push_back(std::move(token.term));
         }
     }
-
     return words;
 }
 
-void Index::writeString(std::ofstream& out, const std::string& str) const {
-    size_t length = str.size();
-    out.write(reinterpret_cast<const char*>(&length), sizeof(length));
-    out.write(str.c_str(), length);
+void Index::setAnalyzerOptions(const AnalyzerOptions& options) {
+    m_generation++;
+    m_analyzer = Analyzer(options);
 }
 
 bool Index::isTextFile(const std::string& extension) const {
@@ -57,18 +65,191 @@ bool Index::isTextFile(const std::string& extension) const {
     return text_extensions.find(ext_lower) != text_extensions.end();
 }
 
-void Index::indexFileContent(const std::string& content, size_t file_index) {
-    if (content.empty()) return;
+std::vector<TermOccurrence> Index::analyzeContent(const FileMetadata& data) const {
+    if (data.content.empty() || !isTextFile(data.extension)) {
+        return {};
+    }
+
+    std::vector<Token> tokens;
+    m_analyzer.analyze(data.content, tokens);
+    std::vector<TermOccurrence> words;
+    words.reserve(tokens.size());
+    for (auto& token : tokens) {
+        words.push_back({std::move(token.term), static_cast<uint32_t>(std::min<size_t>(token.begin, NO_OFFSET - 1)), 1});
+    }
+
+    // Each word only needs one posting per file, which keeps its first offset
+    // and counts the rest
+    std::sort(words.begin(), words.end(), [](const TermOccurrence& a, const TermOccurrence& b) {
+        return a.term != b.term ? a.term < b.term : a.offset < b.offset;
+    });
+    size_t distinct = 0;
+    for (size_t i = 0; i < words.size(); ++i) {
+        if (distinct > 0 && words[distinct - 1].term == words[i].term) {
+            words[distinct - 1].count++;
+        } else {
+            if (distinct != i) words[distinct] = std::move(words[i]);
+            distinct++;
+        }
+    }
+    words.resize(distinct);
+    return words;
+}
+
+void Index::indexFileContent(const std::vector<TermOccurrence>& words, size_t file_index) {
+    // A map node holds the key, the two vectors, a next pointer and the cached hash, plus its bucket
+    const size_t TERM_BYTES = sizeof(std::pair<const std::string, PostingList>) + 3 * sizeof(void*);
 
-    std::vector<std::string> words = extractWords(content);
+    // Doc IDs only ever grow, so appending keeps every posting list sorted
     for (const auto& word : words) {
-        m_inverted_index[word].insert(file_index);
+        auto inserted = m_inverted_index.try_emplace(word.term);
+        PostingList& postings = inserted.first->second;
+        if (inserted.second) {
+            m_postings_bytes += TERM_BYTES + (word.term.size() >= sizeof(std::string) ? word.term.size() + 1 : 0);
+        }
+        if (postings.docs.empty() || postings.docs.back() != file_index) {
+            size_t docCapacity = postings.docs.capacity(), offsetCapacity = postings.offsets.capacity(),
+                   countCapacity = postings.counts.capacity();
+            postings.docs.push_back(file_index);
+            postings.offsets.push_back(word.offset);
+            postings.counts.push_back(static_cast<uint16_t>(std::min<uint32_t>(word.count, MAX_TERM_COUNT)));
+            m_postings_bytes += (postings.docs.capacity() - docCapacity) * sizeof(size_t) +
+                                (postings.offsets.capacity() - offsetCapacity) * sizeof(uint32_t) +
+                                (postings.counts.capacity() - countCapacity) * sizeof(uint16_t);
+        }
+    }
+
+    // Only whole files are spilled, so each run covers its own range of doc IDs
+    if (m_spill_budget && m_postings_bytes + m_content_bytes > m_spill_budget) {
+        spillPostings();
+    }
+}
+
+void Index::setSpillBudget(size_t budgetBytes, const fs::path& directory) {
+    m_spill_budget = budgetBytes;
+    m_spill_directory = directory;
+}
+
+void Index::spillPostings() {
+    std::vector<const std::pair<const std::string, PostingList>*> entries;
+    entries.reserve(m_inverted_index.size());
+    for (const auto& entry : m_inverted_index) {
+        entries.push_back(&entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+
+    fs::path path = spillRunPath(m_spill_directory);
+    try {
+        SpillRunWriter run(path);
+        for (const auto* entry : entries) {
+            run.write(entry->first, entry->second.docs, entry->second.offsets, entry->second.counts);
+        }
+        run.close();
+    } catch (const std::exception& e) {
+        std::error_code ec;
+        fs::remove(path, ec);
+        std::cerr << "Error spilling postings, keeping them in memory: " << e.what() << std::endl;
+        m_spill_budget = 0;
+        return;
+    }
+
+    m_spill_runs.push_back(path);
+    // Swapping with an empty map also gives back the bucket array
+    std::unordered_map<std::string, PostingList>().swap(m_inverted_index);
+    m_postings_bytes = 0;
+}
+
+void Index::removeSpilledRuns() {
+    for (const auto& path : m_spill_runs) {
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+    m_spill_runs.clear();
+}
+
+uint32_t Index::internExtension(const std::string& extension) {
+    auto it = m_extension_ids.find(extension);
+    if (it != m_extension_ids.end()) {
+        return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(m_extensions.size());
+    m_extensions.push_back(extension);
+    m_extension_ids[extension] = id;
+    return id;
+}
+
+uint32_t Index::internDirectory(uint32_t parent, const std::string& name) {
+    std::string key(reinterpret_cast<const char*>(&parent), sizeof(parent));
+    key += name;
+
+    auto it = m_directory_lookup.find(key);
+    if (it != m_directory_lookup.end()) {
+        return it->second;
     }
+    uint32_t id = static_cast<uint32_t>(m_directories.size());
+    m_directories.push_back({parent, name});
+    m_directory_lookup.emplace(std::move(key), id);
+    return id;
+}
+
+uint32_t Index::internPath(const fs::path& directory) {
+    uint32_t id = NO_DIRECTORY;
+    for (const auto& component : directory) {
+        std::string name = component.string();
+        if (name.empty()) continue;
+        id = internDirectory(id, name);
+    }
+    return id;
+}
+
+bool Index::findDirectory(const fs::path& directory, uint32_t& id) const {
+    id = NO_DIRECTORY;
+    for (const auto& component : directory.lexically_normal()) {
+        std::string name = component.string();
+        if (name.empty() || name == ".") continue;
+
+        std::string key(reinterpret_cast<const char*>(&id), sizeof(id));
+        key += name;
+        auto it = m_directory_lookup.find(key);
+        if (it == m_directory_lookup.end()) return false;
+        id = it->second;
+    }
+    return id != NO_DIRECTORY;
+}
+
+fs::path Index::directoryPath(uint32_t id) const {
+    std::vector<const std::string*> names;
+    for (; id != NO_DIRECTORY; id = m_directories[id].parent) {
+        names.push_back(&m_directories[id].name);
+    }
+
+    fs::path path;
+    for (auto it = names.rbegin(); it != names.rend(); ++it) {
+        path /= **it;
+    }
+    return path;
+}
+
+size_t Index::storeRecord(const FileMetadata& data) {
+    // Under a budget, contents may take up to half of it and the postings the
+    // rest; past that files are kept without content, as with --no-content
+    bool keepContent = !m_spill_budget || m_content_bytes + data.content.size() <= m_spill_budget / 2;
+    m_records.push_back({internPath(data.path.parent_path()), data.filename, keepContent ? data.content : std::string()});
+    if (keepContent) m_content_bytes += data.content.size();
+    m_sizes.push_back(data.size);
+    m_mtimes.push_back(data.last_modified.time_since_epoch().count());
+    m_ext_ids.push_back(internExtension(toLowerCase(data.extension)));
+    m_hashes.push_back(data.hash);
+    return m_records.size() - 1;
 }
 
 void Index::addFile(const FileMetadata& data) {
-    m_files.push_back(data);
-    size_t current_index = m_files.size() - 1;
+    addFile(data, analyzeContent(data));
+}
+
+void Index::addFile(const FileMetadata& data, const std::vector<TermOccurrence>& words) {
+    m_generation++;
+    size_t current_index = storeRecord(data);
 
     std::string key = data.filename;
     auto it = m_filename_map.find(key);
@@ -78,7 +259,7 @@ void Index::addFile(const FileMetadata& data) {
         m_filename_map[key] = {current_index};
     }
 
-    m_filename_trie.insert(data.filename, current_index);
+    m_filename_trie.insert(data.filename, current_index, m_mtimes[current_index], m_sizes[current_index]);
 
     std::string extension = data.extension;
     if (!extension.empty()) {
@@ -90,319 +271,1210 @@ void Index::addFile(const FileMetadata& data) {
             m_extension_map[ext_lower] = {current_index};
         }
 
-        if (isTextFile(ext_lower)) {
-            indexFileContent(data.content, current_index);
-        }
+        indexFileContent(words, current_index);
     }
 }
 
-const std::vector<FileMetadata>& Index::getAllFiles() const {
-    return m_files;
+size_t Index::fileCount() const {
+    return m_records.size();
 }
 
-std::vector<FileMetadata> Index::sortResults(std::vector<FileMetadata> results, SortBy criteria) const {
-    switch (criteria) {
-    case SortBy::SIZE_ASC:
-        std::sort(results.begin(), results.end(),
-                  [](const FileMetadata& a, const FileMetadata& b) { return a.size < b.size; });
-        break;
+FileMetadata Index::getFile(size_t id) const {
+    FileMetadata file = fileAttributes(id);
+    file.content = m_records[id].content;
+    return file;
+}
 
-    case SortBy::SIZE_DESC:
-        std::sort(results.begin(), results.end(),
-                  [](const FileMetadata& a, const FileMetadata& b) { return a.size > b.size; });
-        break;
+FileMetadata Index::fileAttributes(size_t id) const {
+    const FileRecord& record = m_records[id];
+
+    FileMetadata file;
+    file.path = directoryPath(record.directory) / record.filename;
+    file.filename = record.filename;
+    file.size = m_sizes[id];
+    file.last_modified = fs::file_time_type(fs::file_time_type::duration(m_mtimes[id]));
+    file.extension = m_extensions[m_ext_ids[id]];
+    file.hash = m_hashes[id];
+    return file;
+}
 
-    case SortBy::DATE_ASC:
-        std::sort(results.begin(), results.end(),
-                  [](const FileMetadata& a, const FileMetadata& b) { return a.last_modified < b.last_modified; });
-        break;
+size_t Index::directoryCount() const {
+    return m_directories.size();
+}
 
-    case SortBy::DATE_DESC:
-        std::sort(results.begin(), results.end(),
-                  [](const FileMetadata& a, const FileMetadata& b) { return a.last_modified > b.last_modified; });
-        break;
+size_t Index::termCount() const {
+    return m_inverted_index.size();
+}
 
-    case SortBy::RELEVANCE:
+size_t Index::extensionCount() const {
+    return m_extension_map.size();
+}
 
-        break;
+bool Index::findFile(const fs::path& path, size_t& id) const {
+    auto it = m_filename_map.find(path.filename().string());
+    if (it == m_filename_map.end()) return false;
 
-    case SortBy::NAME:
-    default:
-        std::sort(results.begin(), results.end(),
-                  [](const FileMetadata& a, const FileMetadata& b) { return a.filename < b.filename; });
-        break;
+    uint32_t directory;
+    if (!findDirectory(path.parent_path(), directory)) return false;
+
+    for (size_t candidate : it->second) {
+        if (m_records[candidate].directory == directory) {
+            id = candidate;
+            return true;
+        }
     }
-    return results;
+    return false;
 }
 
-int Index::calculateRelevance(const FileMetadata& file, const std::vector<std::string>& query_words) const {
-    if (file.content.empty()) return 0;
+void Index::ensureSortedOrders() const {
+    std::lock_guard<std::mutex> lock(m_order_mutex);
+    if (m_order_generation == m_generation) return;
 
-    int score = 0;
-    std::string content_lower = toLowerCase(file.content);
+    auto build = [](std::vector<size_t>& order, const auto& column) {
+        order.resize(column.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(),
+                         [&column](size_t a, size_t b) { return column[a] < column[b]; });
+    };
+    build(m_size_order, m_sizes);
+    build(m_mtime_order, m_mtimes);
+
+    // Number the directory tree in pre-order so every subtree is one contiguous range
+    const uint32_t dirCount = static_cast<uint32_t>(m_directories.size());
+    std::vector<uint32_t> childStart(dirCount + 2, 0);
+    for (const auto& dir : m_directories) {
+        childStart[(dir.parent == NO_DIRECTORY ? dirCount : dir.parent) + 1]++;
+    }
+    for (size_t i = 1; i < childStart.size(); ++i) {
+        childStart[i] += childStart[i - 1];
+    }
+    std::vector<uint32_t> children(dirCount);
+    std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+    for (uint32_t id = 0; id < dirCount; ++id) {
+        uint32_t parent = m_directories[id].parent;
+        children[fill[parent == NO_DIRECTORY ? dirCount : parent]++] = id;
+    }
 
-    for (const auto& word : query_words) {
-        size_t pos = 0;
-        while ((pos = content_lower.find(word, pos)) != std::string::npos) {
-            score += 10;
-            pos += word.length();
-
-            if (pos < content_lower.length()) {
-                char next_char = content_lower[pos];
-                if (!std::isalpha(next_char)) {
-                    score += 5;
-                }
+    m_dir_pre.assign(dirCount, 0);
+    m_dir_end.assign(dirCount, 0);
+    uint32_t counter = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> stack; // (node, next child slot)
+    for (uint32_t slot = childStart[dirCount]; slot < childStart[dirCount + 1]; ++slot) {
+        stack.push_back({children[slot], childStart[children[slot]]});
+        m_dir_pre[children[slot]] = counter++;
+        while (!stack.empty()) {
+            auto& top = stack.back();
+            if (top.second < childStart[top.first + 1]) {
+                uint32_t child = children[top.second++];
+                m_dir_pre[child] = counter++;
+                stack.push_back({child, childStart[child]});
+            } else {
+                m_dir_end[top.first] = counter;
+                stack.pop_back();
             }
         }
     }
 
-    return score;
+    m_doc_dir_pre.resize(m_records.size());
+    for (size_t i = 0; i < m_records.size(); ++i) {
+        uint32_t dir = m_records[i].directory;
+        m_doc_dir_pre[i] = dir == NO_DIRECTORY ? UINT32_MAX : m_dir_pre[dir];
+    }
+    build(m_directory_order, m_doc_dir_pre);
+
+    m_order_generation = m_generation;
+}
+
+namespace {
+
+// [first, last) positions in `order` whose column value lies in [low, high]
+template <typename T>
+std::pair<size_t, size_t> orderRange(const std::vector<size_t>& order, const std::vector<T>& column, T low, T high) {
+    auto first = std::lower_bound(order.begin(), order.end(), low,
+                                  [&column](size_t id, T value) { return column[id] < value; });
+    auto last = std::upper_bound(first, order.end(), high,
+                                 [&column](T value, size_t id) { return value < column[id]; });
+    return {static_cast<size_t>(first - order.begin()), static_cast<size_t>(last - order.begin())};
+}
+
+template <typename T>
+std::vector<size_t> docsInRange(const std::vector<size_t>& order, const std::vector<T>& column, T low, T high) {
+    auto range = orderRange(order, column, low, high);
+    std::vector<size_t> docs(order.begin() + range.first, order.begin() + range.second);
+    std::sort(docs.begin(), docs.end());
+    return docs;
+}
+
+} // namespace
+
+size_t Index::countSizeRange(uint64_t low, uint64_t high) const {
+    ensureSortedOrders();
+    auto range = orderRange(m_size_order, m_sizes, low, high);
+    return range.second - range.first;
+}
+
+std::vector<size_t> Index::docsInSizeRange(uint64_t low, uint64_t high) const {
+    ensureSortedOrders();
+    return docsInRange(m_size_order, m_sizes, low, high);
+}
+
+size_t Index::countMtimeRange(int64_t low, int64_t high) const {
+    ensureSortedOrders();
+    auto range = orderRange(m_mtime_order, m_mtimes, low, high);
+    return range.second - range.first;
+}
+
+std::vector<size_t> Index::docsInMtimeRange(int64_t low, int64_t high) const {
+    ensureSortedOrders();
+    return docsInRange(m_mtime_order, m_mtimes, low, high);
+}
+
+bool Index::directoryRange(const fs::path& directory, uint32_t& first, uint32_t& last) const {
+    uint32_t id;
+    if (!findDirectory(directory, id)) return false;
+
+    ensureSortedOrders();
+    first = m_dir_pre[id];
+    last = m_dir_end[id] - 1;
+    return true;
+}
+
+size_t Index::countDirectoryRange(uint32_t first, uint32_t last) const {
+    ensureSortedOrders();
+    auto range = orderRange(m_directory_order, m_doc_dir_pre, first, last);
+    return range.second - range.first;
+}
+
+std::vector<size_t> Index::docsInDirectoryRange(uint32_t first, uint32_t last) const {
+    ensureSortedOrders();
+    return docsInRange(m_directory_order, m_doc_dir_pre, first, last);
+}
+
+bool parseSortBy(const std::string& text, SortBy& sort) {
+    if (text == "relevance") sort = SortBy::RELEVANCE;
+    else if (text == "name") sort = SortBy::NAME;
+    else if (text == "size") sort = SortBy::SIZE_ASC;
+    else if (text == "-size") sort = SortBy::SIZE_DESC;
+    else if (text == "date") sort = SortBy::DATE_ASC;
+    else if (text == "-date") sort = SortBy::DATE_DESC;
+    else return false;
+    return true;
+}
+
+const char* sortByName(SortBy sort) {
+    switch (sort) {
+    case SortBy::NAME:      return "name";
+    case SortBy::SIZE_ASC:  return "size";
+    case SortBy::SIZE_DESC: return "-size";
+    case SortBy::DATE_ASC:  return "date";
+    case SortBy::DATE_DESC: return "-date";
+    default:                return "relevance";
+    }
 }
 
 std::vector<FileMetadata> Index::searchByFilename(const std::string& filename, SortBy sort) const {
-    std::vector<FileMetadata> results;
+    std::vector<size_t> ids;
     auto it = m_filename_map.find(filename);
     if (it != m_filename_map.end()) {
-        for (size_t index : it->second) {
-            results.push_back(m_files[index]);
-        }
+        ids = it->second;
     }
-    return sortResults(results, sort);
+    rankIds(ids, {}, sort, 0);
+    return materialize(ids);
 }
 
 std::vector<FileMetadata> Index::searchByPrefix(const std::string& prefix, SortBy sort) const {
+    std::vector<size_t> ids = m_filename_trie.searchPrefix(prefix);
+    rankIds(ids, {}, sort, 0);
+    return materialize(ids);
+}
+
+std::vector<FileMetadata> Index::complete(const PrefixCursor& cursor, size_t limit, SortBy sort) const {
+    std::vector<size_t> ids;
+    bool cached = limit > 0 && (sort == SortBy::DATE_DESC || sort == SortBy::SIZE_DESC) &&
+                  cursor.top(limit, sort == SortBy::DATE_DESC ? TrieRank::RECENT : TrieRank::LARGEST, ids);
+    if (!cached) {
+        ids = cursor.all();
+        rankIds(ids, {}, sort, limit);
+    }
+
     std::vector<FileMetadata> results;
-    std::vector<size_t> indices = m_filename_trie.searchPrefix(prefix);
-    for (size_t index : indices) {
-        results.push_back(m_files[index]);
+    results.reserve(ids.size());
+    for (size_t id : ids) {
+        results.push_back(fileAttributes(id));
     }
-    return sortResults(results, sort);
+    return results;
 }
 
 std::vector<FileMetadata> Index::searchByExtension(const std::string& extension, SortBy sort) const {
-    std::vector<FileMetadata> results;
+    std::vector<size_t> ids;
 
     std::string ext_lower = extension;
     std::transform(ext_lower.begin(), ext_lower.end(), ext_lower.begin(), ::tolower);
 
     auto it = m_extension_map.find(ext_lower);
     if (it != m_extension_map.end()) {
-        for (size_t index : it->second) {
-            results.push_back(m_files[index]);
-        }
+        ids = it->second;
     }
 
-    return sortResults(results, sort);
+    rankIds(ids, {}, sort, 0);
+    return materialize(ids);
 }
 
-std::vector<FileMetadata> Index::searchByContent(const std::string& query, SortBy sort) const {
-    std::vector<FileMetadata> results;
-    std::unordered_set<size_t> matching_indices;
+namespace {
 
-    std::vector<std::string> query_words = extractWords(query);
-    if (query_words.empty()) {
-        return results;
+// Sorts (key, doc) pairs, ties broken by doc ID. With a limit only the first
+// `limit` entries are put in order.
+template <typename Key, typename Compare>
+void sortKeyed(std::vector<std::pair<Key, size_t>>& keyed, size_t limit, Compare compare) {
+    auto order = [&compare](const std::pair<Key, size_t>& a, const std::pair<Key, size_t>& b) {
+        if (compare(a.first, b.first)) return true;
+        if (compare(b.first, a.first)) return false;
+        return a.second < b.second;
+    };
+    if (limit > 0 && limit < keyed.size()) {
+        std::partial_sort(keyed.begin(), keyed.begin() + limit, keyed.end(), order);
+        keyed.resize(limit);
+    } else {
+        std::sort(keyed.begin(), keyed.end(), order);
     }
+}
 
-    // For the first word, get all files that contain it
-    auto it = m_inverted_index.find(query_words[0]);
-    if (it != m_inverted_index.end()) {
-        matching_indices = it->second;
+template <typename Key, typename Compare>
+void sortByColumn(std::vector<size_t>& ids, const std::vector<Key>& column, size_t limit, Compare compare) {
+    std::vector<std::pair<Key, size_t>> keyed(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+        keyed[i] = {column[ids[i]], ids[i]};
     }
+    sortKeyed(keyed, limit, compare);
 
-    for (size_t i = 1; i < query_words.size(); i++) {
-        auto word_it = m_inverted_index.find(query_words[i]);
-        if (word_it != m_inverted_index.end()) {
-            std::unordered_set<size_t> temp;
-            for (size_t index : matching_indices) {
-                if (word_it->second.find(index) != word_it->second.end()) {
-                    temp.insert(index);
-                }
+    ids.resize(keyed.size());
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        ids[i] = keyed[i].second;
+    }
+}
+
+} // namespace
+
+void Index::rankIds(std::vector<size_t>& ids, const std::vector<std::string>& query_words, SortBy sort,
+                    size_t limit) const {
+    switch (sort) {
+    case SortBy::SIZE_ASC:
+        sortByColumn(ids, m_sizes, limit, std::less<uint64_t>());
+        break;
+
+    case SortBy::SIZE_DESC:
+        sortByColumn(ids, m_sizes, limit, std::greater<uint64_t>());
+        break;
+
+    case SortBy::DATE_ASC:
+        sortByColumn(ids, m_mtimes, limit, std::less<int64_t>());
+        break;
+
+    case SortBy::DATE_DESC:
+        sortByColumn(ids, m_mtimes, limit, std::greater<int64_t>());
+        break;
+
+    case SortBy::RELEVANCE: {
+        if (query_words.empty()) break;
+
+        // How often each file holds the query's terms, from the counts stored
+        // in the postings; the content is never rescanned, and files score
+        // the same whether or not it is stored
+        std::vector<const PostingList*> postings;
+        for (const auto& word : query_words) {
+            auto it = m_inverted_index.find(word);
+            if (it != m_inverted_index.end()) postings.push_back(&it->second);
+        }
+
+        std::vector<std::pair<uint64_t, size_t>> keyed(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            uint64_t score = 0;
+            for (const PostingList* list : postings) {
+                auto pos = std::lower_bound(list->docs.begin(), list->docs.end(), ids[i]);
+                if (pos != list->docs.end() && *pos == ids[i]) score += list->counts[pos - list->docs.begin()];
             }
-            matching_indices = std::move(temp);
-        } else {
-            matching_indices.clear();
-            break;
+            keyed[i] = {score, ids[i]};
         }
-    }
+        sortKeyed(keyed, limit, std::greater<uint64_t>());
 
-    for (size_t index : matching_indices) {
-        results.push_back(m_files[index]);
+        ids.resize(keyed.size());
+        for (size_t i = 0; i < keyed.size(); ++i) {
+            ids[i] = keyed[i].second;
+        }
+        break;
     }
 
-    if (sort == SortBy::RELEVANCE && !results.empty()) {
-        std::vector<std::pair<int, FileMetadata>> scored_results;
-        for (auto& file : results) {
-            int score = calculateRelevance(file, query_words);
-            scored_results.emplace_back(score, file);
+    case SortBy::NAME:
+    default: {
+        std::vector<std::pair<const std::string*, size_t>> keyed(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i) {
+            keyed[i] = {&m_records[ids[i]].filename, ids[i]};
         }
+        sortKeyed(keyed, limit, [](const std::string* a, const std::string* b) { return *a < *b; });
 
-        std::sort(scored_results.begin(), scored_results.end(),
-                  [](const auto& a, const auto& b) { return a.first > b.first; });
-
-        results.clear();
-        for (auto& scored_file : scored_results) {
-            results.push_back(scored_file.second);
+        ids.resize(keyed.size());
+        for (size_t i = 0; i < keyed.size(); ++i) {
+            ids[i] = keyed[i].second;
         }
-    } else {
-        results = sortResults(results, sort);
+        break;
+    }
     }
 
+    if (limit > 0 && ids.size() > limit) {
+        ids.resize(limit);
+    }
+}
+
+std::vector<size_t> Index::runQuery(const QueryNode& query, SortBy sort, size_t limit) const {
+    // The postings in memory are only those added since the last spill
+    if (!m_spill_runs.empty()) return {};
+
+    // Relative mtime filters move with the clock, so their results can't be reused
+    bool cacheable = !queryUsesClock(query);
+    std::string key = describeQuery(query) + '|' + std::to_string(static_cast<int>(sort)) + '|' +
+                      std::to_string(limit);
+
+    std::vector<size_t> ids;
+    if (cacheable && m_query_cache.lookup(key, m_generation, ids)) {
+        return ids;
+    }
+
+    QueryPlanner planner(*this);
+    ids = planner.execute(query);
+
+    std::vector<std::string> query_words;
+    QueryPlanner::collectPositiveTerms(query, query_words);
+    rankIds(ids, query_words, sort, limit);
+
+    if (cacheable) {
+        m_query_cache.insert(key, m_generation, ids);
+    }
+    return ids;
+}
+
+std::vector<FileMetadata> Index::materialize(const std::vector<size_t>& ids) const {
+    std::vector<FileMetadata> results;
+    results.reserve(ids.size());
+    for (size_t index : ids) {
+        results.push_back(getFile(index));
+    }
     return results;
 }
 
-std::string Index::readString(std::ifstream& in) const {
-    size_t length;
-    in.read(reinterpret_cast<char*>(&length), sizeof(length));
-    std::string str(length, '\0');
-    in.read(&str[0], length);
-    return str;
+std::vector<FileMetadata> Index::searchByContent(const std::string& query, SortBy sort, size_t limit) const {
+    std::vector<std::string> query_words = extractWords(query);
+    if (query_words.empty()) {
+        return {};
+    }
+
+    QueryNode root;
+    root.type = QueryNode::Type::AND;
+    for (const auto& word : query_words) {
+        auto term = std::make_unique<QueryNode>();
+        term->type = QueryNode::Type::TERM;
+        term->text = word;
+        root.children.push_back(std::move(term));
+    }
+    return materialize(runQuery(root, sort, limit));
 }
 
-void Index::writeMap(std::ofstream& out, const std::unordered_map<std::string, std::vector<size_t>>& map) const {
-    size_t mapSize = map.size();
-    out.write(reinterpret_cast<const char*>(&mapSize), sizeof(mapSize));
+std::vector<FileMetadata> Index::search(const std::string& query, SortBy sort, size_t limit,
+                                        std::string* error) const {
+    if (!m_spill_runs.empty()) {
+        if (error) *error = SPILLED_ERROR;
+        return {};
+    }
 
-    for (const auto& pair : map) {
-        writeString(out, pair.first); // key
-        size_t vecSize = pair.second.size();
-        out.write(reinterpret_cast<const char*>(&vecSize), sizeof(vecSize));
-        for (size_t value : pair.second) {
-            out.write(reinterpret_cast<const char*>(&value), sizeof(value));
-        }
+    std::unique_ptr<QueryNode> root;
+    std::string parse_error;
+    if (!parseQuery(query, root, parse_error)) {
+        if (error) *error = parse_error;
+        return {};
+    }
+
+    QueryPlanner planner(*this);
+    if (!planner.normalize(*root)) {
+        return {};
+    }
+    return materialize(runQuery(*root, sort, limit));
+}
+
+std::string Index::explain(const std::string& query) const {
+    std::unique_ptr<QueryNode> root;
+    std::string parse_error;
+    if (!parseQuery(query, root, parse_error)) {
+        return "parse error: " + parse_error;
+    }
+    if (!m_spill_runs.empty()) {
+        return SPILLED_ERROR;
+    }
+
+    QueryPlanner planner(*this);
+    if (!planner.normalize(*root)) {
+        return "empty";
+    }
+    return planner.explain(*root);
+}
+
+namespace {
+
+// Bytes read on each side of a match; bounds the cost of a snippet
+const size_t SNIPPET_CONTEXT = 120;
+
+bool isUtf8Continuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+// Drops the pieces of multi-byte characters that a window boundary cut through
+void trimPartialUtf8(std::string& text, size_t& begin) {
+    size_t skip = 0;
+    while (skip < text.size() && skip < 3 && isUtf8Continuation(text[skip])) skip++;
+    text.erase(0, skip);
+    begin += skip;
+
+    size_t lead = text.size();
+    while (lead > 0 && text.size() - lead < 4 && isUtf8Continuation(text[lead - 1])) lead--;
+    if (lead == 0) return;
+    unsigned char c = static_cast<unsigned char>(text[lead - 1]);
+    size_t length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    if (text.size() - (lead - 1) < length) {
+        text.resize(lead - 1);
     }
 }
 
-void Index::readMap(std::ifstream& in, std::unordered_map<std::string, std::vector<size_t>>& map) {
-    size_t mapSize;
-    in.read(reinterpret_cast<char*>(&mapSize), sizeof(mapSize));
+} // namespace
+
+std::vector<Snippet> Index::snippets(const FileMetadata& file, const std::string& query, size_t maxSnippets) const {
+    size_t id;
+    if (maxSnippets == 0 || !m_spill_runs.empty() || !findFile(file.path, id)) return {};
+
+    std::unique_ptr<QueryNode> root;
+    std::string parse_error;
+    QueryPlanner planner(*this);
+    if (!parseQuery(query, root, parse_error) || !planner.normalize(*root)) return {};
+    std::vector<std::string> terms;
+    QueryPlanner::collectPositiveTerms(*root, terms);
+    std::unordered_set<std::string> termSet(terms.begin(), terms.end());
+
+    // The first occurrence of each query word, straight from the postings
+    std::vector<uint32_t> offsets;
+    for (const auto& term : termSet) {
+        auto it = m_inverted_index.find(term);
+        if (it == m_inverted_index.end()) continue;
+        const std::vector<size_t>& docs = it->second.docs;
+        auto pos = std::lower_bound(docs.begin(), docs.end(), id);
+        if (pos != docs.end() && *pos == id && it->second.offsets[pos - docs.begin()] != NO_OFFSET) {
+            offsets.push_back(it->second.offsets[pos - docs.begin()]);
+        }
+    }
+    if (offsets.empty()) return {};
+    std::sort(offsets.begin(), offsets.end());
+
+    // Without stored content the file is read, and the offsets only hold if it hasn't changed
+    const std::string& content = m_records[id].content;
+    bool fromFile = content.empty();
+    if (fromFile) {
+        std::error_code ec;
+        uintmax_t size = fs::file_size(file.path, ec);
+        if (ec || size != m_sizes[id]) return {};
+        auto mtime = fs::last_write_time(file.path, ec);
+        if (ec || mtime.time_since_epoch().count() != m_mtimes[id]) return {};
+    }
 
-    for (size_t i = 0; i < mapSize; ++i) {
-        std::string key = readString(in);
-        size_t vecSize;
-        in.read(reinterpret_cast<char*>(&vecSize), sizeof(vecSize));
+    std::vector<Snippet> result;
+    uint64_t shownUntil = 0;
+    for (uint32_t offset : offsets) {
+        if (result.size() >= maxSnippets) break;
+        if (offset < shownUntil) continue; // already part of the previous snippet
+
+        uint64_t begin = offset > SNIPPET_CONTEXT ? offset - SNIPPET_CONTEXT : 0;
+        uint64_t end = std::min<uint64_t>(uint64_t(offset) + SNIPPET_CONTEXT, m_sizes[id]);
+        if (begin >= end) continue;
+        std::string window;
+        if (!fromFile) {
+            if (begin >= content.size()) continue;
+            window = content.substr(static_cast<size_t>(begin), static_cast<size_t>(end - begin));
+        } else if (!readFileRange(file.path, begin, static_cast<size_t>(end - begin), window)) {
+            break;
+        }
 
-        std::vector<size_t> values(vecSize);
-        for (size_t j = 0; j < vecSize; ++j) {
-            size_t value;
-            in.read(reinterpret_cast<char*>(&value), sizeof(value));
-            values[j] = value;
+        // Narrow the window to the line holding the match
+        size_t match = static_cast<size_t>(offset - begin);
+        if (match >= window.size()) continue;
+        size_t newline = match == 0 ? std::string::npos : window.rfind('\n', match - 1);
+        size_t first = newline == std::string::npos ? 0 : newline + 1;
+        size_t last = window.find('\n', match);
+        if (last == std::string::npos) last = window.size();
+        if (last > first && window[last - 1] == '\r') last--;
+
+        Snippet snippet;
+        size_t start = first;
+        snippet.text = window.substr(first, last - first);
+        trimPartialUtf8(snippet.text, start);
+        snippet.offset = begin + start;
+
+        std::vector<Token> tokens;
+        m_analyzer.analyze(snippet.text, tokens);
+        for (const auto& token : tokens) {
+            if (termSet.count(token.term) == 0) continue;
+            // Highlight the word itself, not the punctuation a legacy analyzer keeps around it
+            size_t wordBegin = token.begin, wordEnd = token.end;
+            while (wordBegin < wordEnd && std::ispunct(static_cast<unsigned char>(snippet.text[wordBegin]))) wordBegin++;
+            while (wordEnd > wordBegin && std::ispunct(static_cast<unsigned char>(snippet.text[wordEnd - 1]))) wordEnd--;
+            snippet.highlights.emplace_back(wordBegin, wordEnd);
         }
+        // An identifier and its parts can both match; merge what overlaps
+        std::sort(snippet.highlights.begin(), snippet.highlights.end());
+        size_t merged = 0;
+        for (const auto& span : snippet.highlights) {
+            if (merged > 0 && span.first <= snippet.highlights[merged - 1].second) {
+                snippet.highlights[merged - 1].second = std::max(snippet.highlights[merged - 1].second, span.second);
+            } else {
+                snippet.highlights[merged++] = span;
+            }
+        }
+        snippet.highlights.resize(merged);
 
-        map[key] = values;
+        shownUntil = begin + last;
+        result.push_back(std::move(snippet));
     }
+    return result;
 }
 
-void Index::writeInvertedIndex(std::ofstream& out) const {
-    size_t mapSize = m_inverted_index.size();
-    out.write(reinterpret_cast<const char*>(&mapSize), sizeof(mapSize));
+void Index::setContentHash(size_t id, uint64_t hash) {
+    m_generation++;
+    m_hashes[id] = hash;
+}
 
-    for (const auto& pair : m_inverted_index) {
-        writeString(out, pair.first); 
-        size_t setSize = pair.second.size();
-        out.write(reinterpret_cast<const char*>(&setSize), sizeof(setSize));
-        for (size_t value : pair.second) {
-            out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+std::vector<std::vector<FileMetadata>> Index::findDuplicates(uint64_t minSize) const {
+    // Sorting by (size, hash) puts every group next to each other
+    std::vector<size_t> ids;
+    for (size_t id = 0; id < m_hashes.size(); ++id) {
+        if (m_hashes[id] != 0 && m_sizes[id] >= std::max<uint64_t>(minSize, 1)) {
+            ids.push_back(id);
+        }
+    }
+    std::sort(ids.begin(), ids.end(), [this](size_t a, size_t b) {
+        if (m_sizes[a] != m_sizes[b]) return m_sizes[a] < m_sizes[b];
+        if (m_hashes[a] != m_hashes[b]) return m_hashes[a] < m_hashes[b];
+        return a < b;
+    });
+
+    std::vector<std::vector<size_t>> groups;
+    for (size_t begin = 0, end; begin < ids.size(); begin = end) {
+        end = begin + 1;
+        while (end < ids.size() && m_sizes[ids[end]] == m_sizes[ids[begin]] &&
+               m_hashes[ids[end]] == m_hashes[ids[begin]]) {
+            end++;
         }
+        if (end - begin > 1) {
+            groups.emplace_back(ids.begin() + begin, ids.begin() + end);
+        }
+    }
+
+    // Most space reclaimable first: size times the number of redundant copies
+    std::stable_sort(groups.begin(), groups.end(), [this](const std::vector<size_t>& a, const std::vector<size_t>& b) {
+        return m_sizes[a[0]] * (a.size() - 1) > m_sizes[b[0]] * (b.size() - 1);
+    });
+
+    std::vector<std::vector<FileMetadata>> result;
+    result.reserve(groups.size());
+    for (const auto& group : groups) {
+        result.push_back(materialize(group));
+        std::sort(result.back().begin(), result.back().end(),
+                  [](const FileMetadata& a, const FileMetadata& b) { return a.path < b.path; });
     }
+    return result;
+}
+
+void Index::setQueryCacheCapacity(size_t capacity) {
+    m_query_cache.setCapacity(capacity);
+}
+
+uint64_t Index::queryCacheHits() const {
+    return m_query_cache.hits();
 }
 
+uint64_t Index::queryCacheMisses() const {
+    return m_query_cache.misses();
+}
 
-void Index::readInvertedIndex(std::ifstream& in) {
-    size_t mapSize;
-    in.read(reinterpret_cast<char*>(&mapSize), sizeof(mapSize));
+namespace {
 
-    for (size_t i = 0; i < mapSize; ++i) {
-        std::string key = readString(in);
-        size_t setSize;
-        in.read(reinterpret_cast<char*>(&setSize), sizeof(setSize));
+// Caches before version 3 wrote host-order size_t lengths
+std::string readLegacyString(BinaryReader& in) {
+    size_t length = in.fixedCount(1);
+    return std::string(in.bytes(length), length);
+}
 
-        std::unordered_set<size_t> values;
-        for (size_t j = 0; j < setSize; ++j) {
-            size_t value;
-            in.read(reinterpret_cast<char*>(&value), sizeof(value));
-            values.insert(value);
-        }
+} // namespace
 
-        m_inverted_index[key] = values;
+namespace {
+
+// IDs are stored + 1 so that the "none" value UINT32_MAX is a one-byte 0
+uint64_t referenceCode(uint32_t id) {
+    return id == UINT32_MAX ? 0 : uint64_t(id) + 1;
+}
+
+} // namespace
+
+std::string Index::serializeDirectories() const {
+    BlockWriter out;
+    for (const auto& dir : m_directories) {
+        out.out().varint(referenceCode(dir.parent));
+        out.out().string(dir.name);
+        out.endRecord();
     }
+    return out.finish();
 }
 
+std::string Index::serializeExtensions() const {
+    BlockWriter out;
+    for (const auto& extension : m_extensions) {
+        out.out().string(extension);
+        out.endRecord();
+    }
+    return out.finish();
+}
 
-bool Index::saveToFile(const std::string& filename) const {
-    try {
-        std::ofstream out(filename, std::ios::binary);
-        if (!out) return false;
+std::string Index::serializeFiles() const {
+    BlockWriter out;
+    for (size_t i = 0; i < m_records.size(); ++i) {
+        const FileRecord& record = m_records[i];
+        BinaryWriter& w = out.out();
+        w.varint(referenceCode(record.directory));
+        w.string(record.filename);
+        w.varint(m_sizes[i]);
+        w.i64(m_mtimes[i]);
+        w.varint(m_ext_ids[i]);
+        w.string(record.content);
+        out.endRecord();
+    }
+    return out.finish();
+}
+
+// Only hashed files have a record, so caches built without hashing don't grow
+std::string Index::serializeHashes() const {
+    BlockWriter out;
+    for (size_t i = 0; i < m_hashes.size(); ++i) {
+        if (m_hashes[i] == 0) continue;
+        out.out().varint(i);
+        out.out().u64(m_hashes[i]);
+        out.endRecord();
+    }
+    return out.finish();
+}
+
+std::string Index::serializeAnalyzer() const {
+    BlockWriter out;
+    out.out().u32(analyzerFlags(m_analyzer.options()));
+    out.endRecord();
+    return out.finish();
+}
 
+namespace {
+
+void writePostingList(BinaryWriter& w, const std::string& term, const std::vector<size_t>& docs,
+                      const std::vector<uint32_t>& offsets, const std::vector<uint16_t>& counts) {
+    w.string(term);
+    w.varint(docs.size());
+    // Gaps between sorted doc IDs are small, and small varints are one byte
+    size_t previous = 0;
+    for (size_t id : docs) {
+        w.varint(id - previous);
+        previous = id;
+    }
+    for (uint32_t offset : offsets) {
+        w.varint(referenceCode(offset));
+    }
+    for (uint16_t count : counts) {
+        w.varint(count);
+    }
+}
 
-        const int version = 1;
-        out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+// The postings not spilled yet, as the last source of a merge. Entries of a
+// non-const map are moved out rather than copied.
+template <typename Entry>
+class SortedEntrySource : public TermSource {
+public:
+    explicit SortedEntrySource(std::vector<Entry*> entries) : m_entries(std::move(entries)) {}
+
+    bool next(SpilledTerm& out) override {
+        if (m_next == m_entries.size()) return false;
+        Entry* entry = m_entries[m_next++];
+        out.term = entry->first;
+        out.docs = std::move(entry->second.docs);
+        out.offsets = std::move(entry->second.offsets);
+        out.counts = std::move(entry->second.counts);
+        return true;
+    }
 
+private:
+    std::vector<Entry*> m_entries;
+    size_t m_next{0};
+};
+
+// Merges the runs, in order, with the postings still in memory, one term at a time
+template <typename Map>
+void mergeWithRuns(const std::vector<fs::path>& runs, Map& postings, const std::function<void(SpilledTerm&)>& visit) {
+    using Entry = std::remove_reference_t<decltype(*postings.begin())>;
+    std::vector<Entry*> entries;
+    entries.reserve(postings.size());
+    for (auto& entry : postings) {
+        entries.push_back(&entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry* a, const Entry* b) { return a->first < b->first; });
+
+    std::vector<std::unique_ptr<TermSource>> owned;
+    for (const auto& path : runs) {
+        owned.push_back(std::make_unique<SpillRunReader>(path));
+    }
+    owned.push_back(std::make_unique<SortedEntrySource<Entry>>(std::move(entries)));
+    std::vector<TermSource*> sources;
+    for (const auto& source : owned) {
+        sources.push_back(source.get());
+    }
+    mergeTermSources(sources, visit);
+}
 
-        size_t fileCount = m_files.size();
-        out.write(reinterpret_cast<const char*>(&fileCount), sizeof(fileCount));
-        for (const auto& file : m_files) {
-            writeString(out, file.path.string());
-            writeString(out, file.filename);
-            out.write(reinterpret_cast<const char*>(&file.size), sizeof(file.size));
-            out.write(reinterpret_cast<const char*>(&file.last_modified), sizeof(file.last_modified));
-            writeString(out, file.extension);
-            writeString(out, file.content);
+} // namespace
+
+std::string Index::serializePostings() const {
+    BlockWriter out;
+    if (m_spill_runs.empty()) {
+        for (const auto& entry : m_inverted_index) {
+            writePostingList(out.out(), entry.first, entry.second.docs, entry.second.offsets, entry.second.counts);
+            out.endRecord();
         }
+        return out.finish();
+    }
 
-      
-        writeMap(out, m_filename_map);
-        writeMap(out, m_extension_map);
-        writeInvertedIndex(out);
+    mergeWithRuns(m_spill_runs, m_inverted_index, [&](SpilledTerm& term) {
+        writePostingList(out.out(), term.term, term.docs, term.offsets, term.counts);
+        out.endRecord();
+    });
+    return out.finish();
+}
 
-        return true;
+bool Index::mergeSpilledRuns() {
+    // The budget covers one round of adds; the merged postings are all needed in memory
+    m_spill_budget = 0;
+    if (m_spill_runs.empty()) return true;
+
+    m_generation++;
+    std::unordered_map<std::string, PostingList> tail;
+    tail.swap(m_inverted_index);
+    bool merged = true;
+    try {
+        mergeWithRuns(m_spill_runs, tail, [&](SpilledTerm& term) {
+            m_inverted_index.emplace(std::move(term.term),
+                                     PostingList{std::move(term.docs), std::move(term.offsets), std::move(term.counts)});
+        });
     } catch (const std::exception& e) {
-        std::cerr << "Error saving index: " << e.what() << std::endl;
-        return false;
+        // Half the postings would answer queries wrongly; none at least answer them consistently
+        std::cerr << "Error merging spilled postings, content search will find nothing: " << e.what() << std::endl;
+        std::unordered_map<std::string, PostingList>().swap(m_inverted_index);
+        merged = false;
     }
+    removeSpilledRuns();
+    return merged;
 }
 
-bool Index::loadFromFile(const std::string& filename) {
-    try {
-        std::ifstream in(filename, std::ios::binary);
-        if (!in) return false;
+namespace {
+
+// One block's worth of decoded records, filled in parallel and merged in order
+struct DecodedBlock {
+    std::vector<std::pair<uint32_t, std::string>> directories;
+    std::vector<std::string> extensions;
+    std::vector<uint32_t> fileDirectories;
+    std::vector<std::string> filenames;
+    std::vector<std::string> contents;
+    std::vector<uint64_t> sizes;
+    std::vector<int64_t> mtimes;
+    std::vector<uint32_t> extIds;
+    std::vector<std::string> terms;
+    std::vector<std::vector<size_t>> postings;
+    std::vector<std::vector<uint32_t>> offsets;
+    std::vector<std::vector<uint16_t>> counts;
+    std::vector<std::pair<size_t, uint64_t>> hashes;
+};
+
+struct BlockJob {
+    uint32_t section;
+    const CacheBlock* block;
+    size_t firstRecord; // index of the block's first record within its section
+    DecodedBlock decoded;
+};
+
+size_t recordTotal(const std::vector<CacheBlock>& blocks) {
+    size_t total = 0;
+    for (const auto& block : blocks) total += block.records;
+    return total;
+}
 
-        int version;
-        in.read(reinterpret_cast<char*>(&version), sizeof(version));
-        if (version != 1) {
-            std::cerr << "Unsupported cache version: " << version << std::endl;
-            return false;
+uint32_t readReference(BinaryReader& in, size_t limit, const char* what) {
+    uint64_t value = in.varint();
+    if (value == 0) return UINT32_MAX;
+    if (value > limit) {
+        throw CacheFormatError(std::string(what) + " reference out of range");
+    }
+    return static_cast<uint32_t>(value - 1);
+}
+
+} // namespace
+
+void Index::loadSections(const CacheFileReader& reader, bool withPostings) {
+    std::vector<uint32_t> ids = {cachefile::DIRECTORIES, cachefile::EXTENSIONS, cachefile::FILES};
+    if (withPostings) {
+        ids.push_back(cachefile::POSTINGS);
+    }
+    // Optional sections come after the required ones
+    if (reader.hasSection(cachefile::HASHES)) {
+        ids.push_back(cachefile::HASHES);
+    }
+    const size_t SECTIONS = ids.size();
+
+    // Older caches were built with what is now the legacy analyzer
+    AnalyzerOptions analyzer;
+    analyzer.legacy = true;
+    if (reader.version() >= 6) {
+        std::string section = reader.readSection(cachefile::ANALYZER);
+        std::vector<CacheBlock> analyzerBlocks = readBlockTable(section);
+        if (analyzerBlocks.size() != 1 || analyzerBlocks[0].records != 1) {
+            throw CacheFormatError("analyzer section must hold one record");
+        }
+        std::string raw = decodeBlock(analyzerBlocks[0]);
+        BinaryReader in(raw.data(), raw.size());
+        if (!analyzerFromFlags(in.u32(), analyzer) || !in.atEnd()) {
+            throw CacheFormatError("unsupported analyzer options");
         }
+    }
 
-        clear();
+    // Read and checksum the sections concurrently, then fan out over their blocks
+    std::vector<std::string> data(SECTIONS);
+    parallelFor(SECTIONS, [&](size_t i) { data[i] = reader.readSection(ids[i]); });
+
+    std::vector<std::vector<CacheBlock>> blocks(SECTIONS);
+    std::vector<size_t> totals(SECTIONS);
+    std::vector<BlockJob> jobs;
+    size_t termCount = 0;
+    for (size_t i = 0; i < SECTIONS; ++i) {
+        blocks[i] = readBlockTable(data[i]);
+        totals[i] = recordTotal(blocks[i]);
+        if (ids[i] == cachefile::POSTINGS) termCount = totals[i];
+        size_t first = 0;
+        for (const auto& block : blocks[i]) {
+            jobs.push_back({ids[i], &block, first, {}});
+            first += block.records;
+        }
+    }
+    const size_t dirCount = totals[0], extCount = totals[1], fileCount = totals[2];
+    const bool hasOffsets = reader.version() >= 5;
+    const bool hasCounts = reader.version() >= 7;
+
+    parallelFor(jobs.size(), [&](size_t j) {
+        BlockJob& job = jobs[j];
+        std::string raw = decodeBlock(*job.block);
+        BinaryReader in(raw.data(), raw.size());
+        DecodedBlock& out = job.decoded;
+        size_t records = job.block->records;
+
+        switch (job.section) {
+        case cachefile::DIRECTORIES:
+            out.directories.reserve(records);
+            for (size_t r = 0; r < records; ++r) {
+                // Parents are always interned before their children
+                uint32_t parent = readReference(in, job.firstRecord + r, "parent directory");
+                out.directories.emplace_back(parent, in.string());
+            }
+            break;
+        case cachefile::EXTENSIONS:
+            out.extensions.reserve(records);
+            for (size_t r = 0; r < records; ++r) {
+                out.extensions.push_back(in.string());
+            }
+            break;
+        case cachefile::FILES:
+            out.fileDirectories.reserve(records);
+            out.filenames.reserve(records);
+            out.contents.reserve(records);
+            for (size_t r = 0; r < records; ++r) {
+                out.fileDirectories.push_back(readReference(in, dirCount, "directory"));
+                out.filenames.push_back(in.string());
+                out.sizes.push_back(in.varint());
+                out.mtimes.push_back(in.i64());
+                uint64_t ext = in.varint();
+                if (ext >= extCount) {
+                    throw CacheFormatError("extension reference out of range");
+                }
+                out.extIds.push_back(static_cast<uint32_t>(ext));
+                out.contents.push_back(in.string());
+            }
+            break;
+        case cachefile::POSTINGS:
+            out.terms.reserve(records);
+            out.postings.reserve(records);
+            out.offsets.reserve(records);
+            out.counts.reserve(records);
+            for (size_t r = 0; r < records; ++r) {
+                std::string term = in.string();
+                std::vector<size_t> postings(in.count(1 + hasOffsets + hasCounts));
+                uint64_t id = 0;
+                for (size_t k = 0; k < postings.size(); ++k) {
+                    uint64_t gap = in.varint();
+                    if ((k > 0 && gap == 0) || gap >= fileCount - id) {
+                        throw CacheFormatError("posting list for '" + term + "' is not a sorted list of doc IDs");
+                    }
+                    id += gap;
+                    postings[k] = static_cast<size_t>(id);
+                }
+                // Version 4 caches have no offsets, so their files get no snippets
+                std::vector<uint32_t> offsets(postings.size(), NO_OFFSET);
+                for (size_t k = 0; hasOffsets && k < offsets.size(); ++k) {
+                    offsets[k] = readReference(in, NO_OFFSET, "term offset");
+                }
+                // Before version 7 all that's known is that each file holds the term
+                std::vector<uint16_t> counts(postings.size(), 1);
+                for (size_t k = 0; hasCounts && k < counts.size(); ++k) {
+                    uint64_t count = in.varint();
+                    if (count == 0 || count > MAX_TERM_COUNT) {
+                        throw CacheFormatError("term count out of range");
+                    }
+                    counts[k] = static_cast<uint16_t>(count);
+                }
+                out.terms.push_back(std::move(term));
+                out.postings.push_back(std::move(postings));
+                out.offsets.push_back(std::move(offsets));
+                out.counts.push_back(std::move(counts));
+            }
+            break;
+        case cachefile::HASHES:
+            out.hashes.reserve(records);
+            for (size_t r = 0; r < records; ++r) {
+                uint64_t id = in.varint();
+                if (id >= fileCount) {
+                    throw CacheFormatError("content hash for a missing file");
+                }
+                out.hashes.emplace_back(static_cast<size_t>(id), in.u64());
+            }
+            break;
+        }
+        if (!in.atEnd()) {
+            throw CacheFormatError("unexpected trailing data in a block");
+        }
+    });
+
+    // Everything decoded and validated; only now replace the current contents
+    clear();
+    m_analyzer = Analyzer(analyzer);
+    m_directories.reserve(dirCount);
+    m_records.reserve(fileCount);
+    m_sizes.reserve(fileCount);
+    m_mtimes.reserve(fileCount);
+    m_ext_ids.reserve(fileCount);
+    m_hashes.assign(fileCount, 0);
+
+    size_t firstPostingJob = jobs.size();
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        DecodedBlock& block = jobs[j].decoded;
+        if (jobs[j].section == cachefile::POSTINGS) {
+            firstPostingJob = std::min(firstPostingJob, j);
+            continue;
+        }
+        for (const auto& hash : block.hashes) {
+            m_hashes[hash.first] = hash.second;
+        }
+        for (auto& dir : block.directories) {
+            if (internDirectory(dir.first, dir.second) != m_directories.size() - 1) {
+                throw CacheFormatError("duplicate directory entry");
+            }
+        }
+        for (auto& extension : block.extensions) {
+            if (internExtension(extension) != m_extensions.size() - 1) {
+                throw CacheFormatError("duplicate extension entry");
+            }
+        }
+        for (size_t r = 0; r < block.filenames.size(); ++r) {
+            m_records.push_back({block.fileDirectories[r], std::move(block.filenames[r]), std::move(block.contents[r])});
+        }
+        m_sizes.insert(m_sizes.end(), block.sizes.begin(), block.sizes.end());
+        m_mtimes.insert(m_mtimes.end(), block.mtimes.begin(), block.mtimes.end());
+        m_ext_ids.insert(m_ext_ids.end(), block.extIds.begin(), block.extIds.end());
+    }
+
+    // The name maps and trie only need the records, so they are built while the postings are merged.
+    // If the merge throws, the future's destructor still waits for the build to finish.
+    std::future<void> derived = std::async(std::launch::async, &Index::rebuildDerivedMaps, this);
+    bool duplicateTerm = false;
+    m_inverted_index.reserve(termCount);
+    for (size_t j = firstPostingJob; j < jobs.size() && jobs[j].section == cachefile::POSTINGS; ++j) {
+        DecodedBlock& block = jobs[j].decoded;
+        for (size_t r = 0; r < block.terms.size(); ++r) {
+            PostingList postings{std::move(block.postings[r]), std::move(block.offsets[r]), std::move(block.counts[r])};
+            duplicateTerm |= !m_inverted_index.emplace(std::move(block.terms[r]), std::move(postings)).second;
+        }
+    }
+    derived.get();
+    if (duplicateTerm) {
+        throw CacheFormatError("duplicate term in the postings section");
+    }
+}
 
-        size_t fileCount;
-        in.read(reinterpret_cast<char*>(&fileCount), sizeof(fileCount));
-        m_files.resize(fileCount);
+void Index::loadLegacy(BinaryReader& in, uint32_t version) {
+    // Version 1 stored a full path per file instead of the directory table
+    if (version >= 2) {
+        size_t dirCount = in.fixedCount(4 + 8);
+        for (size_t i = 0; i < dirCount; ++i) {
+            uint32_t parent = in.u32();
+            if (parent != NO_DIRECTORY && parent >= i) {
+                throw CacheFormatError("directory " + std::to_string(i) + " has an invalid parent");
+            }
+            if (internDirectory(parent, readLegacyString(in)) != i) {
+                throw CacheFormatError("duplicate directory entry " + std::to_string(i));
+            }
+        }
+    }
+
+    size_t fileCount = in.fixedCount(8 + 8 + 8 + 8 + 8);
+    m_records.reserve(fileCount);
+    m_sizes.reserve(fileCount);
+    m_mtimes.reserve(fileCount);
+    m_ext_ids.reserve(fileCount);
+
+    for (size_t i = 0; i < fileCount; ++i) {
+        FileMetadata file;
+        uint32_t directory = NO_DIRECTORY;
+        if (version >= 2) {
+            directory = in.u32();
+            if (directory != NO_DIRECTORY && directory >= m_directories.size()) {
+                throw CacheFormatError("file " + std::to_string(i) + " refers to a missing directory");
+            }
+        } else {
+            file.path = readLegacyString(in);
+        }
+        file.filename = readLegacyString(in);
+        file.size = in.u64();
+        file.last_modified = fs::file_time_type(fs::file_time_type::duration(in.i64()));
+        file.extension = readLegacyString(in);
+        file.content = readLegacyString(in);
+
+        size_t id = storeRecord(file);
+        if (version >= 2) {
+            m_records[id].directory = directory;
+        }
+    }
+
+    // Filename map, extension map, inverted index; only the last isn't derivable from the records
+    for (int map = 0; map < 3; ++map) {
+        size_t mapSize = in.fixedCount(8 + 8);
+        for (size_t i = 0; i < mapSize; ++i) {
+            std::string key = readLegacyString(in);
+            std::vector<size_t> values(in.fixedCount(8));
+            for (size_t& value : values) {
+                value = static_cast<size_t>(in.u64());
+                if (value >= m_records.size()) {
+                    throw CacheFormatError("doc ID out of range");
+                }
+            }
+            if (map < 2) continue;
+
+            // Older caches stored postings as hash sets, in no particular order
+            if (!std::is_sorted(values.begin(), values.end())) {
+                std::sort(values.begin(), values.end());
+                values.erase(std::unique(values.begin(), values.end()), values.end());
+            }
+            std::vector<uint32_t> offsets(values.size(), NO_OFFSET);
+            std::vector<uint16_t> counts(values.size(), 1);
+            m_inverted_index[key] = {std::move(values), std::move(offsets), std::move(counts)};
+        }
+    }
+}
+
+void Index::rebuildDerivedMaps() {
+    m_filename_map.clear();
+    m_extension_map.clear();
+    m_filename_trie.clear();
+
+    for (size_t id = 0; id < m_records.size(); ++id) {
+        const std::string& filename = m_records[id].filename;
+        m_filename_map[filename].push_back(id);
+        m_filename_trie.insert(filename, id, m_mtimes[id], m_sizes[id]);
 
-        for (size_t i = 0; i < fileCount; ++i) {
-            m_files[i].path = readString(in);
-            m_files[i].filename = readString(in);
-            in.read(reinterpret_cast<char*>(&m_files[i].size), sizeof(m_files[i].size));
-            in.read(reinterpret_cast<char*>(&m_files[i].last_modified), sizeof(m_files[i].last_modified));
-            m_files[i].extension = readString(in);
-            m_files[i].content = readString(in);
+        const std::string& extension = m_extensions[m_ext_ids[id]];
+        if (!extension.empty()) {
+            m_extension_map[extension].push_back(id);
         }
+    }
+}
 
-      
-        readMap(in, m_filename_map);
-        readMap(in, m_extension_map);
-        readInvertedIndex(in);
+bool Index::saveToFile(const std::string& filename) const {
+    try {
+        // Sections are independent, so they are built and compressed concurrently
+        std::string sections[6];
+        parallelFor(6, [&](size_t i) {
+            switch (i) {
+            case 0: sections[i] = serializeDirectories(); break;
+            case 1: sections[i] = serializeExtensions(); break;
+            case 2: sections[i] = serializeFiles(); break;
+            case 3: sections[i] = serializePostings(); break;
+            case 4: sections[i] = serializeHashes(); break;
+            default: sections[i] = serializeAnalyzer(); break;
+            }
+        });
+
+        CacheFileWriter writer;
+        writer.addSection(cachefile::DIRECTORIES, std::move(sections[0]));
+        writer.addSection(cachefile::EXTENSIONS, std::move(sections[1]));
+        writer.addSection(cachefile::FILES, std::move(sections[2]));
+        writer.addSection(cachefile::POSTINGS, std::move(sections[3]));
+        if (std::any_of(m_hashes.begin(), m_hashes.end(), [](uint64_t hash) { return hash != 0; })) {
+            writer.addSection(cachefile::HASHES, std::move(sections[4]));
+        }
+        writer.addSection(cachefile::ANALYZER, std::move(sections[5]));
 
-        m_filename_trie.clear();
-        for (const auto& entry : m_filename_map) {
-            for (size_t index : entry.second) {
-                m_filename_trie.insert(entry.first, index);
+        std::string error;
+        if (!writer.commit(filename, &error)) {
+            std::cerr << "Error saving index: " << error << std::endl;
+            return false;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error saving index: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool Index::loadFromFile(const std::string& filename, bool withPostings) {
+    std::error_code ec;
+    if (!fs::is_regular_file(filename, ec)) return false;
+
+    try {
+        CacheFileReader reader;
+        if (reader.open(filename)) {
+            loadSections(reader, withPostings);
+        } else {
+            std::string data = readFileContent(filename);
+            BinaryReader in(data.data(), data.size());
+            uint32_t version = in.u32();
+            if (version != 1 && version != 2) {
+                std::cerr << "Unsupported cache version: " << version << std::endl;
+                return false;
             }
+            clear();
+            AnalyzerOptions analyzer;
+            analyzer.legacy = true;
+            m_analyzer = Analyzer(analyzer);
+            loadLegacy(in, version);
+            if (!withPostings) m_inverted_index.clear();
+            rebuildDerivedMaps();
         }
 
+        m_generation++;
         return true;
     } catch (const std::exception& e) {
+        clear();
         std::cerr << "Error loading index: " << e.what() << std::endl;
         return false;
     }
@@ -410,10 +1482,23 @@ bool Index::loadFromFile(const std::string& filename) {
 
 
 void Index::clear() {
-    m_files.clear();
+    m_generation++;
+    m_query_cache.clear();
+    m_directories.clear();
+    m_directory_lookup.clear();
+    m_records.clear();
+    m_sizes.clear();
+    m_mtimes.clear();
+    m_ext_ids.clear();
+    m_hashes.clear();
+    m_extensions.clear();
+    m_extension_ids.clear();
     m_filename_map.clear();
     m_extension_map.clear();
     m_inverted_index.clear();
+    m_postings_bytes = 0;
+    m_content_bytes = 0;
+    removeSpilledRuns();
     m_filename_trie.clear();
 }
 
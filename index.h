@@ -8,7 +8,15 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm> 
-#include "Trie.h"
+#include <cstdint>
+#include <mutex>
+#include "analyzer.h"
+#include "trie.h"
+#include "querycache.h"
+#include "query.h"
+
+class BinaryReader;
+class CacheFileReader;
 
 struct FileMetadata {
     std::filesystem::path path;
@@ -17,8 +25,23 @@ struct FileMetadata {
     std::filesystem::file_time_type last_modified;
     std::string extension;
     std::string content;
+    uint64_t hash = 0; // content hash, 0 if the file wasn't hashed
+};
+
+// A distinct word of a file's content, the byte offset of its first
+// occurrence and how many times it occurs
+struct TermOccurrence {
+    std::string term;
+    uint32_t offset;
+    uint32_t count;
 };
 
+// The part of a result's content around one of the query's words
+struct Snippet {
+    uint64_t offset;  // where text starts in the file
+    std::string text; // the line holding the match, clipped to a bounded window
+    std::vector<std::pair<size_t, size_t>> highlights; // [begin, end) of each matched word in text
+};
 
 enum class SortBy {
     NAME,
@@ -29,45 +52,199 @@ enum class SortBy {
     RELEVANCE
 };
 
+// Accepts relevance, name, size, -size, date and -date
+bool parseSortBy(const std::string& text, SortBy& sort);
+const char* sortByName(SortBy sort);
+
 class Index {
 public:
     Index();
     ~Index();
 
     void addFile(const FileMetadata& data);
-    const std::vector<FileMetadata>& getAllFiles() const;
+    // Same as addFile(data), but with the words already extracted by analyzeContent(),
+    // which needs no lock and can run on the caller's thread
+    void addFile(const FileMetadata& data, const std::vector<TermOccurrence>& words);
+    std::vector<TermOccurrence> analyzeContent(const FileMetadata& data) const;
+    // How content and queries are turned into terms; set it before adding files.
+    // Loading a cache switches to the options the cache was built with.
+    void setAnalyzerOptions(const AnalyzerOptions& options);
+    const AnalyzerOptions& analyzerOptions() const { return m_analyzer.options(); }
+    size_t fileCount() const;
+    FileMetadata getFile(size_t id) const;
+    size_t directoryCount() const;
+    size_t termCount() const;
+    size_t extensionCount() const;
+    bool findFile(const std::filesystem::path& path, size_t& id) const;
+
+    // Content hashes, see ContentHash.h. A hash of 0 means "not hashed"
+    uint64_t fileSize(size_t id) const { return m_sizes[id]; }
+    uint64_t contentHash(size_t id) const { return m_hashes[id]; }
+    void setContentHash(size_t id, uint64_t hash);
+    // Groups of two or more files with the same size and content hash, largest
+    // wasted space first; only files that were hashed can take part
+    std::vector<std::vector<FileMetadata>> findDuplicates(uint64_t minSize = 1) const;
 
     std::vector<FileMetadata> searchByFilename(const std::string& filename, SortBy sort = SortBy::NAME) const;
     std::vector<FileMetadata> searchByPrefix(const std::string& prefix, SortBy sort = SortBy::NAME) const;
+    // Search-as-you-type over filenames: keep one cursor per user and seek() it
+    // to the text typed so far. With DATE_DESC or SIZE_DESC and a limit of up
+    // to Trie::BEST_SLOTS the results come from the node's cached best entries
+    // without visiting the subtree; other orders rank the whole subtree like
+    // searchByPrefix(). Results carry no content. The cursor reads the index
+    // unlocked, so it must not be used while files are being added.
+    PrefixCursor prefixCursor() const { return PrefixCursor(m_filename_trie); }
+    std::vector<FileMetadata> complete(const PrefixCursor& cursor, size_t limit, SortBy sort = SortBy::DATE_DESC) const;
     std::vector<FileMetadata> searchByExtension(const std::string& extension, SortBy sort = SortBy::NAME) const;
-    std::vector<FileMetadata> searchByContent(const std::string& query, SortBy sort = SortBy::RELEVANCE) const;
+    std::vector<FileMetadata> searchByContent(const std::string& query, SortBy sort = SortBy::RELEVANCE,
+                                              size_t limit = 0) const;
+    // Full query language (see Query.h); on a parse error returns nothing and fills *error
+    std::vector<FileMetadata> search(const std::string& query, SortBy sort = SortBy::RELEVANCE,
+                                     size_t limit = 0, std::string* error = nullptr) const;
+    std::string explain(const std::string& query) const;
+    // Up to maxSnippets lines of a search result that contain the query's
+    // words, found through the stored first-occurrence offsets. Only a small
+    // window around each offset is read (from the stored content, or from the
+    // file if its content isn't stored), never the whole file. Returns nothing
+    // if the file changed since it was indexed.
+    std::vector<Snippet> snippets(const FileMetadata& file, const std::string& query, size_t maxSnippets = 3) const;
+
+    // Keeps the estimated size of the in-memory postings and stored contents
+    // under budgetBytes. Contents get up to half of it; files added beyond
+    // that are stored without content. Postings beyond the rest are spilled as
+    // sorted runs to temporary files in directory. 0 keeps everything in memory.
+    void setSpillBudget(size_t budgetBytes, const std::filesystem::path& directory);
+    size_t spilledRunCount() const { return m_spill_runs.size(); }
+    // k-way merges the runs back into memory, deletes them and turns the budget
+    // off; the Indexer calls it when it finishes, however it finishes. Until
+    // then the index can be saved (merging the runs into the cache) but not
+    // searched: search() and explain() report that, and searchByContent()
+    // and snippets() come back empty, and termCount() only counts the terms
+    // in memory. False if a run couldn't be read, which leaves no postings.
+    bool mergeSpilledRuns();
 
     bool saveToFile(const std::string& filename) const;
-    bool loadFromFile(const std::string& filename);
+    // Without postings only file lookups work, which is all reusing unchanged
+    // files needs, at a fraction of the memory
+    bool loadFromFile(const std::string& filename, bool withPostings = true);
     void clear();
 
+    // Bumped on every mutation; cached query results from older generations are discarded
+    uint64_t generation() const { return m_generation; }
+    void setQueryCacheCapacity(size_t capacity);
+    uint64_t queryCacheHits() const;
+    uint64_t queryCacheMisses() const;
+
 private:
-    std::vector<FileMetadata> m_files;
+    friend class QueryPlanner;
+
+    static const uint32_t NO_DIRECTORY = UINT32_MAX;
+    static constexpr uint32_t NO_OFFSET = UINT32_MAX;
+    static constexpr uint16_t MAX_TERM_COUNT = UINT16_MAX;
+
+    // Directories form a tree shared by all files, so a path prefix is stored
+    // once no matter how many files sit under it
+    struct DirectoryNode {
+        uint32_t parent;
+        std::string name;
+    };
+
+    // Everything that isn't a fixed-width attribute
+    struct FileRecord {
+        uint32_t directory;
+        std::string filename;
+        std::string content;
+    };
+
+    std::vector<DirectoryNode> m_directories;
+    std::unordered_map<std::string, uint32_t> m_directory_lookup; // parent ID + name -> ID
+
+    // File attributes are stored column-wise, indexed by doc ID, so sorts and
+    // range filters only touch the column they need
+    std::vector<FileRecord> m_records;
+    std::vector<uint64_t> m_sizes;
+    std::vector<int64_t> m_mtimes; // file_time_type ticks
+    std::vector<uint32_t> m_ext_ids;
+    std::vector<uint64_t> m_hashes;
+    std::vector<std::string> m_extensions; // extension ID -> lowercase extension
+    std::unordered_map<std::string, uint32_t> m_extension_ids;
+
+    // Doc IDs ordered by size / mtime, rebuilt lazily after the index changes
+    mutable std::mutex m_order_mutex;
+    mutable std::vector<size_t> m_size_order;
+    mutable std::vector<size_t> m_mtime_order;
+    // Pre-order numbering of the directory tree: directory d's subtree is
+    // exactly the numbers [m_dir_pre[d], m_dir_end[d])
+    mutable std::vector<uint32_t> m_dir_pre;
+    mutable std::vector<uint32_t> m_dir_end;
+    mutable std::vector<uint32_t> m_doc_dir_pre; // doc ID -> pre-order number of its directory
+    mutable std::vector<size_t> m_directory_order;
+    mutable uint64_t m_order_generation{UINT64_MAX};
+
     std::unordered_map<std::string, std::vector<size_t>> m_filename_map;
     std::unordered_map<std::string, std::vector<size_t>> m_extension_map;
-    std::unordered_map<std::string, std::unordered_set<size_t>> m_inverted_index;
+    // Sorted doc IDs per term, with the term's first byte offset in each doc
+    // (NO_OFFSET if unknown) for snippets and its number of occurrences there
+    // (up to MAX_TERM_COUNT) for relevance
+    struct PostingList {
+        std::vector<size_t> docs;
+        std::vector<uint32_t> offsets;
+        std::vector<uint16_t> counts;
+    };
+    std::unordered_map<std::string, PostingList> m_inverted_index;
+    // Estimated heap bytes of m_inverted_index, bytes of content stored by
+    // addFile(), and where the two together go beyond the budget
+    size_t m_postings_bytes{0};
+    size_t m_content_bytes{0};
+    size_t m_spill_budget{0};
+    std::filesystem::path m_spill_directory;
+    std::vector<std::filesystem::path> m_spill_runs; // in doc ID order
     Trie m_filename_trie;
+    Analyzer m_analyzer;
+    uint64_t m_generation{0};
+    mutable QueryCache m_query_cache;
 
-    void indexFileContent(const std::string& content, size_t file_index);
+    size_t storeRecord(const FileMetadata& data);
+    uint32_t internDirectory(uint32_t parent, const std::string& name);
+    uint32_t internPath(const std::filesystem::path& directory);
+    bool findDirectory(const std::filesystem::path& directory, uint32_t& id) const;
+    std::filesystem::path directoryPath(uint32_t id) const;
+    uint32_t internExtension(const std::string& extension);
+    void indexFileContent(const std::vector<TermOccurrence>& words, size_t file_index);
+    void spillPostings();
+    void removeSpilledRuns();
     std::vector<std::string> extractWords(const std::string& text) const;
     std::string toLowerCase(const std::string& str) const;
     bool isTextFile(const std::string& extension) const;
 
 
-    std::vector<FileMetadata> sortResults(std::vector<FileMetadata> results, SortBy criteria) const;
-    int calculateRelevance(const FileMetadata& file, const std::vector<std::string>& query_words) const;
+    std::vector<size_t> runQuery(const QueryNode& query, SortBy sort, size_t limit) const;
+    void rankIds(std::vector<size_t>& ids, const std::vector<std::string>& query_words, SortBy sort, size_t limit) const;
+    std::vector<FileMetadata> materialize(const std::vector<size_t>& ids) const;
+    FileMetadata fileAttributes(size_t id) const; // getFile() without the content
+
+    // Range lookups over the secondary orders; both bounds are inclusive
+    void ensureSortedOrders() const;
+    size_t countSizeRange(uint64_t low, uint64_t high) const;
+    std::vector<size_t> docsInSizeRange(uint64_t low, uint64_t high) const;
+    size_t countMtimeRange(int64_t low, int64_t high) const;
+    std::vector<size_t> docsInMtimeRange(int64_t low, int64_t high) const;
+    // Subtree lookups; false if the directory isn't in the index
+    bool directoryRange(const std::filesystem::path& directory, uint32_t& first, uint32_t& last) const;
+    size_t countDirectoryRange(uint32_t first, uint32_t last) const;
+    std::vector<size_t> docsInDirectoryRange(uint32_t first, uint32_t last) const;
 
-    void writeString(std::ofstream& out, const std::string& str) const;
-    std::string readString(std::ifstream& in) const;
-    void writeMap(std::ofstream& out, const std::unordered_map<std::string, std::vector<size_t>>& map) const;
-    void readMap(std::ifstream& in, std::unordered_map<std::string, std::vector<size_t>>& map);
-    void writeInvertedIndex(std::ofstream& out) const;
-    void readInvertedIndex(std::ifstream& in);
+    // Cache (de)serialization, see CacheFile.h; the filename and extension maps
+    // and the trie are derived from the records instead of being stored
+    std::string serializeDirectories() const;
+    std::string serializeExtensions() const;
+    std::string serializeFiles() const;
+    std::string serializePostings() const;
+    std::string serializeHashes() const;
+    std::string serializeAnalyzer() const;
+    void loadSections(const CacheFileReader& reader, bool withPostings);
+    void loadLegacy(BinaryReader& in, uint32_t version);
+    void rebuildDerivedMaps();
 };
 
 #endif 
@@ -1,5 +1,5 @@
 //Indexer.cpp
-#include "Indexer.h"
+#include "indexer.h"
 #include <filesystem>
 #include <iostream>
 #include <fstream>
@@ -7,11 +7,29 @@
 #include <algorithm>
 #include <thread>
 #include <vector>
-#include <windows.h>
 #include "utils.h"
+#include "contenthash.h"
 
 namespace fs = std::filesystem;
 
+namespace {
+std::ostream nullStream(nullptr);
+
+// Files read per ordering pass; large enough to sweep a directory tree's
+// worth of neighbouring inodes, small enough to start reading right away
+const size_t READ_BATCH = 1024;
+// Larger text files are indexed by name only
+const uint64_t MAX_CONTENT_SIZE = 1048576;
+
+bool isTextExtension(const std::string& ext) {
+    static const std::unordered_set<std::string> text_extensions = {
+        "txt", "cpp", "c", "h", "hpp", "py", "java", "js", "html", "css",
+        "xml", "json", "csv", "md", "log", "conf", "config", "ini", "bat", "sh"
+    };
+    return text_extensions.find(ext) != text_extensions.end();
+}
+}
+
 Indexer::Indexer(Index& index) : m_index(index), m_stopRequested(false) {}
 
 Indexer::~Indexer() {
@@ -22,6 +40,10 @@ void Indexer::setRootPath(const std::string& path) {
     m_rootPath = path;
 }
 
+std::ostream& Indexer::out() const {
+    return m_verbose ? std::cout : nullStream;
+}
+
 void Indexer::stop() {
     m_stopRequested = true;
     m_queueCV.notify_all();
@@ -35,6 +57,8 @@ void Indexer::stop() {
 }
 
 void Indexer::workerThread() {
+    IndexingMetrics::Collector& metrics = m_metrics.newCollector();
+
     while (!m_stopRequested) {
         std::unique_lock<std::mutex> lock(m_queueMutex);
 
@@ -46,21 +70,31 @@ void Indexer::workerThread() {
             if (!m_fileQueue.empty()) {
                 fs::path filePath = m_fileQueue.front();
                 m_fileQueue.pop();
+                metrics.recordQueueDepth(m_fileQueue.size());
                 lock.unlock();
 
-                processFile(filePath);
-
-                int processed = ++m_filesProcessed;
-                if (processed % 50 == 0) {
-                    std::cout << "Processed " << processed << " of " << m_totalFiles
-                              << " files (" << (processed * 100 / m_totalFiles) << "%)" << std::endl;
-                }
+                processFile(filePath, metrics);
+                reportProgress(++m_filesProcessed);
             }
         }
     }
 }
 
-void Indexer::processFile(const fs::path& filePath) {
+void Indexer::reportProgress(int processed) {
+    if (m_progressInterval.count() <= 0) return;
+
+    std::unique_lock<std::mutex> lock(m_progressMutex, std::try_to_lock);
+    if (!lock) return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - m_lastProgress < m_progressInterval) return;
+    m_lastProgress = now;
+
+    out() << "Processed " << processed << "/" << m_totalFiles
+              << " (" << (m_totalFiles ? processed * 100 / m_totalFiles : 100) << "%)" << std::endl;
+}
+
+void Indexer::processFile(const fs::path& filePath, IndexingMetrics::Collector& metrics) {
     try {
         FileMetadata data;
         data.path = filePath;
@@ -74,64 +108,270 @@ void Indexer::processFile(const fs::path& filePath) {
         std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
         data.extension = ext;
 
-        try {
-            data.size = fs::file_size(filePath);
-            data.last_modified = fs::last_write_time(filePath);
-        } catch (...) {
+        {
+            StageTimer timer(metrics, Stage::STAT);
+            std::error_code ec;
+            data.size = fs::file_size(filePath, ec);
+            if (!ec) {
+                data.last_modified = fs::last_write_time(filePath, ec);
+            }
+            if (ec) {
+                metrics.skip(SkipReason::STAT_FAILED);
+                return;
+            }
+        }
+
+        if (m_options.maxFileSize && data.size > m_options.maxFileSize) {
+            metrics.skip(SkipReason::FILTERED);
             return;
         }
 
-        static const std::unordered_set<std::string> text_extensions = {
-            "txt", "cpp", "c", "h", "hpp", "py", "java", "js", "html", "css",
-            "xml", "json", "csv", "md", "log", "conf", "config", "ini", "bat", "sh"
-        };
+        bool is_text_file = isTextExtension(ext);
+        bool needs_content = is_text_file && data.size > 0 && data.size < MAX_CONTENT_SIZE;
+
+        // Unchanged since the previous index: take its content instead of reading the file.
+        // If the previous index didn't store content, the file has to be read again.
+        size_t previousId;
+        bool reused = false;
+        if (m_previous && m_previous->findFile(filePath, previousId)) {
+            FileMetadata previous = m_previous->getFile(previousId);
+            if (previous.size == data.size && previous.last_modified == data.last_modified) {
+                if (m_hashDuplicates) data.hash = previous.hash;
+                if (!previous.content.empty() || !needs_content) {
+                    data.content = std::move(previous.content);
+                    reused = true;
+                    metrics.count(Counter::FILES_REUSED);
+                }
+            }
+        }
 
-        bool is_text_file = (text_extensions.find(ext) != text_extensions.end());
+        // Files whose content is skipped are still indexed by name and attributes
+        if (!reused) {
+            if (!is_text_file) {
+                metrics.skip(SkipReason::NOT_TEXT);
+            } else if (data.size == 0) {
+                metrics.skip(SkipReason::EMPTY);
+            } else if (data.size >= MAX_CONTENT_SIZE) {
+                metrics.skip(SkipReason::TOO_LARGE);
+            } else {
+                auto readStart = std::chrono::steady_clock::now();
+                data.content = readFileContent(filePath);
+                auto readNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - readStart).count();
+                metrics.recordRead(data.content.size(), static_cast<uint64_t>(readNanos));
+                if (data.content.empty()) {
+                    metrics.skip(SkipReason::READ_FAILED);
+                }
+            }
+        }
 
-        if (is_text_file && data.size > 0 && data.size < 1048576) {
-            data.content = readFileContent(filePath);
-        } else {
-            data.content = "";
+        std::vector<TermOccurrence> words;
+        {
+            StageTimer timer(metrics, Stage::TOKENIZE);
+            words = m_index.analyzeContent(data);
+        }
+        if (!m_options.storeContent) {
+            std::string().swap(data.content);
         }
 
+        auto waitStart = std::chrono::steady_clock::now();
         std::lock_guard<std::mutex> indexLock(m_queueMutex);
-        m_index.addFile(data);
+        metrics.record(Stage::LOCK_WAIT, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             std::chrono::steady_clock::now() - waitStart).count()));
+        {
+            StageTimer timer(metrics, Stage::INSERT);
+            m_index.addFile(data, words);
+        }
+        metrics.count(Counter::FILES_INDEXED);
 
     } catch (...) {
+        metrics.skip(SkipReason::ERROR);
     }
 }
 
+void Indexer::orderBatch(std::vector<fs::path>& batch, IndexingMetrics::Collector& metrics) {
+    if (m_options.readOrder == ReadOrder::WALK) return;
+    StageTimer timer(metrics, Stage::ORDER);
+
+    // Files that can't be located keep all-zero keys and go first in walk
+    // order; processFile then reports why. Files without a known extent
+    // (empty, inline, or on tmpfs) fall back to their inode among themselves.
+    bool physical = m_options.readOrder == ReadOrder::PHYSICAL;
+    std::vector<std::pair<FileLocation, size_t>> keyed(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        locateFile(batch[i], physical, keyed[i].first);
+        keyed[i].second = i;
+    }
+    std::stable_sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) {
+        const FileLocation& x = a.first;
+        const FileLocation& y = b.first;
+        if (x.device != y.device) return x.device < y.device;
+        if (x.physical != y.physical) return x.physical < y.physical;
+        return x.inode < y.inode;
+    });
+
+    std::vector<fs::path> ordered;
+    ordered.reserve(batch.size());
+    for (const auto& entry : keyed) {
+        ordered.push_back(std::move(batch[entry.second]));
+    }
+    batch.swap(ordered);
+}
+
+void Indexer::prefetch(const fs::path& filePath, IndexingMetrics::Collector& metrics) {
+    std::string ext = filePath.extension().string();
+    if (!ext.empty() && ext[0] == '.') ext = ext.substr(1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (!isTextExtension(ext)) return;
+    // Most files the previous index has are unchanged and won't be read
+    size_t previousId;
+    if (m_previous && m_previous->findFile(filePath, previousId)) return;
+
+    prefetchFile(filePath, MAX_CONTENT_SIZE);
+    metrics.count(Counter::FILES_PREFETCHED);
+}
+
+void Indexer::hashDuplicateCandidates(IndexingMetrics::Collector& metrics) {
+    StageTimer timer(metrics, Stage::HASH);
+
+    // A file whose size no other file has can't have a duplicate, so only
+    // files in size buckets of two or more are ever read
+    std::unordered_map<uint64_t, std::vector<size_t>> bySize;
+    for (size_t id = 0; id < m_index.fileCount(); ++id) {
+        if (m_index.fileSize(id) > 0) {
+            bySize[m_index.fileSize(id)].push_back(id);
+        }
+    }
+
+    std::vector<size_t> candidates;
+    for (const auto& bucket : bySize) {
+        if (bucket.second.size() < 2) continue;
+        for (size_t id : bucket.second) {
+            // Reused from the previous index with its hash intact
+            if (m_index.contentHash(id) == 0) candidates.push_back(id);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<uint64_t> hashes(candidates.size(), 0);
+    parallelFor(candidates.size(), [&](size_t i) {
+        if (m_stopRequested) return;
+        FileMetadata file = m_index.getFile(candidates[i]);
+        uint64_t hash;
+        if (file.content.size() == file.size) {
+            hash = hashContent(file.content.data(), file.content.size());
+        } else if (!hashFile(file.path, hash)) {
+            return;
+        }
+        // 0 is reserved for "not hashed"
+        hashes[i] = hash ? hash : 1;
+    });
+
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (hashes[i] == 0) {
+            if (!m_stopRequested) metrics.skip(SkipReason::READ_FAILED);
+            continue;
+        }
+        m_index.setContentHash(candidates[i], hashes[i]);
+        metrics.count(Counter::FILES_HASHED);
+    }
+}
 
 bool Indexer::scanDirectorySafe(const fs::path& path) {
+    if (!m_walkCollector) {
+        m_walkCollector = &m_metrics.newCollector();
+    }
+
+    m_ignore.clear();
+    if (m_options.useIgnoreFiles) {
+        for (const char* name : {".git/", ".hg/", ".svn/"}) {
+            m_ignore.defaults().addLine(name);
+        }
+    }
+    for (const auto& pattern : m_options.excludes) {
+        m_ignore.overrides().addLine(pattern);
+    }
+    return scanDirectory(path, std::string(), 0);
+}
+
+// relative is the '/'-separated path from the root, as ignore rules see it
+bool Indexer::scanDirectory(const fs::path& path, const std::string& relative, size_t depth) {
     auto options = fs::directory_options::skip_permission_denied;
-    int fileCount = 0;
+    m_walkCollector->count(Counter::DIRECTORIES_WALKED);
 
+    // Read the whole listing first: the directory's own ignore files apply to all of its entries
+    std::vector<fs::directory_entry> entries;
     try {
         for (const auto& entry : fs::directory_iterator(path, options)) {
             if (m_stopRequested) return false;
+            entries.push_back(entry);
+        }
+    } catch (const fs::filesystem_error& e) {
+        m_walkCollector->skip(SkipReason::DIRECTORY_INACCESSIBLE);
+        std::cerr << "Skipping inaccessible directory: " << path << " - " << e.what() << std::endl;
+        return false;
+    }
+
+    size_t ignoreLevels = 0;
+    if (m_options.useIgnoreFiles) {
+        // .ignore is pushed last so that it takes precedence over .gitignore
+        for (const char* ignoreFile : {".gitignore", ".ignore"}) {
+            bool present = std::any_of(entries.begin(), entries.end(), [ignoreFile](const fs::directory_entry& entry) {
+                return entry.path().filename() == ignoreFile;
+            });
+            IgnoreRules rules;
+            if (present && rules.loadFile(path / ignoreFile) && !rules.empty()) {
+                m_ignore.push(relative, std::move(rules));
+                ignoreLevels++;
+            }
+        }
+    }
+
+    for (const auto& entry : entries) {
+        if (m_stopRequested) break;
+
+        try {
+            std::string name = entry.path().filename().string();
+            std::string entryRelative = relative.empty() ? name : relative + "/" + name;
 
-            try {
-                if (entry.is_regular_file()) {
-                    m_totalFiles++;
-                    m_fileQueue.push(entry.path());
-                    fileCount++;
+            if (entry.is_regular_file()) {
+                if (m_ignore.isIgnored(entryRelative, name, false)) {
+                    m_walkCollector->count(Counter::FILES_IGNORED);
+                    continue;
                 }
-                else if (entry.is_directory()) {
-              
-                    scanDirectorySafe(entry.path());
+                if (!m_options.extensions.empty()) {
+                    std::string ext = entry.path().extension().string();
+                    if (!ext.empty() && ext[0] == '.') ext = ext.substr(1);
+                    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                    if (m_options.extensions.count(ext) == 0) {
+                        m_walkCollector->count(Counter::FILES_IGNORED);
+                        continue;
+                    }
                 }
-            } catch (const fs::filesystem_error& e) {
- 
-                continue;
-            } catch (...) {
-                continue;
+
+                m_totalFiles++;
+                m_fileQueue.push(entry.path());
+                m_walkCollector->count(Counter::FILES_DISCOVERED);
+            }
+            else if (entry.is_directory()) {
+                if (depth >= m_options.maxDepth || m_ignore.isIgnored(entryRelative, name, true)) {
+                    m_walkCollector->count(Counter::DIRECTORIES_PRUNED);
+                    continue;
+                }
+                scanDirectory(entry.path(), entryRelative, depth + 1);
             }
+        } catch (const fs::filesystem_error& e) {
+
+            continue;
+        } catch (...) {
+            continue;
         }
-        return true;
-    } catch (const fs::filesystem_error& e) {
-        std::cerr << "Skipping inaccessible directory: " << path << " - " << e.what() << std::endl;
-        return false;
     }
+
+    for (; ignoreLevels > 0; --ignoreLevels) {
+        m_ignore.pop();
+    }
+    return true;
 }
 
 void Indexer::run() {
@@ -140,11 +380,14 @@ void Indexer::run() {
         return;
     }
 
-    std::cout << "🚀 Scanning: " << m_rootPath << std::endl;
+    out() << "🚀 Scanning: " << m_rootPath << std::endl;
 
     m_stopRequested = false;
     m_filesProcessed = 0;
     m_totalFiles = 0;
+    m_metrics.reset();
+    m_walkCollector = nullptr;
+    m_lastProgress = std::chrono::steady_clock::now();
 
     try {
         if (!fs::exists(m_rootPath)) {
@@ -157,53 +400,77 @@ void Indexer::run() {
             return;
         }
 
-        std::cout << "📁 Building file list (safe mode)..." << std::endl;
+        out() << "📁 Building file list (safe mode)..." << std::endl;
 
-        bool success = scanDirectorySafe(m_rootPath);
+        bool success;
+        {
+            m_walkCollector = &m_metrics.newCollector();
+            StageTimer walkTimer(*m_walkCollector, Stage::WALK);
+            success = scanDirectorySafe(m_rootPath);
+        }
 
         if (m_stopRequested) {
-            std::cout << "⏹️  Scanning stopped" << std::endl;
+            out() << "⏹️  Scanning stopped" << std::endl;
             return;
         }
 
         if (m_totalFiles == 0) {
             if (!success) {
-                std::cout << "❌ Could not access any files in the directory." << std::endl;
-                std::cout << "💡 Try running as Administrator or choose a different directory." << std::endl;
+                out() << "❌ Could not access any files in the directory." << std::endl;
+                out() << "💡 Try running as Administrator or choose a different directory." << std::endl;
             } else {
-                std::cout << "ℹ️  No files found in directory." << std::endl;
+                out() << "ℹ️  No files found in directory." << std::endl;
             }
             return;
         }
 
-        std::cout << "✅ Found " << m_totalFiles << " accessible files" << std::endl;
+        out() << "✅ Found " << m_totalFiles << " accessible files" << std::endl;
 
-        std::cout << "🧵 Using single thread" << std::endl;
-        std::cout << "⚡ Processing files..." << std::endl;
+        out() << "🧵 Using single thread" << std::endl;
+        out() << "⚡ Processing files..." << std::endl;
 
         auto startTime = std::chrono::steady_clock::now();
+        IndexingMetrics::Collector& metrics = m_metrics.newCollector();
+        m_index.setSpillBudget(m_options.memoryBudget, m_options.spillDirectory);
+        size_t runsBefore = m_index.spilledRunCount();
 
+        std::vector<fs::path> batch;
+        size_t ahead = m_options.readAhead;
         while (!m_fileQueue.empty() && !m_stopRequested) {
-            fs::path filePath = m_fileQueue.front();
-            m_fileQueue.pop();
-            processFile(filePath);
-            m_filesProcessed++;
-
-            if (m_filesProcessed % 10 == 0) {
-                auto currentTime = std::chrono::steady_clock::now();
-                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - startTime).count();
-                std::cout << "Processed " << m_filesProcessed << "/" << m_totalFiles
-                          << " (" << (m_filesProcessed * 100 / m_totalFiles) << "%)"
-                          << " in " << elapsed << "ms" << std::endl;
+            batch.clear();
+            while (!m_fileQueue.empty() && batch.size() < READ_BATCH) {
+                batch.push_back(std::move(m_fileQueue.front()));
+                m_fileQueue.pop();
+            }
+            orderBatch(batch, metrics);
+
+            // Keep the next few reads in flight while this file is tokenized
+            for (size_t i = 0; i < std::min(ahead, batch.size()); ++i) {
+                prefetch(batch[i], metrics);
+            }
+            for (size_t i = 0; i < batch.size() && !m_stopRequested; ++i) {
+                if (ahead && i + ahead < batch.size()) {
+                    prefetch(batch[i + ahead], metrics);
+                }
+                metrics.recordQueueDepth(m_fileQueue.size() + batch.size() - i - 1);
+                processFile(batch[i], metrics);
+                reportProgress(++m_filesProcessed);
             }
         }
 
+        metrics.count(Counter::POSTING_RUNS_SPILLED, m_index.spilledRunCount() - runsBefore);
+
+        if (m_hashDuplicates && !m_stopRequested) {
+            out() << "🔍 Hashing possible duplicates..." << std::endl;
+            hashDuplicateCandidates(metrics);
+        }
+
         auto endTime = std::chrono::steady_clock::now();
         auto totalTime = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count();
 
-        std::cout << "✅ Complete! Processed " << m_filesProcessed << " files in " << totalTime << "ms" << std::endl;
+        out() << "✅ Complete! Processed " << m_filesProcessed << " files in " << totalTime << "ms" << std::endl;
         if (m_filesProcessed > 0) {
-            std::cout << "⏱️  Average: " << (totalTime / m_filesProcessed) << "ms per file" << std::endl;
+            out() << "⏱️  Average: " << (totalTime / m_filesProcessed) << "ms per file" << std::endl;
         }
 
     } catch (const fs::filesystem_error& e) {
@@ -211,5 +478,12 @@ void Indexer::run() {
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     }
+
+    // Also when stopped or failed: the index stays searchable for what was
+    // added, and no run files are left behind next to the cache
+    if (m_index.spilledRunCount() > 0) {
+        out() << "🔀 Merging " << m_index.spilledRunCount() << " spilled runs..." << std::endl;
+    }
+    m_index.mergeSpilledRuns();
 }
 
@@ -9,7 +9,50 @@
 #include <queue>
 #include <condition_variable>
 #include <atomic>
-#include "Index.h"
+#include <chrono>
+#include <cstdint>
+#include <unordered_set>
+#include "ignore.h"
+#include "index.h"
+#include "metrics.h"
+
+// The order files are read in. The walk yields them grouped by directory,
+// which on a spinning disk means a seek between most reads; ordering each
+// batch by where the data sits turns that into a mostly forward sweep.
+enum class ReadOrder {
+    WALK,     // as the walk found them
+    INODE,    // by device and inode number, which filesystems allocate near the data
+    PHYSICAL  // by the disk offset of the first extent (Linux FIEMAP), else as INODE
+};
+
+// What the directory walk leaves out. Ignored directories are pruned before
+// they are opened, so nothing below them costs a syscall.
+struct IndexerOptions {
+    // Honour .gitignore and .ignore files and skip .git, .hg and .svn
+    bool useIgnoreFiles = true;
+    // Extra gitignore-style patterns relative to the root; they beat every ignore file
+    std::vector<std::string> excludes;
+    // Files larger than this aren't indexed at all; 0 for no limit
+    uintmax_t maxFileSize = 0;
+    // How many directory levels below the root to descend into
+    size_t maxDepth = SIZE_MAX;
+    // Lowercase extensions without the dot; when non-empty, other files are skipped
+    std::unordered_set<std::string> extensions;
+
+    // Rough cap on the memory the postings and stored contents take while
+    // indexing: contents stop being stored at half of it and postings beyond
+    // it are spilled to sorted runs (see Index::setSpillBudget). 0 for no limit
+    size_t memoryBudget = 0;
+    // Where the runs go; the system temp directory if empty
+    std::filesystem::path spillDirectory;
+    // Keep each file's content in the index. Without it snippets read the
+    // file instead.
+    bool storeContent = true;
+
+    ReadOrder readOrder = ReadOrder::INODE;
+    // How many files ahead of the one being read to ask the kernel to prefetch; 0 for none
+    size_t readAhead = 8;
+};
 
 class Indexer {
 public:
@@ -23,9 +66,27 @@ public:
     
     bool scanDirectorySafe(const std::filesystem::path& path);
 
+    // Files whose size and mtime match an entry here are copied instead of read again
+    void setPreviousIndex(const Index* previous) { m_previous = previous; }
+    // Informational output on stdout; errors always go to stderr
+    void setVerbose(bool verbose) { m_verbose = verbose; }
+    // Hash the content of every file that shares its size with another file,
+    // so Index::findDuplicates() can group them
+    void setHashDuplicates(bool hash) { m_hashDuplicates = hash; }
+    void setOptions(const IndexerOptions& options) { m_options = options; }
+
+    const IndexingMetrics& metrics() const { return m_metrics; }
+    // At most one progress line per interval; zero turns progress output off
+    void setProgressInterval(std::chrono::milliseconds interval) { m_progressInterval = interval; }
+
 private:
     Index& m_index;
+    const Index* m_previous{nullptr};
     std::string m_rootPath;
+    bool m_verbose{true};
+    bool m_hashDuplicates{false};
+    IndexerOptions m_options;
+    IgnoreStack m_ignore;
 
     
     std::vector<std::thread> m_workerThreads;
@@ -36,8 +97,20 @@ private:
     std::atomic<int> m_filesProcessed{0};
     int m_totalFiles{0};
 
+    IndexingMetrics m_metrics;
+    IndexingMetrics::Collector* m_walkCollector{nullptr};
+    std::chrono::milliseconds m_progressInterval{1000};
+    std::chrono::steady_clock::time_point m_lastProgress;
+    std::mutex m_progressMutex;
+
+    bool scanDirectory(const std::filesystem::path& path, const std::string& relative, size_t depth);
     void workerThread(); 
-    void processFile(const std::filesystem::path& filePath); 
+    void processFile(const std::filesystem::path& filePath, IndexingMetrics::Collector& metrics);
+    void orderBatch(std::vector<std::filesystem::path>& batch, IndexingMetrics::Collector& metrics);
+    void prefetch(const std::filesystem::path& filePath, IndexingMetrics::Collector& metrics);
+    void hashDuplicateCandidates(IndexingMetrics::Collector& metrics);
+    void reportProgress(int processed);
+    std::ostream& out() const;
 };
 
 #endif 
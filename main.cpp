@@ -1,12 +1,27 @@
 // main.cpp
+#include <algorithm>
+#include <csignal>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <chrono>
 #include <string>
+#include <vector>
+#include "index.h"
+#include "indexer.h"
+#include "server.h"
+#include "utils.h"
+
+#ifdef _WIN32
 #include <windows.h>
-#include "Index.h"
-#include "Indexer.h"
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
 
+#ifdef _WIN32
 bool isAdmin() {
     BOOL isAdmin = FALSE;
     PSID adminGroup = NULL;
@@ -29,7 +44,658 @@ void runAsAdmin() {
     ShellExecute(NULL, "runas", path, NULL, NULL, SW_SHOWNORMAL);
     exit(0);
 }
+#endif
+
+namespace {
+
+const char* DEFAULT_CACHE = "index_cache.bin";
+const size_t DEFAULT_COMPLETIONS = 10;
+
+enum ExitCode {
+    EXIT_OK = 0,
+    EXIT_FAILED = 1,
+    EXIT_USAGE = 2
+};
+
+struct CliOptions {
+    std::string command;
+    std::vector<std::string> arguments;
+    std::string cache = DEFAULT_CACHE;
+    std::string batch;
+    std::string socket;
+    size_t threads = 0;
+    std::string metricsFile;
+    std::string metricsFormat = "json";
+    SortBy sort = SortBy::RELEVANCE;
+    size_t limit = 0;
+    size_t snippets = 0;
+    uint64_t minSize = 1;
+    bool hash = false;
+    IndexerOptions indexing;
+    AnalyzerOptions analyzer;
+    bool analyzerChosen = false; // otherwise update keeps the cache's analyzer options
+    bool quiet = false;
+    bool json = false;
+    bool explain = false;
+};
+
+void printUsage(std::ostream& out) {
+    out << "Usage:\n"
+        << "  FileSearchApp                                 interactive mode\n"
+        << "  FileSearchApp index <root> [options]          index a directory tree and save the cache\n"
+        << "  FileSearchApp update <root> [options]         re-index, reusing unchanged files from the cache\n"
+        << "  FileSearchApp query [options] <terms...>      run one query against the cache\n"
+        << "  FileSearchApp query --batch <file|-> [options] run one query per line, one JSON result per line\n"
+        << "  FileSearchApp complete [options] <prefix>     filenames starting with prefix, newest first\n"
+        << "  FileSearchApp complete --batch <file|-> [options] one completion per line, as if typed\n"
+        << "  FileSearchApp stats [--json] [options]        describe the cached index\n"
+        << "  FileSearchApp duplicates [options]            list groups of identical files (index with --hash)\n"
+        << "  FileSearchApp serve --socket PATH [options]   keep the index loaded and answer queries on a socket\n"
+        << "\n"
+        << "Options:\n"
+        << "  --cache PATH              index cache file (default " << DEFAULT_CACHE << ")\n"
+        << "  --sort KEY                relevance, name, size, -size, date or -date (complete: -date or -size are fastest)\n"
+        << "  --limit N                 return at most N results (duplicate groups)\n"
+        << "  --snippets N              show up to N matching lines per query result\n"
+        << "  --hash                    hash same-sized files while indexing, for duplicates\n"
+        << "  --exclude PATTERN         gitignore-style pattern to leave out of index/update (repeatable)\n"
+        << "  --no-ignore               don't read .gitignore/.ignore files or skip .git, .hg and .svn\n"
+        << "  --max-size BYTES          don't index files larger than this\n"
+        << "  --max-depth N             descend at most N directory levels below the root\n"
+        << "  --ext LIST                only index these comma-separated extensions\n"
+        << "  --memory-budget BYTES     cap postings plus stored contents while indexing: contents\n"
+        << "                            stop being stored at half, postings beyond it spill to\n"
+        << "                            temporary files next to the cache\n"
+        << "  --no-content              don't keep file contents in the cache (smaller; snippets read the files)\n"
+        << "  --read-order ORDER        inode (default), physical (disk offset, Linux) or walk\n"
+        << "  --read-ahead N            files to prefetch ahead of the one being read (default 8, 0 for none)\n"
+        << "  --stem                    index/update: reduce English words to their stems\n"
+        << "  --stop-words              index/update: leave out common English words\n"
+        << "  --no-split-identifiers    index/update: don't also index the parts of camelCase/snake_case names\n"
+        << "  --min-size BYTES          smallest file duplicates reports (default 1)\n"
+        << "  --json                    machine-readable output\n"
+        << "  --explain                 print the query plan instead of results\n"
+        << "  --metrics FILE            write indexing metrics after index/update\n"
+        << "  --metrics-format FORMAT   json (default) or prometheus\n"
+        << "  --socket PATH             Unix socket to serve on, or for query/stats to send requests to\n"
+        << "  --threads N               server worker threads (default: hardware threads)\n"
+        << "  --quiet                   no progress output\n";
+}
+
+// Returns false (after printing why) on a malformed command line
+bool parseArguments(int argc, char* argv[], CliOptions& options) {
+    options.command = argv[1];
+
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&](std::string& out) {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << std::endl;
+                return false;
+            }
+            out = argv[++i];
+            return true;
+        };
+
+        std::string text;
+        if (arg == "--cache") {
+            if (!value(options.cache)) return false;
+        } else if (arg == "--batch") {
+            if (!value(options.batch)) return false;
+        } else if (arg == "--metrics") {
+            if (!value(options.metricsFile)) return false;
+        } else if (arg == "--metrics-format") {
+            if (!value(options.metricsFormat)) return false;
+            if (options.metricsFormat != "json" && options.metricsFormat != "prometheus") {
+                std::cerr << "Unknown metrics format: " << options.metricsFormat << std::endl;
+                return false;
+            }
+        } else if (arg == "--sort") {
+            if (!value(text)) return false;
+            if (!parseSortBy(text, options.sort)) {
+                std::cerr << "Unknown sort key: " << text << std::endl;
+                return false;
+            }
+        } else if (arg == "--socket") {
+            if (!value(options.socket)) return false;
+        } else if (arg == "--exclude") {
+            if (!value(text)) return false;
+            options.indexing.excludes.push_back(text);
+        } else if (arg == "--ext") {
+            if (!value(text)) return false;
+            std::istringstream list(text);
+            std::string ext;
+            while (std::getline(list, ext, ',')) {
+                if (!ext.empty() && ext[0] == '.') ext = ext.substr(1);
+                std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                options.indexing.extensions.insert(ext);
+            }
+        } else if (arg == "--read-order") {
+            if (!value(text)) return false;
+            if (text == "walk") {
+                options.indexing.readOrder = ReadOrder::WALK;
+            } else if (text == "inode") {
+                options.indexing.readOrder = ReadOrder::INODE;
+            } else if (text == "physical") {
+                options.indexing.readOrder = ReadOrder::PHYSICAL;
+            } else {
+                std::cerr << "Unknown read order: " << text << std::endl;
+                return false;
+            }
+        } else if (arg == "--limit" || arg == "--threads" || arg == "--min-size" || arg == "--max-size" ||
+                   arg == "--max-depth" || arg == "--snippets" || arg == "--memory-budget" ||
+                   arg == "--read-ahead") {
+            if (!value(text)) return false;
+            unsigned long long number;
+            try {
+                number = std::stoull(text);
+            } catch (const std::exception&) {
+                std::cerr << "Invalid number for " << arg << ": " << text << std::endl;
+                return false;
+            }
+            if (arg == "--limit") {
+                options.limit = static_cast<size_t>(number);
+            } else if (arg == "--threads") {
+                options.threads = static_cast<size_t>(number);
+            } else if (arg == "--snippets") {
+                options.snippets = static_cast<size_t>(number);
+            } else if (arg == "--min-size") {
+                options.minSize = number;
+            } else if (arg == "--max-size") {
+                options.indexing.maxFileSize = number;
+            } else if (arg == "--memory-budget") {
+                options.indexing.memoryBudget = static_cast<size_t>(number);
+            } else if (arg == "--read-ahead") {
+                options.indexing.readAhead = static_cast<size_t>(number);
+            } else {
+                options.indexing.maxDepth = static_cast<size_t>(number);
+            }
+        } else if (arg == "--hash") {
+            options.hash = true;
+        } else if (arg == "--no-ignore") {
+            options.indexing.useIgnoreFiles = false;
+        } else if (arg == "--no-content") {
+            options.indexing.storeContent = false;
+        } else if (arg == "--stem" || arg == "--stop-words" || arg == "--no-split-identifiers") {
+            if (arg == "--stem") options.analyzer.stem = true;
+            else if (arg == "--stop-words") options.analyzer.stopWords = true;
+            else options.analyzer.splitIdentifiers = false;
+            options.analyzerChosen = true;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--explain") {
+            options.explain = true;
+        } else if (arg == "--quiet" || arg == "-q") {
+            options.quiet = true;
+        } else if (arg == "--") {
+            for (++i; i < argc; ++i) options.arguments.push_back(argv[i]);
+        } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        } else {
+            // Anything else, including "-word" exclusions, belongs to the command
+            options.arguments.push_back(arg);
+        }
+    }
+    return true;
+}
+
+bool loadIndex(Index& index, const CliOptions& options) {
+    if (!index.loadFromFile(options.cache)) {
+        std::cerr << "Could not load index cache '" << options.cache << "'; run 'index <root>' first" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool writeMetrics(const Indexer& indexer, const CliOptions& options) {
+    if (options.metricsFile.empty()) return true;
+
+    std::ofstream out(options.metricsFile, std::ios::binary);
+    out << (options.metricsFormat == "prometheus" ? indexer.metrics().toPrometheus()
+                                                  : indexer.metrics().toJson() + "\n");
+    if (!out) {
+        std::cerr << "Failed to write metrics to " << options.metricsFile << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Shared by index and update: the previous index, if any, supplies reusable content
+int runIndex(const CliOptions& options, const Index* previous) {
+    if (options.arguments.size() != 1) {
+        std::cerr << "Expected exactly one root directory" << std::endl;
+        return EXIT_USAGE;
+    }
+
+    fs::path root = fs::absolute(fs::path(options.arguments[0])).lexically_normal().make_preferred();
+    Index index;
+    // A legacy cache is upgraded; otherwise update sticks to the analyzer the cache was built with
+    bool keepAnalyzer = previous && !options.analyzerChosen && !previous->analyzerOptions().legacy;
+    index.setAnalyzerOptions(keepAnalyzer ? previous->analyzerOptions() : options.analyzer);
+    Indexer indexer(index);
+    indexer.setRootPath(root.string());
+    indexer.setPreviousIndex(previous);
+    indexer.setHashDuplicates(options.hash);
+    IndexerOptions indexing = options.indexing;
+    if (indexing.spillDirectory.empty()) {
+        // Next to the cache rather than in /tmp, which is often RAM-backed
+        indexing.spillDirectory = fs::absolute(options.cache).parent_path();
+    }
+    indexer.setOptions(indexing);
+    indexer.setVerbose(!options.quiet && !options.json);
+    if (options.quiet || options.json) {
+        indexer.setProgressInterval(std::chrono::milliseconds(0));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    indexer.run();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    bool saved = index.saveToFile(options.cache);
+    if (!saved) {
+        std::cerr << "Failed to save index cache '" << options.cache << "'" << std::endl;
+    }
+    bool metricsWritten = writeMetrics(indexer, options);
+
+    MetricsSnapshot snapshot = indexer.metrics().snapshot();
+    if (options.json) {
+        std::cout << "{\"files\":" << index.fileCount() << ",\"reused\":"
+                  << snapshot.counters[static_cast<size_t>(Counter::FILES_REUSED)] << ",\"elapsed_ms\":"
+                  << elapsed.count() << ",\"cache\":\"" << jsonEscape(options.cache) << "\"}" << std::endl;
+    } else if (!options.quiet) {
+        std::cout << "Indexed " << index.fileCount() << " files";
+        if (previous) {
+            std::cout << " (" << snapshot.counters[static_cast<size_t>(Counter::FILES_REUSED)]
+                      << " unchanged)";
+        }
+        std::cout << " in " << elapsed.count() << " ms; cache written to " << options.cache << std::endl;
+    }
+    return saved && metricsWritten ? EXIT_OK : EXIT_FAILED;
+}
+
+int runUpdate(const CliOptions& options) {
+    // Reuse only needs the file records, not the postings
+    Index previous;
+    if (!previous.loadFromFile(options.cache, false)) {
+        if (!options.quiet) {
+            std::cerr << "No usable cache at '" << options.cache << "'; indexing from scratch" << std::endl;
+        }
+        return runIndex(options, nullptr);
+    }
+    return runIndex(options, &previous);
+}
 
+// "QUERY" plus the --sort/--limit options in the server's key=value form
+std::string remoteQueryVerb(const CliOptions& options) {
+    std::string verb = "QUERY ";
+    if (options.sort != SortBy::RELEVANCE) verb += "sort=" + std::string(sortByName(options.sort)) + " ";
+    if (options.limit) verb += "limit=" + std::to_string(options.limit) + " ";
+    if (options.snippets) verb += "snippets=" + std::to_string(options.snippets) + " ";
+    return verb;
+}
+
+// "COMPLETE" with the sort and limit complete defaults to when none are given
+std::string remoteCompleteVerb(const CliOptions& options) {
+    SortBy sort = options.sort == SortBy::RELEVANCE ? SortBy::DATE_DESC : options.sort;
+    return "COMPLETE sort=" + std::string(sortByName(sort)) + " limit=" +
+           std::to_string(options.limit ? options.limit : DEFAULT_COMPLETIONS) + " ";
+}
+
+// Sends every request over one connection to a running server and prints the raw
+// responses; each line of batch becomes batchVerb followed by the line
+int runRemote(const CliOptions& options, const std::vector<std::string>& requests, std::istream* batch,
+              const std::string& batchVerb = std::string()) {
+    QueryClient client;
+    std::string error;
+    if (!client.connect(options.socket, &error)) {
+        std::cerr << error << std::endl;
+        return EXIT_FAILED;
+    }
+
+    auto send = [&](const std::string& request) {
+        std::string response;
+        if (!client.request(request, response, &error)) {
+            std::cerr << error << std::endl;
+            return false;
+        }
+        std::cout << response << "\n";
+        return true;
+    };
+
+    for (const auto& request : requests) {
+        if (!send(request)) return EXIT_FAILED;
+    }
+
+    std::string line;
+    while (batch && std::getline(*batch, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        if (!send(batchVerb + line)) return EXIT_FAILED;
+    }
+    std::cout.flush();
+    return EXIT_OK;
+}
+
+bool stdoutIsTerminal() {
+#ifdef _WIN32
+    return _isatty(_fileno(stdout)) != 0;
+#else
+    return isatty(fileno(stdout)) != 0;
+#endif
+}
+
+// Indented under the result's path, with the matched words in bold red on a terminal
+void printSnippets(const std::vector<Snippet>& snippets, bool color) {
+    for (const auto& snippet : snippets) {
+        std::string line = "    ";
+        size_t position = 0;
+        for (const auto& highlight : snippet.highlights) {
+            line.append(snippet.text, position, highlight.first - position);
+            if (color) line += "\033[1;31m";
+            line.append(snippet.text, highlight.first, highlight.second - highlight.first);
+            if (color) line += "\033[0m";
+            position = highlight.second;
+        }
+        line.append(snippet.text, position, std::string::npos);
+        std::replace(line.begin(), line.end(), '\t', ' ');
+        std::cout << line << "\n";
+    }
+}
+
+void writeResultJson(const Index& index, const FileMetadata& file, const std::string& query,
+                     const CliOptions& options) {
+    if (options.snippets == 0) {
+        writeFileJson(std::cout, file);
+        return;
+    }
+    std::vector<Snippet> snippets = index.snippets(file, query, options.snippets);
+    writeFileJson(std::cout, file, &snippets);
+}
+
+// Reads one query per line and writes one JSON object per line; the index is loaded once
+int runBatch(const Index& index, const CliOptions& options) {
+    std::ifstream file;
+    std::istream* in = &std::cin;
+    if (options.batch != "-") {
+        file.open(options.batch);
+        if (!file) {
+            std::cerr << "Cannot open batch file '" << options.batch << "'" << std::endl;
+            return EXIT_FAILED;
+        }
+        in = &file;
+    }
+
+    std::string line;
+    while (std::getline(*in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+
+        std::string error;
+        auto start = std::chrono::steady_clock::now();
+        auto results = index.search(line, options.sort, options.limit, &error);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+
+        std::cout << "{\"query\":\"" << jsonEscape(line) << "\"";
+        if (!error.empty()) {
+            std::cout << ",\"error\":\"" << jsonEscape(error) << "\"}\n";
+            continue;
+        }
+        std::cout << ",\"count\":" << results.size() << ",\"elapsed_us\":" << elapsed.count() << ",\"results\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (i) std::cout << ",";
+            writeResultJson(index, results[i], line, options);
+        }
+        std::cout << "]}\n";
+    }
+    std::cout.flush();
+    return EXIT_OK;
+}
+
+int runQuery(const CliOptions& options) {
+    if (options.batch.empty() && options.arguments.empty()) {
+        std::cerr << "Expected query terms or --batch" << std::endl;
+        return EXIT_USAGE;
+    }
+
+    std::string query;
+    for (const auto& argument : options.arguments) {
+        if (!query.empty()) query += ' ';
+        query += argument;
+    }
+
+    if (!options.socket.empty()) {
+        if (options.batch.empty()) {
+            return runRemote(options, {(options.explain ? "EXPLAIN " : remoteQueryVerb(options)) + query}, nullptr);
+        }
+        std::ifstream file;
+        if (options.batch != "-") {
+            file.open(options.batch);
+            if (!file) {
+                std::cerr << "Cannot open batch file '" << options.batch << "'" << std::endl;
+                return EXIT_FAILED;
+            }
+        }
+        return runRemote(options, {}, options.batch == "-" ? &std::cin : &file, remoteQueryVerb(options));
+    }
+
+    Index index;
+    if (!loadIndex(index, options)) return EXIT_FAILED;
+    if (!options.batch.empty()) return runBatch(index, options);
+
+    if (options.explain) {
+        std::cout << index.explain(query) << std::endl;
+        return EXIT_OK;
+    }
+
+    std::string error;
+    auto results = index.search(query, options.sort, options.limit, &error);
+    if (!error.empty()) {
+        if (options.json) {
+            std::cout << "{\"query\":\"" << jsonEscape(query) << "\",\"error\":\"" << jsonEscape(error) << "\"}"
+                      << std::endl;
+        } else {
+            std::cerr << "Invalid query: " << error << std::endl;
+        }
+        return EXIT_USAGE;
+    }
+
+    if (options.json) {
+        std::cout << "{\"query\":\"" << jsonEscape(query) << "\",\"count\":" << results.size() << ",\"results\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (i) std::cout << ",";
+            writeResultJson(index, results[i], query, options);
+        }
+        std::cout << "]}" << std::endl;
+    } else {
+        bool color = stdoutIsTerminal();
+        for (const auto& file : results) {
+            std::cout << file.path.string() << "\n";
+            if (options.snippets) {
+                printSnippets(index.snippets(file, query, options.snippets), color);
+            }
+        }
+        std::cout.flush();
+    }
+    return EXIT_OK;
+}
+
+// Filenames starting with a prefix. With --batch each line is the text typed so
+// far and a single cursor follows along, as a search-as-you-type client would.
+int runComplete(const CliOptions& options) {
+    if (options.batch.empty() && options.arguments.size() != 1) {
+        std::cerr << "Expected one prefix or --batch" << std::endl;
+        return EXIT_USAGE;
+    }
+
+    std::ifstream file;
+    std::istream* batch = nullptr;
+    if (!options.batch.empty()) {
+        batch = &std::cin;
+        if (options.batch != "-") {
+            file.open(options.batch);
+            if (!file) {
+                std::cerr << "Cannot open batch file '" << options.batch << "'" << std::endl;
+                return EXIT_FAILED;
+            }
+            batch = &file;
+        }
+    }
+
+    if (!options.socket.empty()) {
+        std::vector<std::string> requests;
+        if (!batch) requests.push_back(remoteCompleteVerb(options) + options.arguments[0]);
+        return runRemote(options, requests, batch, remoteCompleteVerb(options));
+    }
+
+    Index index;
+    if (!loadIndex(index, options)) return EXIT_FAILED;
+    SortBy sort = options.sort == SortBy::RELEVANCE ? SortBy::DATE_DESC : options.sort;
+    size_t limit = options.limit ? options.limit : DEFAULT_COMPLETIONS;
+    PrefixCursor cursor = index.prefixCursor();
+
+    auto complete = [&](const std::string& prefix, bool json) {
+        auto start = std::chrono::steady_clock::now();
+        cursor.seek(prefix);
+        auto results = index.complete(cursor, limit, sort);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+
+        if (!json) {
+            for (const auto& result : results) {
+                std::cout << result.path.string() << "\n";
+            }
+            return;
+        }
+        std::cout << "{\"prefix\":\"" << jsonEscape(prefix) << "\",\"count\":" << results.size()
+                  << ",\"elapsed_us\":" << elapsed.count() << ",\"results\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (i) std::cout << ",";
+            writeFileJson(std::cout, results[i]);
+        }
+        std::cout << "]}\n";
+    };
+
+    if (!batch) {
+        complete(options.arguments[0], options.json);
+    } else {
+        std::string line;
+        while (std::getline(*batch, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            complete(line, true);
+        }
+    }
+    std::cout.flush();
+    return EXIT_OK;
+}
+
+int runStats(const CliOptions& options) {
+    if (!options.socket.empty()) return runRemote(options, {"STATS"}, nullptr);
+
+    Index index;
+    if (!loadIndex(index, options)) return EXIT_FAILED;
+
+    std::error_code ec;
+    uintmax_t cacheBytes = fs::file_size(options.cache, ec);
+    if (ec) cacheBytes = 0;
+
+    if (options.json) {
+        std::cout << "{\"cache\":\"" << jsonEscape(options.cache) << "\",\"cache_bytes\":" << cacheBytes
+                  << ",\"files\":" << index.fileCount() << ",\"directories\":" << index.directoryCount()
+                  << ",\"terms\":" << index.termCount() << ",\"extensions\":" << index.extensionCount()
+                  << ",\"analyzer\":\"" << jsonEscape(describeAnalyzer(index.analyzerOptions())) << "\"}" << std::endl;
+    } else {
+        std::cout << "Cache:       " << options.cache << " (" << cacheBytes << " bytes)\n"
+                  << "Files:       " << index.fileCount() << "\n"
+                  << "Directories: " << index.directoryCount() << "\n"
+                  << "Terms:       " << index.termCount() << "\n"
+                  << "Extensions:  " << index.extensionCount() << "\n"
+                  << "Analyzer:    " << describeAnalyzer(index.analyzerOptions()) << std::endl;
+    }
+    return EXIT_OK;
+}
+
+int runDuplicates(const CliOptions& options) {
+    Index index;
+    if (!loadIndex(index, options)) return EXIT_FAILED;
+
+    auto groups = index.findDuplicates(options.minSize);
+    if (options.limit && groups.size() > options.limit) {
+        groups.resize(options.limit);
+    }
+    uint64_t wasted = 0;
+    for (const auto& group : groups) {
+        wasted += group[0].size * (group.size() - 1);
+    }
+
+    if (options.json) {
+        std::cout << "{\"groups\":" << groups.size() << ",\"wasted_bytes\":" << wasted << ",\"duplicates\":[";
+        for (size_t g = 0; g < groups.size(); ++g) {
+            if (g) std::cout << ",";
+            std::cout << "{\"size\":" << groups[g][0].size << ",\"hash\":\"" << std::hex << groups[g][0].hash
+                      << std::dec << "\",\"files\":[";
+            for (size_t i = 0; i < groups[g].size(); ++i) {
+                if (i) std::cout << ",";
+                writeFileJson(std::cout, groups[g][i]);
+            }
+            std::cout << "]}";
+        }
+        std::cout << "]}" << std::endl;
+        return EXIT_OK;
+    }
+
+    for (const auto& group : groups) {
+        std::cout << group.size() << " copies of " << group[0].size << " bytes:\n";
+        for (const auto& file : group) {
+            std::cout << "  " << file.path.string() << "\n";
+        }
+    }
+    if (!options.quiet) {
+        std::cout << groups.size() << " duplicate groups, " << wasted << " redundant bytes" << std::endl;
+    }
+    return EXIT_OK;
+}
+
+QueryServer* g_server = nullptr;
+
+void handleStopSignal(int) {
+    if (g_server) g_server->stop();
+}
+
+int runServe(const CliOptions& options) {
+    if (options.socket.empty()) {
+        std::cerr << "serve needs --socket PATH" << std::endl;
+        return EXIT_USAGE;
+    }
+
+    Index index;
+    auto start = std::chrono::steady_clock::now();
+    if (!loadIndex(index, options)) return EXIT_FAILED;
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+    QueryServer server(index, options.socket, options.threads);
+    std::string error;
+    if (!server.start(&error)) {
+        std::cerr << "Cannot serve: " << error << std::endl;
+        return EXIT_FAILED;
+    }
+
+    g_server = &server;
+    std::signal(SIGINT, handleStopSignal);
+    std::signal(SIGTERM, handleStopSignal);
+    if (!options.quiet) {
+        std::cerr << "Loaded " << index.fileCount() << " files in " << elapsed.count() << " ms; listening on "
+                  << options.socket << std::endl;
+    }
+
+    server.run();
+    g_server = nullptr;
+    if (!options.quiet) {
+        std::cerr << "Stopped after " << server.requestsServed() << " requests" << std::endl;
+    }
+    return EXIT_OK;
+}
 
 std::string getRootPathFromUser() {
     std::string path;
@@ -37,37 +703,30 @@ std::string getRootPathFromUser() {
     std::getline(std::cin, path);
 
     if (path.empty()) {
-        return ".\\";
-    }
-
-  
-    std::replace(path.begin(), path.end(), '/', '\\');
-
-
-    if (path.back() != '\\' && path.find('.') == std::string::npos) {
-        path += '\\';
+        return ".";
     }
 
-    return path;
+    return fs::path(path).make_preferred().string();
 }
 
 bool shouldUseCache() {
     char choice;
     std::cout << "💾 Use cached index if available? (y/n): ";
     std::cin >> choice;
-    std::cin.ignore(); 
+    std::cin.ignore();
     return (choice == 'y' || choice == 'Y');
 }
 
-int main() {
+int runInteractive() {
     std::cout << "Starting File Search App (Now with Caching!)..." << std::endl;
 
     Index index;
-    const std::string cacheFile = "./index_cache.bin";
+    const std::string cacheFile = DEFAULT_CACHE;
 
     // Get user input for directory path
     std::string rootPath = getRootPathFromUser();
 
+#ifdef _WIN32
     if ((rootPath == "C:\\" || rootPath.find("C:\\\\") != std::string::npos) && !isAdmin()) {
         std::cout << "\n⚠️  WARNING: Scanning C:\\ requires Administrator privileges!" << std::endl;
         std::cout << "   Some system directories will be inaccessible." << std::endl;
@@ -82,6 +741,7 @@ int main() {
             return 0;
         }
     }
+#endif
 
     bool useCache = shouldUseCache();
 
@@ -89,7 +749,7 @@ int main() {
         std::cout << "Attempting to load index from cache..." << std::endl;
         if (index.loadFromFile(cacheFile)) {
             std::cout << "✅ Successfully loaded index from cache!" << std::endl;
-            std::cout << "📊 Total files in index: " << index.getAllFiles().size() << std::endl;
+            std::cout << "📊 Total files in index: " << index.fileCount() << std::endl;
         } else {
             std::cout << "❌ No cache found or cache invalid. Indexing files..." << std::endl;
             useCache = false;
@@ -119,10 +779,13 @@ int main() {
 
     std::string searchTerm;
     std::cout << "\n🔍 === Interactive Search Mode ===" << std::endl;
+    std::cout << "Syntax: words, OR, -exclude, ext:cpp, name:Index*, size:>1M, mtime:<7d" << std::endl;
 
     while (true) {
         std::cout << "\nEnter search term (or 'quit' to exit): ";
-        std::getline(std::cin, searchTerm);
+        if (!std::getline(std::cin, searchTerm)) {
+            break;
+        }
 
         if (searchTerm == "quit" || searchTerm == "exit") {
             break;
@@ -132,32 +795,23 @@ int main() {
             continue;
         }
 
-        std::cout << "\n📝 Files containing '" << searchTerm << "':" << std::endl;
-        auto results = index.searchByContent(searchTerm);
+        std::string error;
+        auto results = index.search(searchTerm, SortBy::RELEVANCE, 0, &error);
 
-        if (results.empty()) {
-            std::cout << "No files found containing '" << searchTerm << "'" << std::endl;
+        if (!error.empty()) {
+            std::cout << "❌ Invalid query: " << error << std::endl;
+        } else if (results.empty()) {
+            std::cout << "No files found matching '" << searchTerm << "'" << std::endl;
         } else {
+            std::cout << "\n📝 Files matching '" << searchTerm << "':" << std::endl;
+            bool color = stdoutIsTerminal();
             for (const auto& file : results) {
                 std::cout << "• " << file.filename << " | " << file.size << " bytes" << std::endl;
                 std::cout << "  Path: " << file.path << std::endl;
+                printSnippets(index.snippets(file, searchTerm, 2), color);
             }
             std::cout << "Found " << results.size() << " file(s)" << std::endl;
         }
-
-        if (searchTerm.size() <= 5 && searchTerm.find('.') != std::string::npos) {
-            std::cout << "\n📁 Files with extension '" << searchTerm << "':" << std::endl;
-            auto extResults = index.searchByExtension(searchTerm);
-
-            if (extResults.empty()) {
-                std::cout << "No files found with extension '" << searchTerm << "'" << std::endl;
-            } else {
-                for (const auto& file : extResults) {
-                    std::cout << "• " << file.filename << " | " << file.size << " bytes" << std::endl;
-                }
-                std::cout << "Found " << extResults.size() << " file(s)" << std::endl;
-            }
-        }
     }
 
     std::cout << "\n💡 Tips for next time:" << std::endl;
@@ -168,3 +822,34 @@ int main() {
     return 0;
 }
 
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        return runInteractive();
+    }
+
+    std::string command = argv[1];
+    if (command == "help" || command == "--help" || command == "-h") {
+        printUsage(std::cout);
+        return EXIT_OK;
+    }
+
+    CliOptions options;
+    if (!parseArguments(argc, argv, options)) {
+        printUsage(std::cerr);
+        return EXIT_USAGE;
+    }
+
+    if (command == "index") return runIndex(options, nullptr);
+    if (command == "update") return runUpdate(options);
+    if (command == "query") return runQuery(options);
+    if (command == "complete") return runComplete(options);
+    if (command == "stats") return runStats(options);
+    if (command == "duplicates") return runDuplicates(options);
+    if (command == "serve") return runServe(options);
+
+    std::cerr << "Unknown command: " << command << std::endl;
+    printUsage(std::cerr);
+    return EXIT_USAGE;
+}
@@ -0,0 +1,242 @@
+// Metrics.cpp
+#include "metrics.h"
+#include <algorithm>
+#include <sstream>
+
+namespace {
+
+size_t bucketFor(uint64_t value) {
+    size_t bucket = 0;
+    while (bucket + 1 < HistogramSnapshot::BUCKETS && (value >> bucket) != 0) {
+        bucket++;
+    }
+    return bucket;
+}
+
+// Single-writer increment: no lock prefix needed, and still no data race
+inline void bump(std::atomic<uint64_t>& cell, uint64_t amount) {
+    cell.store(cell.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+void histogramJson(std::ostringstream& out, const HistogramSnapshot& histogram, const char* unit) {
+    out << "{\"count\":" << histogram.count << ",\"sum_" << unit << "\":" << histogram.sum << ",\"max_" << unit
+        << "\":" << histogram.max << ",\"p50_" << unit << "\":" << histogram.percentile(0.50) << ",\"p99_" << unit
+        << "\":" << histogram.percentile(0.99) << "}";
+}
+
+void histogramPrometheus(std::ostringstream& out, const std::string& name, const std::string& labels,
+                         const HistogramSnapshot& histogram, double scale) {
+    std::string prefix = labels.empty() ? "{" : "{" + labels + ",";
+    size_t last = 0;
+    for (size_t i = 0; i < HistogramSnapshot::BUCKETS; ++i) {
+        if (histogram.buckets[i]) last = i;
+    }
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i <= last && histogram.count > 0; ++i) {
+        cumulative += histogram.buckets[i];
+        out << name << "_bucket" << prefix << "le=\"" << static_cast<double>(1ULL << i) * scale << "\"} "
+            << cumulative << "\n";
+    }
+    out << name << "_bucket" << prefix << "le=\"+Inf\"} " << histogram.count << "\n";
+    out << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " "
+        << static_cast<double>(histogram.sum) * scale << "\n";
+    out << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << histogram.count << "\n";
+}
+
+} // namespace
+
+const char* stageName(Stage stage) {
+    switch (stage) {
+    case Stage::WALK:      return "walk";
+    case Stage::STAT:      return "stat";
+    case Stage::READ:      return "read";
+    case Stage::TOKENIZE:  return "tokenize";
+    case Stage::INSERT:    return "insert";
+    case Stage::LOCK_WAIT: return "lock_wait";
+    case Stage::HASH:      return "hash";
+    case Stage::ORDER:     return "order";
+    default:               return "unknown";
+    }
+}
+
+const char* skipReasonName(SkipReason reason) {
+    switch (reason) {
+    case SkipReason::STAT_FAILED:            return "stat_failed";
+    case SkipReason::READ_FAILED:            return "read_failed";
+    case SkipReason::NOT_TEXT:               return "not_text";
+    case SkipReason::TOO_LARGE:              return "too_large";
+    case SkipReason::EMPTY:                  return "empty";
+    case SkipReason::DIRECTORY_INACCESSIBLE: return "directory_inaccessible";
+    case SkipReason::FILTERED:               return "filtered";
+    case SkipReason::ERROR:                  return "error";
+    default:                                 return "unknown";
+    }
+}
+
+const char* counterName(Counter counter) {
+    switch (counter) {
+    case Counter::DIRECTORIES_WALKED:   return "directories_walked";
+    case Counter::DIRECTORIES_PRUNED:   return "directories_pruned";
+    case Counter::FILES_DISCOVERED:     return "files_discovered";
+    case Counter::FILES_IGNORED:        return "files_ignored";
+    case Counter::FILES_INDEXED:        return "files_indexed";
+    case Counter::FILES_REUSED:         return "files_reused";
+    case Counter::FILES_HASHED:         return "files_hashed";
+    case Counter::BYTES_READ:           return "bytes_read";
+    case Counter::POSTING_RUNS_SPILLED: return "posting_runs_spilled";
+    case Counter::FILES_PREFETCHED:     return "files_prefetched";
+    default:                            return "unknown";
+    }
+}
+
+void HistogramSnapshot::merge(const HistogramSnapshot& other) {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+double HistogramSnapshot::percentile(double p) const {
+    if (count == 0) return 0;
+    uint64_t target = static_cast<uint64_t>(p * static_cast<double>(count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen > target) {
+            return std::min(static_cast<double>(1ULL << i), static_cast<double>(max));
+        }
+    }
+    return static_cast<double>(max);
+}
+
+void IndexingMetrics::Collector::Histogram::add(uint64_t value) {
+    bump(buckets[bucketFor(value)], 1);
+    bump(count, 1);
+    bump(sum, value);
+    if (value > max.load(std::memory_order_relaxed)) {
+        max.store(value, std::memory_order_relaxed);
+    }
+}
+
+void IndexingMetrics::Collector::Histogram::snapshotInto(HistogramSnapshot& out) const {
+    HistogramSnapshot mine;
+    for (size_t i = 0; i < HistogramSnapshot::BUCKETS; ++i) {
+        mine.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+    }
+    mine.count = count.load(std::memory_order_relaxed);
+    mine.sum = sum.load(std::memory_order_relaxed);
+    mine.max = max.load(std::memory_order_relaxed);
+    out.merge(mine);
+}
+
+void IndexingMetrics::Collector::record(Stage stage, uint64_t nanos) {
+    m_stages[static_cast<size_t>(stage)].add(nanos);
+}
+
+void IndexingMetrics::Collector::recordRead(uint64_t bytes, uint64_t nanos) {
+    m_stages[static_cast<size_t>(Stage::READ)].add(nanos);
+    m_readBytes.add(bytes);
+    bump(m_counters[static_cast<size_t>(Counter::BYTES_READ)], bytes);
+}
+
+void IndexingMetrics::Collector::recordQueueDepth(uint64_t depth) {
+    m_queueDepth.add(depth);
+}
+
+void IndexingMetrics::Collector::skip(SkipReason reason) {
+    bump(m_skipped[static_cast<size_t>(reason)], 1);
+}
+
+void IndexingMetrics::Collector::count(Counter counter, uint64_t amount) {
+    bump(m_counters[static_cast<size_t>(counter)], amount);
+}
+
+void IndexingMetrics::Collector::snapshotInto(MetricsSnapshot& out) const {
+    for (size_t i = 0; i < m_stages.size(); ++i) {
+        m_stages[i].snapshotInto(out.stages[i]);
+    }
+    m_readBytes.snapshotInto(out.readBytes);
+    m_queueDepth.snapshotInto(out.queueDepth);
+    for (size_t i = 0; i < m_skipped.size(); ++i) {
+        out.skipped[i] += m_skipped[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < m_counters.size(); ++i) {
+        out.counters[i] += m_counters[i].load(std::memory_order_relaxed);
+    }
+}
+
+IndexingMetrics::Collector& IndexingMetrics::newCollector() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_collectors.push_back(std::make_unique<Collector>());
+    return *m_collectors.back();
+}
+
+void IndexingMetrics::reset() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_collectors.clear();
+}
+
+MetricsSnapshot IndexingMetrics::snapshot() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    MetricsSnapshot snapshot;
+    for (const auto& collector : m_collectors) {
+        collector->snapshotInto(snapshot);
+    }
+    return snapshot;
+}
+
+std::string IndexingMetrics::toJson() const {
+    MetricsSnapshot s = snapshot();
+    std::ostringstream out;
+
+    out << "{\"counters\":{";
+    for (size_t i = 0; i < s.counters.size(); ++i) {
+        out << (i ? "," : "") << "\"" << counterName(static_cast<Counter>(i)) << "\":" << s.counters[i];
+    }
+    out << "},\"skipped\":{";
+    for (size_t i = 0; i < s.skipped.size(); ++i) {
+        out << (i ? "," : "") << "\"" << skipReasonName(static_cast<SkipReason>(i)) << "\":" << s.skipped[i];
+    }
+    out << "},\"stages\":{";
+    for (size_t i = 0; i < s.stages.size(); ++i) {
+        out << (i ? "," : "") << "\"" << stageName(static_cast<Stage>(i)) << "\":";
+        histogramJson(out, s.stages[i], "ns");
+    }
+    out << "},\"read_bytes\":";
+    histogramJson(out, s.readBytes, "bytes");
+    out << ",\"queue_depth\":";
+    histogramJson(out, s.queueDepth, "files");
+    out << "}";
+    return out.str();
+}
+
+std::string IndexingMetrics::toPrometheus() const {
+    MetricsSnapshot s = snapshot();
+    std::ostringstream out;
+
+    for (size_t i = 0; i < s.counters.size(); ++i) {
+        std::string name = std::string("filesearch_indexer_") + counterName(static_cast<Counter>(i)) + "_total";
+        out << "# TYPE " << name << " counter\n" << name << " " << s.counters[i] << "\n";
+    }
+
+    out << "# TYPE filesearch_indexer_skipped_total counter\n";
+    for (size_t i = 0; i < s.skipped.size(); ++i) {
+        out << "filesearch_indexer_skipped_total{reason=\"" << skipReasonName(static_cast<SkipReason>(i))
+            << "\"} " << s.skipped[i] << "\n";
+    }
+
+    out << "# TYPE filesearch_indexer_stage_seconds histogram\n";
+    for (size_t i = 0; i < s.stages.size(); ++i) {
+        histogramPrometheus(out, "filesearch_indexer_stage_seconds",
+                            std::string("stage=\"") + stageName(static_cast<Stage>(i)) + "\"", s.stages[i], 1e-9);
+    }
+
+    out << "# TYPE filesearch_indexer_read_bytes histogram\n";
+    histogramPrometheus(out, "filesearch_indexer_read_bytes", "", s.readBytes, 1.0);
+    out << "# TYPE filesearch_indexer_queue_depth histogram\n";
+    histogramPrometheus(out, "filesearch_indexer_queue_depth", "", s.queueDepth, 1.0);
+    return out.str();
+}
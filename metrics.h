@@ -0,0 +1,143 @@
+// Metrics.h
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Timed stages of the indexing pipeline
+enum class Stage {
+    WALK,
+    STAT,
+    READ,
+    TOKENIZE,
+    INSERT,
+    LOCK_WAIT,
+    HASH,
+    ORDER,
+    COUNT
+};
+
+// Why a file (or a file's content) was left out of the index
+enum class SkipReason {
+    STAT_FAILED,
+    READ_FAILED,
+    NOT_TEXT,
+    TOO_LARGE,
+    EMPTY,
+    DIRECTORY_INACCESSIBLE,
+    FILTERED,
+    ERROR,
+    COUNT
+};
+
+enum class Counter {
+    DIRECTORIES_WALKED,
+    DIRECTORIES_PRUNED,
+    FILES_DISCOVERED,
+    FILES_IGNORED,
+    FILES_INDEXED,
+    FILES_REUSED,
+    FILES_HASHED,
+    BYTES_READ,
+    POSTING_RUNS_SPILLED,
+    FILES_PREFETCHED,
+    COUNT
+};
+
+// Log2-bucketed histogram of nanosecond durations (or any other non-negative value)
+struct HistogramSnapshot {
+    static const size_t BUCKETS = 48;
+
+    std::array<uint64_t, BUCKETS> buckets{}; // bucket i counts values < 2^i
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    void merge(const HistogramSnapshot& other);
+    double percentile(double p) const; // upper bound of the bucket holding the p-quantile
+};
+
+struct MetricsSnapshot {
+    std::array<HistogramSnapshot, static_cast<size_t>(Stage::COUNT)> stages;
+    HistogramSnapshot readBytes;
+    HistogramSnapshot queueDepth;
+    std::array<uint64_t, static_cast<size_t>(SkipReason::COUNT)> skipped{};
+    std::array<uint64_t, static_cast<size_t>(Counter::COUNT)> counters{};
+};
+
+class IndexingMetrics {
+public:
+    // Owned by exactly one thread. Updates are plain relaxed stores, so the hot
+    // path takes no lock and no atomic read-modify-write; readers may see a
+    // slightly stale but never torn value.
+    class Collector {
+    public:
+        void record(Stage stage, uint64_t nanos);
+        void recordRead(uint64_t bytes, uint64_t nanos);
+        void recordQueueDepth(uint64_t depth);
+        void skip(SkipReason reason);
+        void count(Counter counter, uint64_t amount = 1);
+
+        void snapshotInto(MetricsSnapshot& out) const;
+
+    private:
+        struct Histogram {
+            std::array<std::atomic<uint64_t>, HistogramSnapshot::BUCKETS> buckets{};
+            std::atomic<uint64_t> count{0};
+            std::atomic<uint64_t> sum{0};
+            std::atomic<uint64_t> max{0};
+
+            void add(uint64_t value);
+            void snapshotInto(HistogramSnapshot& out) const;
+        };
+
+        std::array<Histogram, static_cast<size_t>(Stage::COUNT)> m_stages;
+        Histogram m_readBytes;
+        Histogram m_queueDepth;
+        std::array<std::atomic<uint64_t>, static_cast<size_t>(SkipReason::COUNT)> m_skipped{};
+        std::array<std::atomic<uint64_t>, static_cast<size_t>(Counter::COUNT)> m_counters{};
+    };
+
+    // Hands out a new collector for the calling thread; it lives as long as this object
+    Collector& newCollector();
+    void reset();
+
+    MetricsSnapshot snapshot() const;
+    std::string toJson() const;
+    std::string toPrometheus() const;
+
+private:
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<Collector>> m_collectors;
+};
+
+// Adds the elapsed time to a stage when it goes out of scope
+class StageTimer {
+public:
+    StageTimer(IndexingMetrics::Collector& collector, Stage stage)
+        : m_collector(collector), m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() { m_collector.record(m_stage, elapsedNanos()); }
+
+    uint64_t elapsedNanos() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now() - m_start).count());
+    }
+
+private:
+    IndexingMetrics::Collector& m_collector;
+    Stage m_stage;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+const char* stageName(Stage stage);
+const char* skipReasonName(SkipReason reason);
+const char* counterName(Counter counter);
+
+#endif
@@ -0,0 +1,989 @@
+// Query.cpp
+#include "query.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <sstream>
+#include "index.h"
+#include "utils.h"
+
+namespace {
+
+const uint64_t kMaxValue = std::numeric_limits<uint64_t>::max();
+
+// ---------------------------------------------------------------------------
+// Lexer / parser
+// ---------------------------------------------------------------------------
+
+struct Token {
+    enum class Kind { WORD, PHRASE, LPAREN, RPAREN, MINUS, END };
+    Kind kind;
+    std::string text;
+};
+
+std::vector<Token> tokenize(const std::string& text) {
+    std::vector<Token> tokens;
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char c = text[i];
+        if (std::isspace(c)) {
+            i++;
+        } else if (c == '(') {
+            tokens.push_back({Token::Kind::LPAREN, "("});
+            i++;
+        } else if (c == ')') {
+            tokens.push_back({Token::Kind::RPAREN, ")"});
+            i++;
+        } else if (c == '"') {
+            size_t close = text.find('"', i + 1);
+            if (close == std::string::npos) close = text.size();
+            tokens.push_back({Token::Kind::PHRASE, text.substr(i + 1, close - i - 1)});
+            i = close + 1;
+        } else if (c == '-' && i + 1 < text.size() && !std::isspace(static_cast<unsigned char>(text[i + 1]))) {
+            tokens.push_back({Token::Kind::MINUS, "-"});
+            i++;
+        } else {
+            std::string word;
+            while (i < text.size() && !std::isspace(static_cast<unsigned char>(text[i])) &&
+                   text[i] != '(' && text[i] != ')') {
+                if (text[i] == '"') {
+                    // field:"quoted value" stays one word; a quote anywhere else starts a phrase
+                    if (word.empty() || word.back() != ':') break;
+                    size_t close = text.find('"', i + 1);
+                    if (close == std::string::npos) close = text.size();
+                    word += text.substr(i + 1, close - i - 1);
+                    i = close + 1;
+                    continue;
+                }
+                word += text[i++];
+            }
+            tokens.push_back({Token::Kind::WORD, word});
+        }
+    }
+    tokens.push_back({Token::Kind::END, ""});
+    return tokens;
+}
+
+std::unique_ptr<QueryNode> makeNode(QueryNode::Type type, const std::string& text = "") {
+    auto node = std::make_unique<QueryNode>();
+    node->type = type;
+    node->text = text;
+    return node;
+}
+
+// "1.5M" -> bytes, "7d" -> seconds, depending on the unit table
+bool parseAmount(const std::string& text, uint64_t (*unit)(char), uint64_t& out) {
+    size_t pos = 0;
+    while (pos < text.size() && (std::isdigit(static_cast<unsigned char>(text[pos])) || text[pos] == '.')) {
+        pos++;
+    }
+    if (pos == 0) return false;
+
+    double number;
+    try {
+        number = std::stod(text.substr(0, pos));
+    } catch (...) {
+        return false;
+    }
+
+    std::string suffix = text.substr(pos);
+    uint64_t multiplier = 1;
+    if (!suffix.empty()) {
+        multiplier = unit(static_cast<char>(std::tolower(static_cast<unsigned char>(suffix[0]))));
+        if (multiplier == 0) return false;
+        std::string rest = suffix.substr(1);
+        std::transform(rest.begin(), rest.end(), rest.begin(), ::tolower);
+        if (!rest.empty() && rest != "b" && rest != "ib") return false;
+    }
+
+    double value = number * static_cast<double>(multiplier);
+    if (value >= static_cast<double>(kMaxValue)) return false;
+    out = static_cast<uint64_t>(value);
+    return true;
+}
+
+uint64_t sizeUnit(char c) {
+    switch (c) {
+    case 'b': return 1;
+    case 'k': return 1ULL << 10;
+    case 'm': return 1ULL << 20;
+    case 'g': return 1ULL << 30;
+    case 't': return 1ULL << 40;
+    default:  return 0;
+    }
+}
+
+uint64_t ageUnit(char c) {
+    switch (c) {
+    case 's': return 1;
+    case 'm': return 60;
+    case 'h': return 3600;
+    case 'd': return 86400;
+    case 'w': return 7 * 86400;
+    case 'y': return 365 * 86400;
+    default:  return 0;
+    }
+}
+
+// Turns ">1M", "<=7d", "10K..2M" or "42" into an inclusive [low, high] range
+bool parseRange(const std::string& value, uint64_t (*unit)(char), uint64_t& low, uint64_t& high) {
+    low = 0;
+    high = kMaxValue;
+
+    size_t dots = value.find("..");
+    if (dots != std::string::npos) {
+        std::string from = value.substr(0, dots);
+        std::string to = value.substr(dots + 2);
+        if (from.empty() && to.empty()) return false;
+        if (!from.empty() && !parseAmount(from, unit, low)) return false;
+        if (!to.empty() && !parseAmount(to, unit, high)) return false;
+        return low <= high;
+    }
+
+    std::string op;
+    size_t pos = 0;
+    while (pos < value.size() && (value[pos] == '<' || value[pos] == '>' || value[pos] == '=')) {
+        op += value[pos++];
+    }
+
+    uint64_t amount;
+    if (!parseAmount(value.substr(pos), unit, amount)) return false;
+
+    if (op == ">") {
+        if (amount == kMaxValue) return false;
+        low = amount + 1;
+    } else if (op == ">=") {
+        low = amount;
+    } else if (op == "<") {
+        if (amount == 0) return false;
+        high = amount - 1;
+    } else if (op == "<=") {
+        high = amount;
+    } else if (op.empty() || op == "=") {
+        low = high = amount;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+class Parser {
+public:
+    explicit Parser(const std::string& text) : m_tokens(tokenize(text)) {}
+
+    std::unique_ptr<QueryNode> parse(std::string& error) {
+        auto node = parseOr();
+        if (node && peek().kind != Token::Kind::END) {
+            m_error = "unexpected '" + peek().text + "'";
+            node.reset();
+        }
+        error = m_error;
+        return node;
+    }
+
+private:
+    std::vector<Token> m_tokens;
+    size_t m_pos = 0;
+    std::string m_error;
+
+    const Token& peek() const { return m_tokens[m_pos]; }
+    bool peekWord(const char* word) const {
+        return peek().kind == Token::Kind::WORD && peek().text == word;
+    }
+
+    std::unique_ptr<QueryNode> parseOr() {
+        auto first = parseAnd();
+        if (!first) return nullptr;
+        if (!peekWord("OR")) return first;
+
+        auto node = makeNode(QueryNode::Type::OR);
+        node->children.push_back(std::move(first));
+        while (peekWord("OR")) {
+            m_pos++;
+            auto next = parseAnd();
+            if (!next) return nullptr;
+            node->children.push_back(std::move(next));
+        }
+        return node;
+    }
+
+    std::unique_ptr<QueryNode> parseAnd() {
+        auto node = makeNode(QueryNode::Type::AND);
+        while (peek().kind != Token::Kind::END && peek().kind != Token::Kind::RPAREN && !peekWord("OR")) {
+            if (peekWord("AND")) {
+                m_pos++;
+                continue;
+            }
+            auto child = parseUnary();
+            if (!child) return nullptr;
+            node->children.push_back(std::move(child));
+        }
+
+        if (node->children.empty()) {
+            m_error = "expected a search term";
+            return nullptr;
+        }
+        if (node->children.size() == 1) {
+            return std::move(node->children[0]);
+        }
+        return node;
+    }
+
+    std::unique_ptr<QueryNode> parseUnary() {
+        if (peek().kind == Token::Kind::MINUS || peekWord("NOT")) {
+            m_pos++;
+            auto child = parseUnary();
+            if (!child) return nullptr;
+            auto node = makeNode(QueryNode::Type::NOT);
+            node->children.push_back(std::move(child));
+            return node;
+        }
+        return parsePrimary();
+    }
+
+    std::unique_ptr<QueryNode> parsePrimary() {
+        Token token = peek();
+        switch (token.kind) {
+        case Token::Kind::LPAREN: {
+            m_pos++;
+            auto node = parseOr();
+            if (!node) return nullptr;
+            if (peek().kind != Token::Kind::RPAREN) {
+                m_error = "missing ')'";
+                return nullptr;
+            }
+            m_pos++;
+            return node;
+        }
+        case Token::Kind::PHRASE: {
+            m_pos++;
+            auto node = makeNode(QueryNode::Type::AND);
+            std::stringstream ss(token.text);
+            std::string word;
+            while (ss >> word) {
+                node->children.push_back(makeNode(QueryNode::Type::TERM, word));
+            }
+            if (node->children.empty()) {
+                m_error = "empty phrase";
+                return nullptr;
+            }
+            return node;
+        }
+        case Token::Kind::WORD:
+            m_pos++;
+            return parseWord(token.text);
+        default:
+            m_error = token.kind == Token::Kind::END ? "unexpected end of query"
+                                                     : "unexpected '" + token.text + "'";
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<QueryNode> parseWord(const std::string& word) {
+        size_t colon = word.find(':');
+        if (colon == std::string::npos || colon == 0) {
+            return makeNode(QueryNode::Type::TERM, word);
+        }
+
+        std::string field = word.substr(0, colon);
+        std::transform(field.begin(), field.end(), field.begin(), ::tolower);
+        std::string value = word.substr(colon + 1);
+
+        QueryNode::Type type;
+        if (field == "ext") {
+            type = QueryNode::Type::EXT;
+        } else if (field == "name") {
+            type = QueryNode::Type::NAME;
+        } else if (field == "size") {
+            type = QueryNode::Type::SIZE;
+        } else if (field == "mtime") {
+            type = QueryNode::Type::MTIME;
+        } else if (field == "in") {
+            type = QueryNode::Type::IN;
+        } else {
+            // Not a field we know, so it's just a word that happens to contain a colon
+            return makeNode(QueryNode::Type::TERM, word);
+        }
+
+        if (value.empty()) {
+            m_error = "missing value for '" + field + ":'";
+            return nullptr;
+        }
+
+        auto node = makeNode(type, value);
+        if (type == QueryNode::Type::SIZE && !parseRange(value, sizeUnit, node->low, node->high)) {
+            m_error = "invalid size filter '" + value + "' (try size:>1M or size:10K..2M)";
+            return nullptr;
+        }
+        if (type == QueryNode::Type::MTIME && !parseRange(value, ageUnit, node->low, node->high)) {
+            m_error = "invalid mtime filter '" + value + "' (try mtime:<7d or mtime:>12h)";
+            return nullptr;
+        }
+        return node;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Iterators
+// ---------------------------------------------------------------------------
+
+class EmptyIterator : public DocIterator {
+public:
+    void next() override {}
+    void advance(size_t) override {}
+    size_t estimate() const override { return 0; }
+    std::string describe() const override { return "empty"; }
+};
+
+class AllDocsIterator : public DocIterator {
+public:
+    explicit AllDocsIterator(size_t count) : m_count(count) { m_doc = count > 0 ? 0 : END; }
+
+    void next() override { advance(m_doc + 1); }
+    void advance(size_t target) override {
+        if (m_doc == END || target <= m_doc) return;
+        m_doc = target < m_count ? target : END;
+    }
+    size_t estimate() const override { return m_count; }
+    std::string describe() const override { return "all[" + std::to_string(m_count) + "]"; }
+
+private:
+    size_t m_count;
+};
+
+// Walks a sorted doc-ID list, either borrowed from the index or owned
+class PostingIterator : public DocIterator {
+public:
+    PostingIterator(const std::vector<size_t>& docs, std::string label)
+        : m_docs(&docs), m_label(std::move(label)) { seek(0); }
+    PostingIterator(std::vector<size_t>&& docs, std::string label)
+        : m_owned(std::move(docs)), m_docs(&m_owned), m_label(std::move(label)) { seek(0); }
+
+    void next() override {
+        if (m_doc != END) seek(m_pos + 1);
+    }
+
+    void advance(size_t target) override {
+        if (m_doc == END || target <= m_doc) return;
+
+        // Gallop forward, then binary search inside the last step
+        const std::vector<size_t>& docs = *m_docs;
+        size_t step = 1;
+        size_t low = m_pos;
+        size_t high = m_pos + step;
+        while (high < docs.size() && docs[high] < target) {
+            low = high;
+            step *= 2;
+            high = m_pos + step;
+        }
+        high = std::min(high, docs.size());
+        auto it = std::lower_bound(docs.begin() + low, docs.begin() + high, target);
+        seek(static_cast<size_t>(it - docs.begin()));
+    }
+
+    size_t estimate() const override { return m_docs->size(); }
+    std::string describe() const override {
+        return m_label + "[" + std::to_string(m_docs->size()) + "]";
+    }
+
+private:
+    std::vector<size_t> m_owned;
+    const std::vector<size_t>* m_docs;
+    std::string m_label;
+    size_t m_pos = 0;
+
+    void seek(size_t pos) {
+        m_pos = pos;
+        m_doc = pos < m_docs->size() ? (*m_docs)[pos] : END;
+    }
+};
+
+class AndIterator : public DocIterator {
+public:
+    AndIterator(std::vector<std::unique_ptr<DocIterator>> required,
+                std::vector<std::unique_ptr<DocIterator>> excluded,
+                std::vector<DocFilter> filters)
+        : m_required(std::move(required)), m_excluded(std::move(excluded)), m_filters(std::move(filters)) {
+        std::stable_sort(m_required.begin(), m_required.end(),
+                         [](const auto& a, const auto& b) { return a->estimate() < b->estimate(); });
+        std::stable_sort(m_filters.begin(), m_filters.end(),
+                         [](const DocFilter& a, const DocFilter& b) { return a.cost < b.cost; });
+        findMatch(0);
+    }
+
+    void next() override {
+        if (m_doc != END) findMatch(m_doc + 1);
+    }
+
+    void advance(size_t target) override {
+        if (m_doc == END || target <= m_doc) return;
+        findMatch(target);
+    }
+
+    size_t estimate() const override { return m_required.front()->estimate(); }
+
+    std::string describe() const override {
+        std::string out = "AND(";
+        for (size_t i = 0; i < m_required.size(); ++i) {
+            out += (i ? ", " : "") + m_required[i]->describe();
+        }
+        for (const auto& excluded : m_excluded) {
+            out += ", NOT " + excluded->describe();
+        }
+        for (const auto& filter : m_filters) {
+            out += ", filter " + filter.label;
+        }
+        return out + ")";
+    }
+
+private:
+    std::vector<std::unique_ptr<DocIterator>> m_required;
+    std::vector<std::unique_ptr<DocIterator>> m_excluded;
+    std::vector<DocFilter> m_filters;
+
+    void findMatch(size_t target) {
+        DocIterator& lead = *m_required.front();
+        lead.advance(target);
+
+        while (lead.doc() != END) {
+            size_t candidate = lead.doc();
+            size_t behind = candidate;
+
+            for (size_t i = 1; i < m_required.size(); ++i) {
+                m_required[i]->advance(candidate);
+                if (m_required[i]->doc() != candidate) {
+                    behind = m_required[i]->doc();
+                    break;
+                }
+            }
+            if (behind != candidate) {
+                if (behind == END) break;
+                lead.advance(behind);
+                continue;
+            }
+
+            if (accepts(candidate)) {
+                m_doc = candidate;
+                return;
+            }
+            lead.next();
+        }
+        m_doc = END;
+    }
+
+    bool accepts(size_t candidate) {
+        for (auto& excluded : m_excluded) {
+            excluded->advance(candidate);
+            if (excluded->doc() == candidate) return false;
+        }
+        for (const auto& filter : m_filters) {
+            if (!filter.matches(candidate)) return false;
+        }
+        return true;
+    }
+};
+
+class OrIterator : public DocIterator {
+public:
+    explicit OrIterator(std::vector<std::unique_ptr<DocIterator>> children) : m_children(std::move(children)) {
+        settle();
+    }
+
+    void next() override {
+        if (m_doc == END) return;
+        size_t current = m_doc;
+        for (auto& child : m_children) {
+            if (child->doc() == current) child->next();
+        }
+        settle();
+    }
+
+    void advance(size_t target) override {
+        if (m_doc == END || target <= m_doc) return;
+        for (auto& child : m_children) {
+            child->advance(target);
+        }
+        settle();
+    }
+
+    size_t estimate() const override {
+        size_t total = 0;
+        for (const auto& child : m_children) {
+            total += child->estimate();
+        }
+        return total;
+    }
+
+    std::string describe() const override {
+        std::string out = "OR(";
+        for (size_t i = 0; i < m_children.size(); ++i) {
+            out += (i ? ", " : "") + m_children[i]->describe();
+        }
+        return out + ")";
+    }
+
+private:
+    std::vector<std::unique_ptr<DocIterator>> m_children;
+
+    void settle() {
+        m_doc = END;
+        for (const auto& child : m_children) {
+            m_doc = std::min(m_doc, child->doc());
+        }
+    }
+};
+
+void describeInto(const QueryNode& node, std::string& out) {
+    switch (node.type) {
+    case QueryNode::Type::TERM:
+        out += node.text;
+        return;
+    case QueryNode::Type::EXT:
+        out += "ext:" + node.text;
+        return;
+    case QueryNode::Type::NAME:
+        out += "name:" + node.text;
+        return;
+    case QueryNode::Type::IN:
+        out += "in:" + node.text;
+        return;
+    case QueryNode::Type::SIZE:
+    case QueryNode::Type::MTIME:
+        out += node.type == QueryNode::Type::SIZE ? "size:" : "mtime:";
+        out += std::to_string(node.low) + ".." + std::to_string(node.high);
+        return;
+    case QueryNode::Type::NOT:
+        out += "-";
+        describeInto(*node.children[0], out);
+        return;
+    case QueryNode::Type::AND:
+    case QueryNode::Type::OR: {
+        // Both are commutative, so sort the children for a canonical form
+        std::vector<std::string> parts;
+        for (const auto& child : node.children) {
+            std::string part;
+            describeInto(*child, part);
+            parts.push_back(part);
+        }
+        std::sort(parts.begin(), parts.end());
+        out += "(";
+        for (size_t i = 0; i < parts.size(); ++i) {
+            if (i) out += node.type == QueryNode::Type::AND ? " " : " OR ";
+            out += parts[i];
+        }
+        out += ")";
+        return;
+    }
+    }
+}
+
+} // namespace
+
+bool parseQuery(const std::string& text, std::unique_ptr<QueryNode>& out, std::string& error) {
+    Parser parser(text);
+    out = parser.parse(error);
+    return out != nullptr;
+}
+
+std::string describeQuery(const QueryNode& node) {
+    std::string out;
+    describeInto(node, out);
+    return out;
+}
+
+bool queryUsesClock(const QueryNode& node) {
+    if (node.type == QueryNode::Type::MTIME) return true;
+    for (const auto& child : node.children) {
+        if (queryUsesClock(*child)) return true;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Planner
+// ---------------------------------------------------------------------------
+
+QueryPlanner::QueryPlanner(const Index& index) : m_index(index) {}
+
+bool QueryPlanner::normalize(QueryNode& node) const {
+    switch (node.type) {
+    case QueryNode::Type::TERM: {
+        std::vector<std::string> words = m_index.extractWords(node.text);
+        if (words.empty()) return false;
+        if (words.size() == 1) {
+            node.text = words[0];
+            return true;
+        }
+        node.type = QueryNode::Type::AND;
+        node.text.clear();
+        for (const auto& word : words) {
+            auto child = std::make_unique<QueryNode>();
+            child->type = QueryNode::Type::TERM;
+            child->text = word;
+            node.children.push_back(std::move(child));
+        }
+        return true;
+    }
+    case QueryNode::Type::EXT:
+        if (!node.text.empty() && node.text[0] == '.') {
+            node.text.erase(0, 1);
+        }
+        std::transform(node.text.begin(), node.text.end(), node.text.begin(), ::tolower);
+        return !node.text.empty();
+    case QueryNode::Type::NAME:
+    case QueryNode::Type::SIZE:
+    case QueryNode::Type::MTIME:
+    case QueryNode::Type::IN:
+        return true;
+    case QueryNode::Type::NOT:
+        // A term with no words constrains nothing, so every file matches it and
+        // excluding it leaves nothing; an empty AND stands in for "everything"
+        if (!normalize(*node.children[0])) {
+            node.children[0] = std::make_unique<QueryNode>();
+        }
+        return true;
+    case QueryNode::Type::AND:
+    case QueryNode::Type::OR: {
+        auto& children = node.children;
+        children.erase(std::remove_if(children.begin(), children.end(),
+                                      [this](const auto& child) { return !normalize(*child); }),
+                       children.end());
+        if (children.empty()) return false;
+        if (children.size() == 1) {
+            std::unique_ptr<QueryNode> only = std::move(children[0]);
+            node = std::move(*only);
+        }
+        return true;
+    }
+    }
+    return false;
+}
+
+void QueryPlanner::collectPositiveTerms(const QueryNode& node, std::vector<std::string>& terms) {
+    if (node.type == QueryNode::Type::TERM) {
+        terms.push_back(node.text);
+    } else if (node.type != QueryNode::Type::NOT) {
+        for (const auto& child : node.children) {
+            collectPositiveTerms(*child, terms);
+        }
+    }
+}
+
+DocFilter QueryPlanner::sizeFilter(const QueryNode& node) const {
+    const Index& index = m_index;
+    uint64_t low = node.low;
+    uint64_t high = node.high;
+
+    DocFilter filter;
+    filter.matches = [&index, low, high](size_t doc) {
+        uint64_t size = index.m_sizes[doc];
+        return size >= low && size <= high;
+    };
+    filter.cost = 1;
+    filter.label = "size:" + node.text;
+    filter.estimate = index.countSizeRange(low, high);
+    filter.candidates = [&index, low, high]() { return index.docsInSizeRange(low, high); };
+    return filter;
+}
+
+DocFilter QueryPlanner::mtimeFilter(const QueryNode& node) const {
+    using Clock = std::filesystem::file_time_type::clock;
+    using Duration = std::filesystem::file_time_type::duration;
+
+    // Convert the age range into a range of timestamps, saturating instead of overflowing
+    const int64_t now = Clock::now().time_since_epoch().count();
+    const int64_t ticksPerSecond = std::chrono::duration_cast<Duration>(std::chrono::seconds(1)).count();
+    auto ageToTicks = [&](uint64_t age) -> int64_t {
+        if (age > static_cast<uint64_t>(std::numeric_limits<int64_t>::max() / ticksPerSecond)) {
+            return std::numeric_limits<int64_t>::max();
+        }
+        return static_cast<int64_t>(age) * ticksPerSecond;
+    };
+    auto subtract = [](int64_t time, int64_t ticks) {
+        return time < std::numeric_limits<int64_t>::min() + ticks ? std::numeric_limits<int64_t>::min()
+                                                                  : time - ticks;
+    };
+    const int64_t oldest = node.high == kMaxValue ? std::numeric_limits<int64_t>::min()
+                                                  : subtract(now, ageToTicks(node.high));
+    const int64_t newest = node.low == 0 ? std::numeric_limits<int64_t>::max()
+                                         : subtract(now, ageToTicks(node.low));
+
+    const Index& index = m_index;
+    DocFilter filter;
+    filter.matches = [&index, oldest, newest](size_t doc) {
+        int64_t modified = index.m_mtimes[doc];
+        return modified >= oldest && modified <= newest;
+    };
+    filter.cost = 1;
+    filter.label = "mtime:" + node.text;
+    filter.estimate = index.countMtimeRange(oldest, newest);
+    filter.candidates = [&index, oldest, newest]() { return index.docsInMtimeRange(oldest, newest); };
+    return filter;
+}
+
+QueryPlanner::Compiled QueryPlanner::compileDirectory(const QueryNode& node) const {
+    Compiled compiled;
+    uint32_t first;
+    uint32_t last;
+    if (!m_index.directoryRange(node.text, first, last)) {
+        compiled.iterator = std::make_unique<EmptyIterator>();
+        return compiled;
+    }
+
+    const Index& index = m_index;
+    DocFilter filter;
+    filter.matches = [&index, first, last](size_t doc) {
+        uint32_t pre = index.m_doc_dir_pre[doc];
+        return pre >= first && pre <= last;
+    };
+    filter.cost = 1;
+    filter.label = "in:" + node.text;
+    filter.estimate = index.countDirectoryRange(first, last);
+    filter.candidates = [&index, first, last]() { return index.docsInDirectoryRange(first, last); };
+    compiled.filters.push_back(std::move(filter));
+    return compiled;
+}
+
+void QueryPlanner::promoteIndexedFilter(std::vector<std::unique_ptr<DocIterator>>& required,
+                                        std::vector<DocFilter>& filters) const {
+    // Worth it only if the range is smaller than whatever would otherwise drive the AND
+    size_t driver = m_index.fileCount() + 1;
+    for (const auto& iterator : required) {
+        driver = std::min(driver, iterator->estimate());
+    }
+
+    size_t best = filters.size();
+    for (size_t i = 0; i < filters.size(); ++i) {
+        if (filters[i].candidates && filters[i].estimate < driver) {
+            driver = filters[i].estimate;
+            best = i;
+        }
+    }
+    if (best == filters.size()) return;
+
+    required.push_back(std::make_unique<PostingIterator>(filters[best].candidates(), filters[best].label));
+    filters.erase(filters.begin() + best);
+}
+
+QueryPlanner::Compiled QueryPlanner::compileName(const QueryNode& node) const {
+    const std::string& pattern = node.text;
+    size_t wildcard = pattern.find_first_of("*?");
+
+    Compiled compiled;
+    if (wildcard == std::string::npos) {
+        auto it = m_index.m_filename_map.find(pattern);
+        if (it == m_index.m_filename_map.end()) {
+            compiled.iterator = std::make_unique<EmptyIterator>();
+        } else {
+            compiled.iterator = std::make_unique<PostingIterator>(it->second, "name:" + pattern);
+        }
+        return compiled;
+    }
+
+    // The literal prefix narrows candidates through the trie; the glob checks the rest
+    std::string prefix = pattern.substr(0, wildcard);
+    if (!prefix.empty()) {
+        std::vector<size_t> candidates = m_index.m_filename_trie.searchPrefix(prefix);
+        std::sort(candidates.begin(), candidates.end());
+        compiled.iterator = std::make_unique<PostingIterator>(std::move(candidates), "prefix:" + prefix);
+    }
+
+    bool prefixOnly = wildcard == pattern.size() - 1 && pattern.back() == '*';
+    if (!prefixOnly || prefix.empty()) {
+        const Index& index = m_index;
+        DocFilter filter;
+        filter.matches = [&index, pattern](size_t doc) {
+            return globMatch(pattern, index.m_records[doc].filename);
+        };
+        filter.cost = 4;
+        filter.label = "name:" + pattern;
+        compiled.filters.push_back(std::move(filter));
+    }
+    return compiled;
+}
+
+QueryPlanner::Compiled QueryPlanner::compileAnd(const std::vector<const QueryNode*>& children) const {
+    std::vector<std::unique_ptr<DocIterator>> required;
+    std::vector<std::unique_ptr<DocIterator>> excluded;
+    std::vector<DocFilter> filters;
+
+    for (const QueryNode* child : children) {
+        if (child->type == QueryNode::Type::NOT) {
+            Compiled negated = compileNode(*child->children[0]);
+            if (negated.unconstrained) {
+                // Excluding everything leaves nothing, whatever else is required
+                Compiled empty;
+                empty.iterator = std::make_unique<EmptyIterator>();
+                return empty;
+            }
+
+            if (!negated.iterator) {
+                // Excluding a pure filter is just the inverted filter
+                auto parts = std::make_shared<std::vector<DocFilter>>(std::move(negated.filters));
+                DocFilter inverted;
+                inverted.matches = [parts](size_t doc) {
+                    for (const auto& part : *parts) {
+                        if (!part.matches(doc)) return true;
+                    }
+                    return false;
+                };
+                inverted.cost = 0;
+                inverted.label = "NOT(";
+                for (const auto& part : *parts) {
+                    inverted.cost += part.cost;
+                    inverted.label += part.label + " ";
+                }
+                inverted.label.back() = ')';
+                filters.push_back(std::move(inverted));
+            } else {
+                excluded.push_back(toIterator(std::move(negated)));
+            }
+            continue;
+        }
+
+        Compiled compiled = compileNode(*child);
+        if (compiled.unconstrained) continue;
+        if (compiled.iterator) {
+            if (compiled.iterator->estimate() == 0) {
+                Compiled empty;
+                empty.iterator = std::make_unique<EmptyIterator>();
+                return empty;
+            }
+            required.push_back(std::move(compiled.iterator));
+        }
+        for (auto& filter : compiled.filters) {
+            filters.push_back(std::move(filter));
+        }
+    }
+
+    Compiled result;
+    if (required.empty() && excluded.empty()) {
+        result.filters = std::move(filters);
+        result.unconstrained = result.filters.empty();
+        return result;
+    }
+    promoteIndexedFilter(required, filters);
+    if (required.empty()) {
+        required.push_back(std::make_unique<AllDocsIterator>(m_index.fileCount()));
+    }
+    if (required.size() == 1 && excluded.empty() && filters.empty()) {
+        result.iterator = std::move(required[0]);
+        return result;
+    }
+    result.iterator = std::make_unique<AndIterator>(std::move(required), std::move(excluded), std::move(filters));
+    return result;
+}
+
+QueryPlanner::Compiled QueryPlanner::compileOr(const QueryNode& node) const {
+    std::vector<std::unique_ptr<DocIterator>> children;
+    for (const auto& child : node.children) {
+        Compiled compiled = compileNode(*child);
+        if (compiled.unconstrained) continue;
+        auto iterator = toIterator(std::move(compiled));
+        if (iterator->estimate() > 0) {
+            children.push_back(std::move(iterator));
+        }
+    }
+
+    Compiled result;
+    if (children.empty()) {
+        result.iterator = std::make_unique<EmptyIterator>();
+    } else if (children.size() == 1) {
+        result.iterator = std::move(children[0]);
+    } else {
+        result.iterator = std::make_unique<OrIterator>(std::move(children));
+    }
+    return result;
+}
+
+QueryPlanner::Compiled QueryPlanner::compileNode(const QueryNode& node) const {
+    Compiled compiled;
+    switch (node.type) {
+    case QueryNode::Type::TERM: {
+        auto it = m_index.m_inverted_index.find(node.text);
+        if (it == m_index.m_inverted_index.end()) {
+            compiled.iterator = std::make_unique<EmptyIterator>();
+        } else {
+            compiled.iterator = std::make_unique<PostingIterator>(it->second.docs, "term:" + node.text);
+        }
+        return compiled;
+    }
+    case QueryNode::Type::EXT: {
+        auto it = m_index.m_extension_map.find(node.text);
+        if (it == m_index.m_extension_map.end()) {
+            compiled.iterator = std::make_unique<EmptyIterator>();
+        } else {
+            compiled.iterator = std::make_unique<PostingIterator>(it->second, "ext:" + node.text);
+        }
+        return compiled;
+    }
+    case QueryNode::Type::NAME:
+        return compileName(node);
+    case QueryNode::Type::SIZE:
+        compiled.filters.push_back(sizeFilter(node));
+        return compiled;
+    case QueryNode::Type::MTIME:
+        compiled.filters.push_back(mtimeFilter(node));
+        return compiled;
+    case QueryNode::Type::IN:
+        return compileDirectory(node);
+    case QueryNode::Type::AND: {
+        std::vector<const QueryNode*> children;
+        for (const auto& child : node.children) {
+            children.push_back(child.get());
+        }
+        return compileAnd(children);
+    }
+    case QueryNode::Type::NOT:
+        // A lone NOT is an AND with nothing required
+        return compileAnd({&node});
+    case QueryNode::Type::OR:
+        return compileOr(node);
+    }
+    return compiled;
+}
+
+std::unique_ptr<DocIterator> QueryPlanner::toIterator(Compiled compiled) const {
+    if (compiled.unconstrained) {
+        return std::make_unique<AllDocsIterator>(m_index.fileCount());
+    }
+    if (compiled.filters.empty()) {
+        return std::move(compiled.iterator);
+    }
+
+    std::vector<std::unique_ptr<DocIterator>> required;
+    if (compiled.iterator) {
+        required.push_back(std::move(compiled.iterator));
+    }
+    promoteIndexedFilter(required, compiled.filters);
+    if (required.empty()) {
+        required.push_back(std::make_unique<AllDocsIterator>(m_index.fileCount()));
+    }
+    if (compiled.filters.empty() && required.size() == 1) {
+        return std::move(required[0]);
+    }
+    return std::make_unique<AndIterator>(std::move(required), std::vector<std::unique_ptr<DocIterator>>(),
+                                         std::move(compiled.filters));
+}
+
+std::unique_ptr<DocIterator> QueryPlanner::compile(const QueryNode& node) const {
+    Compiled compiled = compileNode(node);
+    if (compiled.unconstrained) {
+        return std::make_unique<EmptyIterator>();
+    }
+    return toIterator(std::move(compiled));
+}
+
+std::vector<size_t> QueryPlanner::execute(const QueryNode& node) const {
+    std::vector<size_t> ids;
+    auto iterator = compile(node);
+    ids.reserve(std::min(iterator->estimate(), m_index.fileCount()));
+    for (; iterator->doc() != DocIterator::END; iterator->next()) {
+        ids.push_back(iterator->doc());
+    }
+    return ids;
+}
+
+std::string QueryPlanner::explain(const QueryNode& node) const {
+    return compile(node)->describe();
+}
@@ -0,0 +1,106 @@
+// Query.h
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Index;
+
+// Parsed form of the query language:
+//   foo bar          both words (implicit AND)
+//   foo OR bar       either word
+//   -baz / NOT baz   exclude; a term with no words (-*, or a stop word) matches
+//                    every file, so excluding it matches nothing
+//   ext:cpp          extension
+//   name:Index*      filename glob (* and ?), case-sensitive like searchByFilename
+//   size:>1M         size filter: > >= < <= =, or a range 10K..2M; K/M/G/T are powers of 1024
+//   mtime:<7d        age filter: s, m, h, d, w units; <7d means modified within the last 7 days
+//   in:src/core      only files somewhere under this directory (quote paths with spaces: in:"My Docs")
+//   ( ... )          grouping, "a b" groups words as well
+struct QueryNode {
+    enum class Type { TERM, AND, OR, NOT, EXT, NAME, SIZE, MTIME, IN };
+
+    Type type = Type::AND;
+    std::string text;                                   // TERM word, EXT extension, NAME pattern, IN directory
+    uint64_t low = 0;                                   // SIZE bytes, MTIME age in seconds
+    uint64_t high = std::numeric_limits<uint64_t>::max();
+    std::vector<std::unique_ptr<QueryNode>> children;
+};
+
+bool parseQuery(const std::string& text, std::unique_ptr<QueryNode>& out, std::string& error);
+std::string describeQuery(const QueryNode& node);
+bool queryUsesClock(const QueryNode& node);
+
+// Lazily evaluated, ascending stream of doc IDs
+class DocIterator {
+public:
+    static constexpr size_t END = std::numeric_limits<size_t>::max();
+
+    virtual ~DocIterator() = default;
+
+    size_t doc() const { return m_doc; }
+    virtual void next() = 0;
+    virtual void advance(size_t target) = 0; // first doc >= target
+    virtual size_t estimate() const = 0;     // upper bound on remaining matches
+    virtual std::string describe() const = 0;
+
+protected:
+    size_t m_doc = END;
+};
+
+// Per-document check applied after the iterators have agreed on a candidate.
+// Filters backed by a secondary index can also produce their matches directly,
+// which the planner uses when that is more selective than any posting list.
+struct DocFilter {
+    std::function<bool(size_t)> matches;
+    int cost;
+    std::string label;
+    size_t estimate = std::numeric_limits<size_t>::max();
+    std::function<std::vector<size_t>()> candidates;
+};
+
+// Compiles a parsed query against an index into a tree of iterators.
+// AND nodes drive from their most selective child, leapfrog the others and
+// only then run the remaining filters in order of cost.
+class QueryPlanner {
+public:
+    explicit QueryPlanner(const Index& index);
+
+    // Rewrites TERM/EXT text the way the index stores it and drops empty terms
+    // (under NOT they become an empty AND, which matches everything).
+    // Returns false when nothing constraining is left.
+    bool normalize(QueryNode& node) const;
+
+    std::unique_ptr<DocIterator> compile(const QueryNode& node) const;
+    std::vector<size_t> execute(const QueryNode& node) const;
+    std::string explain(const QueryNode& node) const;
+
+    static void collectPositiveTerms(const QueryNode& node, std::vector<std::string>& terms);
+
+private:
+    struct Compiled {
+        std::unique_ptr<DocIterator> iterator; // null when the node is filters only
+        std::vector<DocFilter> filters;
+        bool unconstrained = false;
+    };
+
+    const Index& m_index;
+
+    Compiled compileNode(const QueryNode& node) const;
+    Compiled compileAnd(const std::vector<const QueryNode*>& children) const;
+    Compiled compileOr(const QueryNode& node) const;
+    Compiled compileName(const QueryNode& node) const;
+    std::unique_ptr<DocIterator> toIterator(Compiled compiled) const;
+    void promoteIndexedFilter(std::vector<std::unique_ptr<DocIterator>>& required,
+                              std::vector<DocFilter>& filters) const;
+    DocFilter sizeFilter(const QueryNode& node) const;
+    DocFilter mtimeFilter(const QueryNode& node) const;
+    Compiled compileDirectory(const QueryNode& node) const;
+};
+
+#endif
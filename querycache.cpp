@@ -0,0 +1,87 @@
+// QueryCache.cpp
+#include "querycache.h"
+
+QueryCache::QueryCache(size_t capacity) : m_capacity(capacity) {}
+
+void QueryCache::resetForGeneration(uint64_t generation) {
+    m_entries.clear();
+    m_lookup.clear();
+    m_generation = generation;
+}
+
+void QueryCache::evictOverflow() {
+    while (m_entries.size() > m_capacity) {
+        m_lookup.erase(m_entries.back().key);
+        m_entries.pop_back();
+    }
+}
+
+bool QueryCache::lookup(const std::string& key, uint64_t generation, std::vector<size_t>& out) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (generation != m_generation) {
+        resetForGeneration(generation);
+    }
+
+    auto it = m_lookup.find(key);
+    if (it == m_lookup.end()) {
+        m_misses++;
+        return false;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    out = it->second->ids;
+    m_hits++;
+    return true;
+}
+
+void QueryCache::insert(const std::string& key, uint64_t generation, const std::vector<size_t>& ids) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_capacity == 0) return;
+
+    if (generation < m_generation) {
+        // Computed against an index that has since changed
+        return;
+    }
+    if (generation > m_generation) {
+        resetForGeneration(generation);
+    }
+
+    auto it = m_lookup.find(key);
+    if (it != m_lookup.end()) {
+        it->second->ids = ids;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return;
+    }
+
+    m_entries.push_front(Entry{key, ids});
+    m_lookup[key] = m_entries.begin();
+    evictOverflow();
+}
+
+void QueryCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_lookup.clear();
+}
+
+void QueryCache::setCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_capacity = capacity;
+    evictOverflow();
+}
+
+size_t QueryCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+uint64_t QueryCache::hits() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+uint64_t QueryCache::misses() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
@@ -0,0 +1,46 @@
+// QueryCache.h
+#ifndef QUERYCACHE_H
+#define QUERYCACHE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// LRU cache of query results, stored as doc-ID lists.
+// Every entry belongs to one index generation; a lookup or insert carrying a
+// newer generation drops everything cached for the old one.
+class QueryCache {
+public:
+    explicit QueryCache(size_t capacity = 256);
+
+    bool lookup(const std::string& key, uint64_t generation, std::vector<size_t>& out);
+    void insert(const std::string& key, uint64_t generation, const std::vector<size_t>& ids);
+    void clear();
+
+    void setCapacity(size_t capacity);
+    size_t size() const;
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::vector<size_t> ids;
+    };
+
+    size_t m_capacity;
+    uint64_t m_generation{0};
+    std::list<Entry> m_entries; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> m_lookup;
+    uint64_t m_hits{0};
+    uint64_t m_misses{0};
+    mutable std::mutex m_mutex;
+
+    void resetForGeneration(uint64_t generation);
+    void evictOverflow();
+};
+
+#endif
@@ -0,0 +1,523 @@
+// Server.cpp
+#include "server.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include "utils.h"
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const size_t MAX_REQUEST_LINE = 64 * 1024;
+const int POLL_INTERVAL_MS = 250;
+const size_t DEFAULT_COMPLETIONS = 10;
+
+std::string errorResponse(const std::string& message, uint64_t micros) {
+    return "{\"ok\":false,\"error\":\"" + jsonEscape(message) + "\",\"elapsed_us\":" + std::to_string(micros) + "}";
+}
+
+// Splits "VERB rest of line" at the first space
+void splitVerb(const std::string& line, std::string& verb, std::string& rest) {
+    size_t space = line.find(' ');
+    verb = line.substr(0, space);
+    rest = space == std::string::npos ? "" : line.substr(space + 1);
+}
+
+// Strips the leading key=value options off rest; the query language and
+// filename prefixes never start with a word holding '='. False, with the
+// offending option, on one that is malformed or that the request doesn't take.
+bool takeOptions(std::string& rest, SortBy& sort, size_t& limit, size_t* snippets, std::string& invalid) {
+    while (true) {
+        std::string option, remainder;
+        splitVerb(rest, option, remainder);
+        size_t equals = option.find('=');
+        if (equals == std::string::npos) return true;
+
+        std::string key = option.substr(0, equals), value = option.substr(equals + 1);
+        bool number = !value.empty() && value.size() < 10 && value.find_first_not_of("0123456789") == std::string::npos;
+        bool valid = false;
+        if (key == "sort") {
+            valid = parseSortBy(value, sort);
+        } else if (key == "limit" && number) {
+            limit = static_cast<size_t>(std::stoull(value));
+            valid = true;
+        } else if (key == "snippets" && snippets && number) {
+            *snippets = static_cast<size_t>(std::stoull(value));
+            valid = true;
+        }
+        if (!valid) {
+            invalid = option;
+            return false;
+        }
+        rest = remainder;
+    }
+}
+
+#ifndef _WIN32
+bool fillAddress(const std::string& path, sockaddr_un& address, std::string* error) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        if (error) *error = "socket path must be 1-" + std::to_string(sizeof(address.sun_path) - 1) + " bytes";
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+bool sendAll(int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+#endif
+
+} // namespace
+
+void writeFileJson(std::ostream& out, const FileMetadata& file, const std::vector<Snippet>* snippets) {
+    out << "{\"path\":\"" << jsonEscape(file.path.string()) << "\",\"size\":" << file.size
+        << ",\"mtime\":" << toUnixSeconds(file.last_modified);
+    if (snippets) {
+        out << ",\"snippets\":[";
+        for (size_t i = 0; i < snippets->size(); ++i) {
+            const Snippet& snippet = (*snippets)[i];
+            out << (i ? "," : "") << "{\"offset\":" << snippet.offset << ",\"text\":\"" << jsonEscape(snippet.text)
+                << "\",\"highlights\":[";
+            for (size_t h = 0; h < snippet.highlights.size(); ++h) {
+                out << (h ? "," : "") << "[" << snippet.highlights[h].first << "," << snippet.highlights[h].second << "]";
+            }
+            out << "]}";
+        }
+        out << "]";
+    }
+    out << "}";
+}
+
+QueryServer::QueryServer(const Index& index, const std::string& socketPath, size_t threads)
+    : m_index(index), m_socketPath(socketPath), m_threadCount(threads) {
+    if (m_threadCount == 0) {
+        m_threadCount = std::max(2u, std::thread::hardware_concurrency());
+    }
+}
+
+QueryServer::~QueryServer() {
+    stop();
+    m_queueCV.notify_all();
+    for (auto& thread : m_workerThreads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    closeSocket();
+}
+
+void QueryServer::recordLatency(uint64_t micros) {
+    m_requests.fetch_add(1, std::memory_order_relaxed);
+    m_totalMicros.fetch_add(micros, std::memory_order_relaxed);
+    uint64_t seen = m_maxMicros.load(std::memory_order_relaxed);
+    while (micros > seen && !m_maxMicros.compare_exchange_weak(seen, micros, std::memory_order_relaxed)) {
+    }
+}
+
+std::string QueryServer::handleRequest(const std::string& line, PrefixCursor* cursor) {
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start]() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                         std::chrono::steady_clock::now() - start).count());
+    };
+
+    std::string verb, rest;
+    splitVerb(line, verb, rest);
+    std::ostringstream out;
+
+    if (verb == "PING") {
+        uint64_t micros = elapsed();
+        recordLatency(micros);
+        out << "{\"ok\":true,\"elapsed_us\":" << micros << "}";
+    } else if (verb == "STATS") {
+        uint64_t requests = m_requests.load(std::memory_order_relaxed);
+        uint64_t uptime = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                                                    std::chrono::steady_clock::now() - m_started).count());
+        out << "{\"ok\":true,\"files\":" << m_index.fileCount() << ",\"directories\":" << m_index.directoryCount()
+            << ",\"terms\":" << m_index.termCount() << ",\"analyzer\":\""
+            << jsonEscape(describeAnalyzer(m_index.analyzerOptions())) << "\",\"uptime_s\":" << uptime << ",\"requests\":" << requests
+            << ",\"errors\":" << m_errors.load(std::memory_order_relaxed) << ",\"mean_us\":"
+            << (requests ? m_totalMicros.load(std::memory_order_relaxed) / requests : 0) << ",\"max_us\":"
+            << m_maxMicros.load(std::memory_order_relaxed) << ",\"cache_hits\":" << m_index.queryCacheHits()
+            << ",\"cache_misses\":" << m_index.queryCacheMisses();
+        uint64_t micros = elapsed();
+        recordLatency(micros);
+        out << ",\"elapsed_us\":" << micros << "}";
+    } else if (verb == "QUERY") {
+        SortBy sort = SortBy::RELEVANCE;
+        size_t limit = 0;
+        size_t snippets = 0;
+
+        std::string query = rest, invalid;
+        if (!takeOptions(query, sort, limit, &snippets, invalid)) {
+            uint64_t micros = elapsed();
+            recordLatency(micros);
+            m_errors.fetch_add(1, std::memory_order_relaxed);
+            return errorResponse("invalid option '" + invalid + "'", micros);
+        }
+
+        std::string error;
+        auto results = m_index.search(query, sort, limit, &error);
+        if (!error.empty()) {
+            uint64_t micros = elapsed();
+            recordLatency(micros);
+            m_errors.fetch_add(1, std::memory_order_relaxed);
+            return errorResponse(error, micros);
+        }
+        std::vector<std::vector<Snippet>> resultSnippets;
+        if (snippets > 0) {
+            resultSnippets.reserve(results.size());
+            for (const auto& file : results) {
+                resultSnippets.push_back(m_index.snippets(file, query, snippets));
+            }
+        }
+        uint64_t micros = elapsed();
+        recordLatency(micros);
+
+        out << "{\"ok\":true,\"count\":" << results.size() << ",\"elapsed_us\":" << micros << ",\"results\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (i) out << ",";
+            writeFileJson(out, results[i], snippets > 0 ? &resultSnippets[i] : nullptr);
+        }
+        out << "]}";
+    } else if (verb == "COMPLETE") {
+        SortBy sort = SortBy::DATE_DESC;
+        size_t limit = DEFAULT_COMPLETIONS;
+        std::string prefix = rest, invalid;
+        if (!takeOptions(prefix, sort, limit, nullptr, invalid)) {
+            uint64_t micros = elapsed();
+            recordLatency(micros);
+            m_errors.fetch_add(1, std::memory_order_relaxed);
+            return errorResponse("invalid option '" + invalid + "'", micros);
+        }
+
+        // Without a connection's cursor to move, start from the root
+        PrefixCursor fresh = m_index.prefixCursor();
+        if (!cursor) cursor = &fresh;
+        cursor->seek(prefix);
+        auto results = m_index.complete(*cursor, limit, sort);
+        uint64_t micros = elapsed();
+        recordLatency(micros);
+
+        out << "{\"ok\":true,\"count\":" << results.size() << ",\"elapsed_us\":" << micros << ",\"results\":[";
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (i) out << ",";
+            writeFileJson(out, results[i]);
+        }
+        out << "]}";
+    } else if (verb == "EXPLAIN") {
+        std::string plan = m_index.explain(rest);
+        uint64_t micros = elapsed();
+        recordLatency(micros);
+        out << "{\"ok\":true,\"plan\":\"" << jsonEscape(plan) << "\",\"elapsed_us\":" << micros << "}";
+    } else {
+        uint64_t micros = elapsed();
+        recordLatency(micros);
+        m_errors.fetch_add(1, std::memory_order_relaxed);
+        return errorResponse("unknown request '" + verb + "'", micros);
+    }
+    return out.str();
+}
+
+QueryServer::Connection::~Connection() {
+#ifndef _WIN32
+    ::close(fd);
+#endif
+}
+
+#ifdef _WIN32
+
+bool QueryServer::start(std::string* error) {
+    if (error) *error = "the query server needs Unix domain sockets, which this build does not support";
+    return false;
+}
+
+void QueryServer::run() {}
+void QueryServer::workerThread() {}
+void QueryServer::serveRequests(Connection&) {}
+void QueryServer::closeSocket() {}
+
+QueryClient::~QueryClient() {}
+
+bool QueryClient::connect(const std::string&, std::string* error) {
+    if (error) *error = "the query server needs Unix domain sockets, which this build does not support";
+    return false;
+}
+
+bool QueryClient::request(const std::string&, std::string&, std::string* error) {
+    if (error) *error = "not connected";
+    return false;
+}
+
+#else
+
+bool QueryServer::start(std::string* error) {
+    sockaddr_un address;
+    if (!fillAddress(m_socketPath, address, error)) return false;
+
+    // A socket file nobody answers on is left over from a crashed server
+    struct stat info;
+    if (::lstat(m_socketPath.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode)) {
+            if (error) *error = m_socketPath + " exists and is not a socket";
+            return false;
+        }
+        QueryClient probe;
+        if (probe.connect(m_socketPath, nullptr)) {
+            if (error) *error = "another server is already listening on " + m_socketPath;
+            return false;
+        }
+        ::unlink(m_socketPath.c_str());
+    }
+
+    m_listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listenFd < 0) {
+        if (error) *error = std::string("socket: ") + std::strerror(errno);
+        return false;
+    }
+
+    // Results include file paths, so only the owner may connect
+    mode_t previousMask = ::umask(0177);
+    int bound = ::bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    ::umask(previousMask);
+    if (bound < 0 || ::listen(m_listenFd, 64) < 0) {
+        if (error) *error = std::string(bound < 0 ? "bind: " : "listen: ") + std::strerror(errno);
+        closeSocket();
+        return false;
+    }
+
+    // Non-blocking, so a burst of wake-ups can neither block a worker nor the loop draining them
+    if (::pipe(m_wakeFds) < 0) {
+        if (error) *error = std::string("pipe: ") + std::strerror(errno);
+        m_wakeFds[0] = m_wakeFds[1] = -1;
+        closeSocket();
+        return false;
+    }
+    for (int fd : m_wakeFds) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    // A client that hangs up mid-response must not kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+    m_started = std::chrono::steady_clock::now();
+    return true;
+}
+
+void QueryServer::run() {
+    if (m_listenFd < 0) return;
+
+    for (size_t i = 0; i < m_threadCount; ++i) {
+        m_workerThreads.emplace_back(&QueryServer::workerThread, this);
+    }
+
+    // Connections between requests; a readable one is handed to the workers
+    std::vector<std::unique_ptr<Connection>> idle;
+    std::vector<pollfd> fds;
+    while (!m_stopRequested) {
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            for (auto& connection : m_returned) {
+                if (connection->open) idle.push_back(std::move(connection));
+            }
+            m_returned.clear();
+        }
+
+        fds.clear();
+        fds.push_back({m_listenFd, POLLIN, 0});
+        fds.push_back({m_wakeFds[0], POLLIN, 0});
+        for (const auto& connection : idle) {
+            fds.push_back({connection->fd, POLLIN, 0});
+        }
+        int ready = ::poll(fds.data(), fds.size(), POLL_INTERVAL_MS);
+        if (ready <= 0) continue;
+
+        if (fds[1].revents) {
+            char drain[64];
+            while (::read(m_wakeFds[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+
+        // Hang-ups and errors count as readable too; the worker's recv sees them
+        size_t handed = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            size_t kept = 0;
+            for (size_t i = 0; i < idle.size(); ++i) {
+                if (fds[i + 2].revents) {
+                    m_ready.push(std::move(idle[i]));
+                    handed++;
+                } else {
+                    idle[kept++] = std::move(idle[i]);
+                }
+            }
+            idle.resize(kept);
+        }
+        for (; handed > 0; --handed) {
+            m_queueCV.notify_one();
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int client = ::accept(m_listenFd, nullptr, nullptr);
+            if (client >= 0) {
+                ::fcntl(client, F_SETFD, FD_CLOEXEC);
+                idle.push_back(std::make_unique<Connection>(client, m_index));
+            }
+        }
+    }
+
+    m_queueCV.notify_all();
+    for (auto& thread : m_workerThreads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    m_workerThreads.clear();
+
+    // Closes every remaining connection
+    idle.clear();
+    m_returned.clear();
+    m_ready = std::queue<std::unique_ptr<Connection>>();
+    closeSocket();
+}
+
+void QueryServer::workerThread() {
+    while (!m_stopRequested) {
+        std::unique_lock<std::mutex> lock(m_queueMutex);
+
+        if (m_queueCV.wait_for(lock, std::chrono::milliseconds(100), [this]() {
+                return !m_ready.empty() || m_stopRequested;
+            })) {
+            if (m_stopRequested) break;
+
+            std::unique_ptr<Connection> connection = std::move(m_ready.front());
+            m_ready.pop();
+            lock.unlock();
+
+            serveRequests(*connection);
+
+            lock.lock();
+            m_returned.push_back(std::move(connection));
+            lock.unlock();
+            char wake = 0;
+            ssize_t written = ::write(m_wakeFds[1], &wake, 1);
+            (void)written; // a full pipe already means a pending wake-up
+        }
+    }
+}
+
+void QueryServer::serveRequests(Connection& connection) {
+    char chunk[4096];
+    ssize_t n;
+    do {
+        n = ::recv(connection.fd, chunk, sizeof(chunk), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        connection.open = false;
+        return;
+    }
+    std::string& buffer = connection.buffer;
+    buffer.append(chunk, static_cast<size_t>(n));
+
+    size_t begin = 0;
+    size_t newline;
+    while ((newline = buffer.find('\n', begin)) != std::string::npos) {
+        std::string line = buffer.substr(begin, newline - begin);
+        begin = newline + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+
+        if (!sendAll(connection.fd, handleRequest(line, &connection.cursor) + "\n")) {
+            connection.open = false;
+            return;
+        }
+    }
+    buffer.erase(0, begin);
+
+    if (buffer.size() > MAX_REQUEST_LINE) {
+        sendAll(connection.fd, errorResponse("request line too long", 0) + "\n");
+        connection.open = false;
+    }
+}
+
+void QueryServer::closeSocket() {
+    for (int& fd : m_wakeFds) {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+    if (m_listenFd < 0) return;
+    ::close(m_listenFd);
+    m_listenFd = -1;
+    ::unlink(m_socketPath.c_str());
+}
+
+QueryClient::~QueryClient() {
+    if (m_fd >= 0) ::close(m_fd);
+}
+
+bool QueryClient::connect(const std::string& socketPath, std::string* error) {
+    sockaddr_un address;
+    if (!fillAddress(socketPath, address, error)) return false;
+
+    // Reconnecting drops the previous connection and anything left unread on it
+    if (m_fd >= 0) ::close(m_fd);
+    m_buffer.clear();
+    m_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_fd < 0 || ::connect(m_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        if (error) *error = "cannot connect to " + socketPath + ": " + std::strerror(errno);
+        if (m_fd >= 0) ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool QueryClient::request(const std::string& line, std::string& response, std::string* error) {
+    if (m_fd < 0) {
+        if (error) *error = "not connected";
+        return false;
+    }
+    if (!sendAll(m_fd, line + "\n")) {
+        if (error) *error = std::string("send: ") + std::strerror(errno);
+        return false;
+    }
+
+    char chunk[4096];
+    size_t newline;
+    while ((newline = m_buffer.find('\n')) == std::string::npos) {
+        ssize_t n = ::recv(m_fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (error) *error = "server closed the connection";
+            return false;
+        }
+        m_buffer.append(chunk, static_cast<size_t>(n));
+    }
+
+    response = m_buffer.substr(0, newline);
+    m_buffer.erase(0, newline + 1);
+    return true;
+}
+
+#endif
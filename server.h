@@ -0,0 +1,118 @@
+// Server.h
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include "index.h"
+
+// Line protocol spoken over a Unix domain socket. Each request is one line,
+// each response is one line of JSON carrying "ok" and "elapsed_us":
+//
+//   PING
+//   STATS
+//   QUERY [limit=N] [sort=KEY] [snippets=N] <query>
+//                                         KEY as for the CLI: relevance, name, size, -size, date, -date;
+//                                         snippets=N adds up to N matching lines per result
+//   EXPLAIN <query>
+//   COMPLETE [limit=N] [sort=KEY] <prefix>
+//                                         filenames starting with prefix (the rest of the line),
+//                                         by default the 10 newest; each connection keeps a
+//                                         cursor, so sending the text after every keystroke
+//                                         only moves it by the characters that changed
+//
+// A connection may send any number of requests and is served in order. A
+// worker thread only holds a connection while it has a request to answer;
+// between requests it waits in the accept loop's poll set, so idle keep-alive
+// clients don't tie up workers.
+class QueryServer {
+public:
+    // The index must stay alive and unmodified while the server runs
+    QueryServer(const Index& index, const std::string& socketPath, size_t threads = 0);
+    ~QueryServer();
+
+    // Binds and listens; fails if another server already owns the socket
+    bool start(std::string* error);
+    // Accepts connections until stop(); returns after all workers have exited
+    void run();
+    // Only sets a flag, so it is safe to call from a signal handler
+    void stop() { m_stopRequested = true; }
+
+    // Handles a single request line; exposed so callers can serve requests without a socket.
+    // cursor carries COMPLETE's position from one request to the next.
+    std::string handleRequest(const std::string& line, PrefixCursor* cursor = nullptr);
+
+    uint64_t requestsServed() const { return m_requests; }
+
+private:
+    const Index& m_index;
+    std::string m_socketPath;
+    size_t m_threadCount;
+    int m_listenFd{-1};
+    std::chrono::steady_clock::time_point m_started;
+
+    // One client; only the accept loop or a single worker touches it at a time
+    struct Connection {
+        int fd;
+        std::string buffer; // the start of a request line not yet complete
+        PrefixCursor cursor; // COMPLETE requests on one connection are usually successive keystrokes
+        bool open = true;
+
+        Connection(int fd, const Index& index) : fd(fd), cursor(index.prefixCursor()) {}
+        ~Connection();
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+    };
+
+    std::vector<std::thread> m_workerThreads;
+    std::queue<std::unique_ptr<Connection>> m_ready;      // readable, waiting for a worker
+    std::vector<std::unique_ptr<Connection>> m_returned;  // served, going back to the poll set
+    std::mutex m_queueMutex;
+    std::condition_variable m_queueCV;
+    int m_wakeFds[2]{-1, -1}; // workers write a byte to make the accept loop poll returned connections
+    std::atomic<bool> m_stopRequested{false};
+
+    std::atomic<uint64_t> m_requests{0};
+    std::atomic<uint64_t> m_errors{0};
+    std::atomic<uint64_t> m_totalMicros{0};
+    std::atomic<uint64_t> m_maxMicros{0};
+
+    void workerThread();
+    // Reads what the client sent and answers every complete request line
+    void serveRequests(Connection& connection);
+    void recordLatency(uint64_t micros);
+    void closeSocket();
+};
+
+// Client side of the protocol: one connection, any number of request/response round trips
+class QueryClient {
+public:
+    QueryClient() = default;
+    ~QueryClient();
+    QueryClient(const QueryClient&) = delete;
+    QueryClient& operator=(const QueryClient&) = delete;
+
+    bool connect(const std::string& socketPath, std::string* error);
+    // Sends one request line and waits for its response line (without the newline)
+    bool request(const std::string& line, std::string& response, std::string* error);
+
+private:
+    int m_fd{-1};
+    std::string m_buffer;
+};
+
+// JSON shape of one result, shared by the CLI's --json output and the server.
+// Snippets become "snippets":[{"offset":N,"text":"...","highlights":[[begin,end],...]}],
+// with highlights as byte ranges of text.
+void writeFileJson(std::ostream& out, const FileMetadata& file, const std::vector<Snippet>* snippets = nullptr);
+
+#endif
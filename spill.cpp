@@ -0,0 +1,158 @@
+// Spill.cpp
+#include "spill.h"
+#include <atomic>
+#include <queue>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const size_t WRITE_BUFFER_BYTES = 1 << 20;
+
+} // namespace
+
+fs::path spillRunPath(const fs::path& directory) {
+    static std::atomic<uint64_t> counter{0};
+#ifdef _WIN32
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif
+    std::error_code ec;
+    fs::path base = directory.empty() ? fs::temp_directory_path(ec) : directory;
+    return base / ("fsidx-spill-" + std::to_string(pid) + "-" + std::to_string(counter++) + ".run");
+}
+
+SpillRunWriter::SpillRunWriter(const fs::path& path)
+    : m_path(path), m_out(path, std::ios::binary | std::ios::trunc) {
+    if (!m_out) {
+        throw std::runtime_error(path.string() + ": cannot create");
+    }
+}
+
+void SpillRunWriter::write(const std::string& term, const std::vector<size_t>& docs,
+                           const std::vector<uint32_t>& offsets, const std::vector<uint16_t>& counts) {
+    BinaryWriter record;
+    record.string(term);
+    record.varint(docs.size());
+    size_t previous = 0;
+    for (size_t id : docs) {
+        record.varint(id - previous);
+        previous = id;
+    }
+    for (uint32_t offset : offsets) {
+        record.varint(offset);
+    }
+    for (uint16_t count : counts) {
+        record.varint(count);
+    }
+
+    m_buffer.u32(static_cast<uint32_t>(record.data().size()));
+    m_buffer.bytes(record.data().data(), record.data().size());
+    if (m_buffer.data().size() >= WRITE_BUFFER_BYTES) flush();
+}
+
+void SpillRunWriter::flush() {
+    m_out.write(m_buffer.data().data(), static_cast<std::streamsize>(m_buffer.data().size()));
+    m_buffer.data().clear();
+    if (!m_out) {
+        throw std::runtime_error(m_path.string() + ": write failed");
+    }
+}
+
+void SpillRunWriter::close() {
+    flush();
+    m_out.close();
+    if (!m_out) {
+        throw std::runtime_error(m_path.string() + ": write failed");
+    }
+}
+
+SpillRunReader::SpillRunReader(const fs::path& path) : m_path(path), m_in(path, std::ios::binary) {
+    if (!m_in) {
+        throw CacheFormatError(path.string() + ": cannot open spilled run");
+    }
+}
+
+bool SpillRunReader::next(SpilledTerm& out) {
+    char prefix[4];
+    m_in.read(prefix, sizeof(prefix));
+    if (m_in.gcount() == 0 && m_in.eof()) return false;
+    if (m_in.gcount() != sizeof(prefix)) {
+        throw CacheFormatError(m_path.string() + ": truncated spilled run");
+    }
+    uint32_t length = BinaryReader(prefix, sizeof(prefix)).u32();
+
+    m_record.resize(length);
+    m_in.read(&m_record[0], length);
+    if (static_cast<uint32_t>(m_in.gcount()) != length) {
+        throw CacheFormatError(m_path.string() + ": truncated spilled run");
+    }
+
+    BinaryReader in(m_record.data(), m_record.size());
+    out.term = in.string();
+    out.docs.resize(in.count(3));
+    uint64_t id = 0;
+    for (size_t& doc : out.docs) {
+        id += in.varint();
+        doc = static_cast<size_t>(id);
+    }
+    out.offsets.resize(out.docs.size());
+    for (uint32_t& offset : out.offsets) {
+        offset = static_cast<uint32_t>(in.varint());
+    }
+    out.counts.resize(out.docs.size());
+    for (uint16_t& count : out.counts) {
+        uint64_t value = in.varint();
+        if (value == 0 || value > UINT16_MAX) {
+            throw CacheFormatError(m_path.string() + ": damaged spilled run");
+        }
+        count = static_cast<uint16_t>(value);
+    }
+    if (!in.atEnd()) {
+        throw CacheFormatError(m_path.string() + ": damaged spilled run");
+    }
+    return true;
+}
+
+void mergeTermSources(const std::vector<TermSource*>& sources, const std::function<void(SpilledTerm&)>& visit) {
+    std::vector<SpilledTerm> heads(sources.size());
+    // (term, source), smallest term first and earlier sources first among equal terms
+    auto later = [&heads](size_t a, size_t b) {
+        int order = heads[a].term.compare(heads[b].term);
+        return order != 0 ? order > 0 : a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> queue(later);
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (sources[i]->next(heads[i])) queue.push(i);
+    }
+
+    SpilledTerm merged;
+    while (!queue.empty()) {
+        size_t source = queue.top();
+        queue.pop();
+        merged = std::move(heads[source]);
+        if (sources[source]->next(heads[source])) queue.push(source);
+
+        while (!queue.empty() && heads[queue.top()].term == merged.term) {
+            size_t other = queue.top();
+            queue.pop();
+            SpilledTerm& head = heads[other];
+            if (!merged.docs.empty() && !head.docs.empty() && head.docs.front() <= merged.docs.back()) {
+                throw CacheFormatError("spilled runs overlap for term '" + merged.term + "'");
+            }
+            merged.docs.insert(merged.docs.end(), head.docs.begin(), head.docs.end());
+            merged.offsets.insert(merged.offsets.end(), head.offsets.begin(), head.offsets.end());
+            merged.counts.insert(merged.counts.end(), head.counts.begin(), head.counts.end());
+            if (sources[other]->next(heads[other])) queue.push(other);
+        }
+        visit(merged);
+    }
+}
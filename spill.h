@@ -0,0 +1,71 @@
+// Spill.h
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include "cachefile.h"
+
+// One term's postings on their way through a merge
+struct SpilledTerm {
+    std::string term;
+    std::vector<size_t> docs;
+    std::vector<uint32_t> offsets;
+    std::vector<uint16_t> counts;
+};
+
+// Terms in ascending order, from a run file or from memory
+class TermSource {
+public:
+    virtual ~TermSource() = default;
+    // False once the source is exhausted
+    virtual bool next(SpilledTerm& out) = 0;
+};
+
+// A unique name for a run file in directory (the system temp directory if empty)
+std::filesystem::path spillRunPath(const std::filesystem::path& directory);
+
+// Writes a sorted run of postings: per term a u32 record length, then the term,
+// a varint count, varint doc ID gaps, varint offsets and varint term counts. Terms must be written
+// in ascending order. Throws std::runtime_error on I/O errors.
+class SpillRunWriter {
+public:
+    explicit SpillRunWriter(const std::filesystem::path& path);
+
+    void write(const std::string& term, const std::vector<size_t>& docs, const std::vector<uint32_t>& offsets,
+               const std::vector<uint16_t>& counts);
+    // Flushes the file; the run is incomplete until this returns
+    void close();
+
+private:
+    std::filesystem::path m_path;
+    std::ofstream m_out;
+    BinaryWriter m_buffer;
+
+    void flush();
+};
+
+// Reads a run back one term at a time; throws CacheFormatError if it is damaged
+class SpillRunReader : public TermSource {
+public:
+    explicit SpillRunReader(const std::filesystem::path& path);
+
+    bool next(SpilledTerm& out) override;
+
+private:
+    std::filesystem::path m_path;
+    std::ifstream m_in;
+    std::string m_record;
+};
+
+// k-way merge: calls visit once per distinct term, in ascending order, with
+// the postings of every source that has it concatenated in source order.
+// Runs are spilled as doc IDs grow, so earlier sources hold smaller doc IDs
+// and the concatenation stays sorted. Only one term per source is in memory.
+void mergeTermSources(const std::vector<TermSource*>& sources, const std::function<void(SpilledTerm&)>& visit);
+
+#endif
@@ -0,0 +1,207 @@
+// Cachefile_test.cpp
+// The cache file container: a flipped byte anywhere is caught by a checksum,
+// a truncated file is rejected when it's opened, and a write that fails
+// leaves the previous cache in place.
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include "cachefile.h"
+#include "check.h"
+#include "index.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const uint32_t FIRST = 1;
+const uint32_t SECOND = 2;
+
+std::string readAll(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void writeAll(const fs::path& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+bool writeCache(const fs::path& path, const std::string& first, const std::string& second, std::string* error = nullptr) {
+    CacheFileWriter writer;
+    writer.addSection(FIRST, first);
+    writer.addSection(SECOND, second);
+    return writer.commit(path.string(), error);
+}
+
+// Opens the file and reads both sections; false if anything on the way throws
+bool readsBack(const fs::path& path, std::string* first = nullptr, std::string* error = nullptr) {
+    try {
+        CacheFileReader reader;
+        if (!reader.open(path.string())) {
+            if (error) *error = "not a cache file";
+            return false;
+        }
+        std::string data = reader.readSection(FIRST);
+        reader.readSection(SECOND);
+        if (first) *first = data;
+        return true;
+    } catch (const CacheFormatError& e) {
+        if (error) *error = e.what();
+        return false;
+    }
+}
+
+int processId() {
+#ifdef _WIN32
+    return _getpid();
+#else
+    return static_cast<int>(getpid());
+#endif
+}
+
+// Where CacheFileWriter::commit() writes before renaming over the cache
+std::string tempName(const fs::path& cache) {
+    return cache.string() + ".tmp" + std::to_string(processId());
+}
+
+void testRoundTrip(const fs::path& dir) {
+    fs::path cache = dir / "round-trip.idx";
+    CHECK(writeCache(cache, "first section", std::string(1000, 'x')));
+    std::string first;
+    CHECK(readsBack(cache, &first));
+    CHECK_EQ(first, std::string("first section"));
+    CHECK(!fs::exists(tempName(cache)));
+}
+
+void testFlippedBytes(const fs::path& dir) {
+    fs::path cache = dir / "flipped.idx";
+    CHECK(writeCache(cache, "first section", "second section"));
+    const std::string original = readAll(cache);
+
+    // Past the magic every byte is covered by the header CRC or a section CRC
+    for (size_t i = sizeof(cachefile::MAGIC); i < original.size(); ++i) {
+        std::string damaged = original;
+        damaged[i] = static_cast<char>(damaged[i] ^ 0x10);
+        writeAll(cache, damaged);
+        std::string error;
+        if (readsBack(cache, nullptr, &error)) {
+            checkFailed(__FILE__, __LINE__, "flipped byte " + std::to_string(i) + " went unnoticed");
+        }
+    }
+
+    // A damaged magic makes it not a cache file at all rather than a corrupt one
+    std::string damaged = original;
+    damaged[0] = 'X';
+    writeAll(cache, damaged);
+    CacheFileReader reader;
+    CHECK(!reader.open(cache.string()));
+}
+
+void testTruncated(const fs::path& dir) {
+    fs::path cache = dir / "truncated.idx";
+    CHECK(writeCache(cache, "first section", "second section"));
+    const std::string original = readAll(cache);
+
+    for (size_t length = sizeof(cachefile::MAGIC); length < original.size(); ++length) {
+        writeAll(cache, original.substr(0, length));
+        try {
+            CacheFileReader reader;
+            reader.open(cache.string());
+            checkFailed(__FILE__, __LINE__, "file cut to " + std::to_string(length) + " bytes was opened");
+        } catch (const CacheFormatError&) {
+        }
+    }
+}
+
+void testFailedWriteKeepsOldCache(const fs::path& dir) {
+    fs::path cache = dir / "kept.idx";
+    CHECK(writeCache(cache, "old cache", "old"));
+    const std::string original = readAll(cache);
+
+    // The temporary file can't be created: something else is in its place
+    fs::path temp = tempName(cache);
+    fs::create_directory(temp);
+    writeAll(temp / "occupied", "");
+    std::string error;
+    CHECK(!writeCache(cache, "new cache", "new", &error));
+    CHECK(!error.empty());
+    CHECK(readAll(cache) == original);
+    std::error_code ec;
+    fs::remove_all(temp, ec);
+
+#ifndef _WIN32
+    // The temporary file is created but writing to it fails
+    if (fs::exists("/dev/full")) {
+        fs::create_symlink("/dev/full", temp);
+        error.clear();
+        CHECK(!writeCache(cache, "new cache", std::string(1 << 16, 'n'), &error));
+        CHECK(!error.empty());
+        CHECK(readAll(cache) == original);
+        CHECK(!fs::exists(fs::symlink_status(temp)));
+        fs::remove(temp, ec);
+    }
+#endif
+
+    std::string first;
+    CHECK(readsBack(cache, &first));
+    CHECK_EQ(first, std::string("old cache"));
+
+    // And a write that goes through replaces it
+    CHECK(writeCache(cache, "new cache", "new"));
+    CHECK(readsBack(cache, &first));
+    CHECK_EQ(first, std::string("new cache"));
+}
+
+// A corrupt cache makes Index::loadFromFile() fail instead of loading garbage
+void testIndexRejectsCorruptCache(const fs::path& dir) {
+    Index index;
+    FileMetadata data;
+    data.path = "/t/notes.txt";
+    data.filename = "notes.txt";
+    data.size = 42;
+    data.last_modified = fs::file_time_type::clock::now();
+    data.extension = "txt";
+    data.content = "a few words to index";
+    index.addFile(data);
+
+    fs::path cache = dir / "index.idx";
+    CHECK(index.saveToFile(cache.string()));
+    Index loaded;
+    CHECK(loaded.loadFromFile(cache.string()));
+    CHECK_EQ(loaded.fileCount(), size_t(1));
+
+    std::string damaged = readAll(cache);
+    damaged[damaged.size() - 1] = static_cast<char>(damaged[damaged.size() - 1] ^ 1);
+    writeAll(cache, damaged);
+    Index corrupt;
+    CHECK(!corrupt.loadFromFile(cache.string()));
+
+    writeAll(cache, damaged.substr(0, damaged.size() / 2));
+    Index truncated;
+    CHECK(!truncated.loadFromFile(cache.string()));
+}
+
+} // namespace
+
+int main() {
+    fs::path dir = fs::temp_directory_path() / ("fsidx-cachefile-test-" + std::to_string(processId()));
+    fs::create_directories(dir);
+
+    testRoundTrip(dir);
+    testFlippedBytes(dir);
+    testTruncated(dir);
+    testFailedWriteKeepsOldCache(dir);
+    testIndexRejectsCorruptCache(dir);
+
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    return checkResult("cachefile_test");
+}
@@ -0,0 +1,45 @@
+// Check.h
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <iostream>
+#include <sstream>
+
+// Just enough of a test framework for ctest: a failed CHECK prints where and
+// what, the test carries on, and main() returns checkResult()
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline void checkFailed(const char* file, int line, const std::string& what) {
+    checkFailures()++;
+    std::cerr << file << ":" << line << ": " << what << std::endl;
+}
+
+#define CHECK(condition)                                                  \
+    do {                                                                  \
+        if (!(condition)) checkFailed(__FILE__, __LINE__, #condition);    \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                        \
+    do {                                                                                  \
+        auto checkActual = (actual);                                                      \
+        auto checkExpected = (expected);                                                  \
+        if (!(checkActual == checkExpected)) {                                            \
+            std::ostringstream checkMessage;                                              \
+            checkMessage << #actual << " is " << checkActual << ", expected " << checkExpected; \
+            checkFailed(__FILE__, __LINE__, checkMessage.str());                          \
+        }                                                                                 \
+    } while (0)
+
+inline int checkResult(const char* name) {
+    if (checkFailures()) {
+        std::cerr << name << ": " << checkFailures() << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << name << ": all checks passed" << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,197 @@
+// Ignore_test.cpp
+// Ignore rules against a table of what git does with the same rules and
+// paths, covering the hash-lookup fast paths and how they order against the
+// glob rules around them.
+#include <sstream>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "ignore.h"
+
+namespace {
+
+using Match = IgnoreRules::Match;
+
+const bool DIR = true;
+const bool FILE = false;
+
+struct Case {
+    const char* rules; // one rule per line, as in a .gitignore
+    const char* path;  // relative to the .gitignore's directory
+    bool isDirectory;
+    Match expected;
+};
+
+// Expectations are what `git check-ignore` says for each path (INCLUDE and
+// NONE both mean "not ignored" to git; INCLUDE says a '!' rule decided).
+// No path here sits below a directory its rules exclude, since git would
+// skip such a directory without ever asking about what's inside.
+const Case CASES[] = {
+    // Plain names match at any depth
+    {"node_modules", "node_modules", DIR, Match::IGNORE},
+    {"node_modules", "src/node_modules", DIR, Match::IGNORE},
+    {"node_modules", "node_modules.txt", FILE, Match::NONE},
+    {"core", "src/core", FILE, Match::IGNORE},
+
+    // A slash anywhere but the end anchors the rule to the .gitignore's directory
+    {"doc/frotz", "doc/frotz", FILE, Match::IGNORE},
+    {"doc/frotz", "a/doc/frotz", FILE, Match::NONE},
+    {"/core", "core", FILE, Match::IGNORE},
+    {"/core", "src/core", FILE, Match::NONE},
+    {"a/*.c", "a/x.c", FILE, Match::IGNORE},
+    {"a/*.c", "a/b/x.c", FILE, Match::NONE},
+
+    // **
+    {"a/**/b", "a/b", FILE, Match::IGNORE},
+    {"a/**/b", "a/x/b", FILE, Match::IGNORE},
+    {"a/**/b", "a/x/y/b", DIR, Match::IGNORE},
+    {"a/**/b", "x/a/b", FILE, Match::NONE},
+    {"a/**/b", "a/bb", FILE, Match::NONE},
+    {"a/**/b", "a/x/cb", FILE, Match::NONE},
+    {"**/foo", "foo", FILE, Match::IGNORE},
+    {"**/foo", "x/y/foo", FILE, Match::IGNORE},
+    {"**/foo/bar", "x/foo/bar", FILE, Match::IGNORE},
+    {"**/foo/bar", "x/foo/baz", FILE, Match::NONE},
+    {"out/**", "out/x", FILE, Match::IGNORE},
+    {"out/**", "out/x/y.o", FILE, Match::IGNORE},
+    {"out/**", "out", DIR, Match::NONE},
+
+    // Wildcards
+    {"*.o", "x.o", FILE, Match::IGNORE},
+    {"*.o", "src/x.o", FILE, Match::IGNORE},
+    {"*.o", "x.obj", FILE, Match::NONE},
+    {"?.txt", "a.txt", FILE, Match::IGNORE},
+    {"?.txt", "ab.txt", FILE, Match::NONE},
+    {"[a-c].o", "b.o", FILE, Match::IGNORE},
+    {"[a-c].o", "d.o", FILE, Match::NONE},
+    {"[!a].o", "a.o", FILE, Match::NONE},
+    {"[!a].o", "b.o", FILE, Match::IGNORE},
+    {"\\#notes", "#notes", FILE, Match::IGNORE},
+    {"\\!important", "!important", FILE, Match::IGNORE},
+    {"# comment", "# comment", FILE, Match::NONE},
+    {"trailing   ", "trailing", FILE, Match::IGNORE},
+
+    // Directory-only rules
+    {"build/", "build", DIR, Match::IGNORE},
+    {"build/", "build", FILE, Match::NONE},
+    {"build/", "src/build", DIR, Match::IGNORE},
+    {"/build/", "build", DIR, Match::IGNORE},
+    {"/build/", "src/build", DIR, Match::NONE},
+    {"*.d/", "x.d", DIR, Match::IGNORE},
+    {"*.d/", "x.d", FILE, Match::NONE},
+    {"cache*/", "cache-1", DIR, Match::IGNORE},
+    {"cache*/", "cache-1", FILE, Match::NONE},
+
+    // '!' re-includes, and the last matching rule decides
+    {"*.log\n!keep.log", "a.log", FILE, Match::IGNORE},
+    {"*.log\n!keep.log", "keep.log", FILE, Match::INCLUDE},
+    {"*.log\n!keep.log", "x/keep.log", FILE, Match::INCLUDE},
+    {"!keep.log\n*.log", "keep.log", FILE, Match::IGNORE},
+    {"tmp\n!tmp/", "tmp", DIR, Match::INCLUDE},
+    {"tmp\n!tmp/", "tmp", FILE, Match::IGNORE},
+
+    // "*.ext" and plain-name lookups against glob rules before and after them
+    {"*.txt\n!important*.txt", "notes.txt", FILE, Match::IGNORE},
+    {"*.txt\n!important*.txt", "important-notes.txt", FILE, Match::INCLUDE},
+    {"!important*.txt\n*.txt", "important-notes.txt", FILE, Match::IGNORE},
+    {"*.txt\n!docs/*.txt", "docs/a.txt", FILE, Match::INCLUDE},
+    {"*.txt\n!docs/*.txt", "docs/x/a.txt", FILE, Match::IGNORE},
+    {"*.txt\n!docs/*.txt", "a.txt", FILE, Match::IGNORE},
+    {"docs/*\n!*.md", "docs/a.md", FILE, Match::INCLUDE},
+    {"docs/*\n!*.md", "docs/a.txt", FILE, Match::IGNORE},
+    {"!*.md\ndocs/*", "docs/a.md", FILE, Match::IGNORE},
+    {"node_modules\n!node_mod*", "node_modules", DIR, Match::INCLUDE},
+    {"!node_mod*\nnode_modules", "node_modules", DIR, Match::IGNORE},
+    {"*.d\n!*.d/", "x.d", FILE, Match::IGNORE},
+    {"*.d\n!*.d/", "x.d", DIR, Match::INCLUDE},
+    {"*.gz\n*.tar.gz\n!keep.*", "keep.tar.gz", FILE, Match::INCLUDE},
+    {"!keep.*\n*.gz\n*.tar.gz", "keep.tar.gz", FILE, Match::IGNORE},
+    {"*.o\n!lib*.o\n*.o", "libx.o", FILE, Match::IGNORE},
+};
+
+std::string describe(Match match) {
+    switch (match) {
+    case Match::NONE:
+        return "NONE";
+    case Match::IGNORE:
+        return "IGNORE";
+    case Match::INCLUDE:
+        return "INCLUDE";
+    }
+    return "?";
+}
+
+IgnoreRules makeRules(const std::string& text) {
+    IgnoreRules rules;
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        rules.addLine(line);
+    }
+    return rules;
+}
+
+std::string lastComponent(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+void testRules() {
+    for (const auto& test : CASES) {
+        IgnoreRules rules = makeRules(test.rules);
+        Match actual = rules.match(test.path, lastComponent(test.path), test.isDirectory);
+        if (actual != test.expected) {
+            std::string rulesText = test.rules;
+            for (auto& c : rulesText) {
+                if (c == '\n') c = ';';
+            }
+            checkFailed(__FILE__, __LINE__, "rules '" + rulesText + "', " + (test.isDirectory ? "directory " : "file ") +
+                                                test.path + ": " + describe(actual) + ", expected " +
+                                                describe(test.expected));
+        }
+    }
+}
+
+// Deeper ignore files beat shallower ones, overrides beat them all and
+// defaults lose to all. The stack holds the levels of one point of the walk,
+// so each path asked about is below every pushed level.
+void testStack() {
+    IgnoreStack stack;
+    stack.defaults() = makeRules("*.bak\n*.tmp");
+    stack.overrides() = makeRules("!*.bak\nsecret.txt");
+    stack.push("", makeRules("*.log\n!*.tmp\n/local.txt"));
+
+    CHECK(stack.isIgnored("a.log", "a.log", FILE));
+    CHECK(stack.isIgnored("local.txt", "local.txt", FILE));
+    CHECK(!stack.isIgnored("x.tmp", "x.tmp", FILE));
+    CHECK(!stack.isIgnored("x.bak", "x.bak", FILE));
+    CHECK(stack.isIgnored("secret.txt", "secret.txt", FILE));
+
+    stack.push("sub", makeRules("!*.log\n/local.txt"));
+    CHECK(!stack.isIgnored("sub/a.log", "a.log", FILE));
+    CHECK(stack.isIgnored("sub/local.txt", "local.txt", FILE));
+    CHECK(!stack.isIgnored("sub/b.tmp", "b.tmp", FILE));
+    CHECK(stack.isIgnored("sub/secret.txt", "secret.txt", FILE));
+
+    // Anchored rules of the root don't reach into sub, nor sub's into deeper directories
+    stack.push("sub/deeper", IgnoreRules());
+    CHECK(!stack.isIgnored("sub/deeper/local.txt", "local.txt", FILE));
+    CHECK(!stack.isIgnored("sub/deeper/a.log", "a.log", FILE));
+    stack.pop();
+
+    stack.pop();
+    stack.push("other", IgnoreRules());
+    CHECK(stack.isIgnored("other/a.log", "a.log", FILE));
+    CHECK(!stack.isIgnored("other/local.txt", "local.txt", FILE));
+
+    stack.clear();
+    CHECK(!stack.isIgnored("a.log", "a.log", FILE));
+}
+
+} // namespace
+
+int main() {
+    testRules();
+    testStack();
+    return checkResult("ignore_test");
+}
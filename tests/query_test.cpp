@@ -0,0 +1,382 @@
+// Query_test.cpp
+// The query language end to end: parser cases, then random queries run
+// through Index::search() and compared against a brute-force evaluation of
+// the same expression over every file.
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "check.h"
+#include "index.h"
+#include "query.h"
+#include "utils.h"
+
+namespace {
+
+const uint64_t MAX = std::numeric_limits<uint64_t>::max();
+const uint64_t HOUR = 3600;
+const uint64_t DAY = 24 * HOUR;
+
+// ---------------------------------------------------------------------------
+// Parser
+// ---------------------------------------------------------------------------
+
+std::string describe(const std::string& text) {
+    std::unique_ptr<QueryNode> root;
+    std::string error;
+    if (!parseQuery(text, root, error)) return "error: " + error;
+    return describeQuery(*root);
+}
+
+void checkRange(const std::string& text, QueryNode::Type type, uint64_t low, uint64_t high) {
+    std::unique_ptr<QueryNode> root;
+    std::string error;
+    if (!parseQuery(text, root, error)) {
+        checkFailed(__FILE__, __LINE__, "'" + text + "' didn't parse: " + error);
+        return;
+    }
+    if (root->type != type || root->low != low || root->high != high) {
+        checkFailed(__FILE__, __LINE__, "'" + text + "' parsed as " + describeQuery(*root) + ", expected " +
+                                            std::to_string(low) + ".." + std::to_string(high));
+    }
+}
+
+void checkRejected(const std::string& text) {
+    std::unique_ptr<QueryNode> root;
+    std::string error;
+    if (parseQuery(text, root, error) || error.empty()) {
+        checkFailed(__FILE__, __LINE__, "'" + text + "' should not parse");
+    }
+}
+
+void testParser() {
+    // AND binds tighter than OR; NOT and '-' bind to the next term or group
+    CHECK_EQ(describe("a b OR c"), "((a b) OR c)");
+    CHECK_EQ(describe("a AND b"), "(a b)");
+    CHECK_EQ(describe("a OR b c"), "((b c) OR a)");
+    CHECK_EQ(describe("-a b"), "(-a b)");
+    CHECK_EQ(describe("NOT (a OR b) c"), "(-(a OR b) c)");
+    CHECK_EQ(describe("-a OR -b"), "(-a OR -b)");
+    CHECK_EQ(describe("--a"), "--a");
+    CHECK_EQ(describe("\"a b\" OR c"), "((a b) OR c)");
+    CHECK_EQ(describe("ext:cpp name:Index* in:src/core"), "(ext:cpp in:src/core name:Index*)");
+    CHECK_EQ(describe("in:\"My Docs\""), "in:My Docs");
+
+    // Sizes: K/M/G/T are powers of 1024, with an optional B or iB
+    checkRange("size:>1K", QueryNode::Type::SIZE, 1025, MAX);
+    checkRange("size:>=1K", QueryNode::Type::SIZE, 1024, MAX);
+    checkRange("size:<1kb", QueryNode::Type::SIZE, 0, 1023);
+    checkRange("size:<=2M", QueryNode::Type::SIZE, 0, 2ULL << 20);
+    checkRange("size:=512", QueryNode::Type::SIZE, 512, 512);
+    checkRange("size:512", QueryNode::Type::SIZE, 512, 512);
+    checkRange("size:1.5K", QueryNode::Type::SIZE, 1536, 1536);
+    checkRange("size:2GiB..", QueryNode::Type::SIZE, 2ULL << 30, MAX);
+    checkRange("size:..1T", QueryNode::Type::SIZE, 0, 1ULL << 40);
+    checkRange("size:10K..2M", QueryNode::Type::SIZE, 10240, 2ULL << 20);
+
+    // Ages in seconds; <7d is "modified within the last 7 days"
+    checkRange("mtime:<7d", QueryNode::Type::MTIME, 0, 7 * DAY - 1);
+    checkRange("mtime:>2h", QueryNode::Type::MTIME, 2 * HOUR + 1, MAX);
+    checkRange("mtime:1w", QueryNode::Type::MTIME, 7 * DAY, 7 * DAY);
+    checkRange("mtime:30m..1d", QueryNode::Type::MTIME, 1800, DAY);
+    checkRange("mtime:<=45s", QueryNode::Type::MTIME, 0, 45);
+    checkRange("mtime:1y..", QueryNode::Type::MTIME, 365 * DAY, MAX);
+
+    checkRejected("");
+    checkRejected("(a");
+    checkRejected("a)");
+    checkRejected("a OR");
+    checkRejected("NOT");
+    checkRejected("size:5X");
+    checkRejected("size:<0");
+    checkRejected("size:2M..1M");
+    checkRejected("size:..");
+    checkRejected("mtime:3q");
+}
+
+// ---------------------------------------------------------------------------
+// Planner against brute force
+// ---------------------------------------------------------------------------
+
+struct Doc {
+    FileMetadata data;
+    std::string directory;
+    uint64_t age; // seconds since modification
+    std::set<std::string> terms;
+};
+
+const char* const DIRECTORIES[] = {"/t/a", "/t/a/x", "/t/b", "/t/b/c", "/t/b/c/d"};
+const char* const EXTENSIONS[] = {"txt", "cpp", "md", "log", "bin"};
+const uint64_t SIZES[] = {0, 100, 512, 513, 1023, 1024, 1025, 4096, 8192, 3ULL << 20};
+// Well away from every bound the queries use
+const uint64_t AGES[] = {10 * 60, 5 * HOUR, 3 * DAY, 10 * DAY, 40 * DAY};
+const char* const WORDS[] = {"alpha", "beta", "gamma", "delta", "omega", "alphaBeta", "gamma_delta"};
+
+std::vector<Doc> makeDocs(std::mt19937& rng, size_t count) {
+    auto pick = [&rng](size_t n) { return static_cast<size_t>(rng() % n); };
+    auto now = std::filesystem::file_time_type::clock::now();
+
+    std::vector<Doc> docs(count);
+    for (size_t i = 0; i < count; ++i) {
+        Doc& doc = docs[i];
+        doc.directory = DIRECTORIES[pick(5)];
+        doc.data.extension = EXTENSIONS[pick(5)];
+        doc.data.filename = "f" + std::to_string(i) + "." + doc.data.extension;
+        doc.data.path = std::filesystem::path(doc.directory) / doc.data.filename;
+        doc.data.size = SIZES[pick(10)];
+        doc.age = AGES[pick(5)];
+        doc.data.last_modified = now - std::chrono::seconds(doc.age);
+        size_t words = pick(6);
+        for (size_t w = 0; w < words; ++w) {
+            doc.data.content += std::string(WORDS[pick(7)]) + " ";
+        }
+    }
+    return docs;
+}
+
+// A query as the test built it, evaluated without the index
+struct Expr {
+    enum class Kind { WORD, EXT, NAME, SIZE, MTIME, IN, AND, OR, NOT } kind;
+    std::string text;    // as written in the query
+    std::string operand; // word, extension, pattern or directory
+    uint64_t low = 0;
+    uint64_t high = MAX;
+    std::vector<Expr> children;
+    std::vector<std::string> terms; // WORD operand as analyzed, see analyzeWords()
+};
+
+Expr leaf(Expr::Kind kind, const std::string& text, const std::string& operand, uint64_t low = 0,
+          uint64_t high = MAX) {
+    Expr expr{kind, text, operand, low, high, {}, {}};
+    return expr;
+}
+
+Expr word(const std::string& w) { return leaf(Expr::Kind::WORD, w, w); }
+
+Expr group(Expr::Kind kind, std::vector<Expr> children) {
+    Expr expr{kind, "", "", 0, MAX, std::move(children), {}};
+    return expr;
+}
+
+Expr negate(Expr child) { return group(Expr::Kind::NOT, {std::move(child)}); }
+
+std::string render(const Expr& expr, std::mt19937& rng) {
+    switch (expr.kind) {
+    case Expr::Kind::AND:
+    case Expr::Kind::OR: {
+        std::string out = "(";
+        for (size_t i = 0; i < expr.children.size(); ++i) {
+            if (i) out += expr.kind == Expr::Kind::AND ? (rng() % 4 ? " " : " AND ") : " OR ";
+            out += render(expr.children[i], rng);
+        }
+        return out + ")";
+    }
+    case Expr::Kind::NOT:
+        return (rng() % 2 ? "-" : "NOT ") + render(expr.children[0], rng);
+    default:
+        return expr.text;
+    }
+}
+
+// A term with no words ("*", or punctuation) is neutral: AND and OR drop it,
+// excluding it leaves nothing, and a query that is nothing but neutral finds
+// nothing. NEUTRAL stands for that while evaluating.
+enum class Match { NO, YES, NEUTRAL };
+
+void analyzeWords(Expr& expr, const Analyzer& analyzer) {
+    if (expr.kind == Expr::Kind::WORD) {
+        std::vector<Token> tokens;
+        analyzer.analyze(expr.operand, tokens, true);
+        for (const auto& token : tokens) {
+            expr.terms.push_back(token.term);
+        }
+    }
+    for (auto& child : expr.children) {
+        analyzeWords(child, analyzer);
+    }
+}
+
+Match evaluate(const Expr& expr, const Doc& doc) {
+    switch (expr.kind) {
+    case Expr::Kind::WORD:
+        if (expr.terms.empty()) return Match::NEUTRAL;
+        for (const auto& term : expr.terms) {
+            if (!doc.terms.count(term)) return Match::NO;
+        }
+        return Match::YES;
+    case Expr::Kind::EXT:
+        return doc.data.extension == expr.operand ? Match::YES : Match::NO;
+    case Expr::Kind::NAME:
+        return globMatch(expr.operand, doc.data.filename) ? Match::YES : Match::NO;
+    case Expr::Kind::SIZE:
+        return doc.data.size >= expr.low && doc.data.size <= expr.high ? Match::YES : Match::NO;
+    case Expr::Kind::MTIME:
+        return doc.age >= expr.low && doc.age <= expr.high ? Match::YES : Match::NO;
+    case Expr::Kind::IN:
+        return doc.directory == expr.operand || doc.directory.compare(0, expr.operand.size() + 1, expr.operand + "/") == 0
+                   ? Match::YES
+                   : Match::NO;
+    case Expr::Kind::NOT: {
+        Match child = evaluate(expr.children[0], doc);
+        return child == Match::NO ? Match::YES : Match::NO;
+    }
+    case Expr::Kind::AND:
+    case Expr::Kind::OR: {
+        bool any = false;
+        bool all = true;
+        bool constrained = false;
+        for (const auto& child : expr.children) {
+            Match match = evaluate(child, doc);
+            if (match == Match::NEUTRAL) continue;
+            constrained = true;
+            any |= match == Match::YES;
+            all &= match == Match::YES;
+        }
+        if (!constrained) return Match::NEUTRAL;
+        return (expr.kind == Expr::Kind::AND ? all : any) ? Match::YES : Match::NO;
+    }
+    }
+    return Match::NO;
+}
+
+Expr randomLeaf(std::mt19937& rng) {
+    static const std::vector<Expr> leaves = {
+        word("alpha"), word("beta"), word("gamma"), word("delta"), word("omega"), word("zeta"),
+        word("Alpha"), word("*"), word("gammaDelta"),
+        group(Expr::Kind::AND, {word("alpha"), word("beta")}),
+        leaf(Expr::Kind::EXT, "ext:cpp", "cpp"), leaf(Expr::Kind::EXT, "ext:TXT", "txt"),
+        leaf(Expr::Kind::EXT, "ext:.md", "md"), leaf(Expr::Kind::EXT, "ext:zip", "zip"),
+        leaf(Expr::Kind::NAME, "name:f1*", "f1*"), leaf(Expr::Kind::NAME, "name:f?.txt", "f?.txt"),
+        leaf(Expr::Kind::NAME, "name:*3.md", "*3.md"), leaf(Expr::Kind::NAME, "name:f12.log", "f12.log"),
+        leaf(Expr::Kind::SIZE, "size:>1K", "", 1025), leaf(Expr::Kind::SIZE, "size:<=512", "", 0, 512),
+        leaf(Expr::Kind::SIZE, "size:1K..8K", "", 1024, 8192), leaf(Expr::Kind::SIZE, "size:>=3M", "", 3ULL << 20),
+        leaf(Expr::Kind::SIZE, "size:=1024", "", 1024, 1024), leaf(Expr::Kind::SIZE, "size:<1kb", "", 0, 1023),
+        leaf(Expr::Kind::MTIME, "mtime:<1d", "", 0, DAY - 1), leaf(Expr::Kind::MTIME, "mtime:>7d", "", 7 * DAY + 1),
+        leaf(Expr::Kind::MTIME, "mtime:2d..30d", "", 2 * DAY, 30 * DAY),
+        leaf(Expr::Kind::MTIME, "mtime:<=6h", "", 0, 6 * HOUR),
+        leaf(Expr::Kind::IN, "in:/t/b", "/t/b"), leaf(Expr::Kind::IN, "in:/t/a/x", "/t/a/x"),
+        leaf(Expr::Kind::IN, "in:/t/nowhere", "/t/nowhere"),
+    };
+    Expr expr = leaves[rng() % leaves.size()];
+    // Quoted words group the same way parentheses do
+    if (expr.kind == Expr::Kind::AND) expr = leaf(Expr::Kind::WORD, "\"alpha beta\"", "alpha beta");
+    return expr;
+}
+
+Expr randomExpr(std::mt19937& rng, int depth) {
+    if (depth == 0 || rng() % 3 == 0) {
+        Expr expr = randomLeaf(rng);
+        return rng() % 4 == 0 ? negate(std::move(expr)) : expr;
+    }
+    switch (rng() % 3) {
+    case 0:
+        return negate(randomExpr(rng, depth - 1));
+    default: {
+        std::vector<Expr> children;
+        size_t count = 2 + rng() % 2;
+        for (size_t i = 0; i < count; ++i) {
+            children.push_back(randomExpr(rng, depth - 1));
+        }
+        return group(rng() % 2 ? Expr::Kind::AND : Expr::Kind::OR, std::move(children));
+    }
+    }
+}
+
+struct Corpus {
+    Index index;
+    std::vector<Doc> docs;
+};
+
+std::vector<std::string> expectedPaths(const Corpus& corpus, Expr expr) {
+    analyzeWords(expr, Analyzer(corpus.index.analyzerOptions()));
+    std::vector<std::string> paths;
+    for (const auto& doc : corpus.docs) {
+        if (evaluate(expr, doc) == Match::YES) {
+            paths.push_back(doc.data.path.string());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+std::vector<std::string> searchPaths(const Index& index, const std::string& query, std::string& error) {
+    std::vector<std::string> paths;
+    for (const auto& file : index.search(query, SortBy::NAME, 0, &error)) {
+        paths.push_back(file.path.string());
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+bool compare(const Corpus& corpus, const Expr& expr, const std::string& query) {
+    std::string error;
+    std::vector<std::string> actual = searchPaths(corpus.index, query, error);
+    std::vector<std::string> expected = expectedPaths(corpus, expr);
+    if (!error.empty() || actual != expected) {
+        checkFailed(__FILE__, __LINE__, "'" + query + "' found " + std::to_string(actual.size()) +
+                                            " files, brute force " + std::to_string(expected.size()) +
+                                            (error.empty() ? "" : " (" + error + ")"));
+        return false;
+    }
+    return true;
+}
+
+void testNegation(const Corpus& corpus, std::mt19937& rng) {
+    const Expr alpha = word("alpha");
+    const Expr star = word("*");
+    const std::vector<Expr> cases = {
+        // Excluding a match-everything term matches nothing, alone or in an AND
+        group(Expr::Kind::AND, {alpha, negate(star)}),
+        negate(star),
+        group(Expr::Kind::AND, {alpha, negate(negate(star))}),
+        negate(negate(star)),
+        group(Expr::Kind::OR, {alpha, negate(star)}),
+        group(Expr::Kind::OR, {negate(alpha), negate(word("beta"))}),
+        group(Expr::Kind::OR, {negate(alpha), word("beta")}),
+        negate(group(Expr::Kind::OR, {alpha, word("beta")})),
+        negate(group(Expr::Kind::AND, {alpha, star})),
+        group(Expr::Kind::AND, {negate(leaf(Expr::Kind::SIZE, "size:>1K", "", 1025)), word("gamma")}),
+        negate(leaf(Expr::Kind::MTIME, "mtime:<1d", "", 0, DAY - 1)),
+        group(Expr::Kind::OR, {negate(leaf(Expr::Kind::IN, "in:/t/b", "/t/b")), leaf(Expr::Kind::EXT, "ext:cpp", "cpp")}),
+        star,
+        group(Expr::Kind::OR, {star, word("zeta")}),
+    };
+    for (const auto& expr : cases) {
+        compare(corpus, expr, render(expr, rng));
+    }
+}
+
+void testRandomQueries(const Corpus& corpus, unsigned seed) {
+    std::mt19937 rng(seed);
+    int mismatches = 0;
+    for (int i = 0; i < 1000 && mismatches < 10; ++i) {
+        Expr expr = randomExpr(rng, 3);
+        if (!compare(corpus, expr, render(expr, rng))) mismatches++;
+    }
+}
+
+} // namespace
+
+int main() {
+    testParser();
+
+    std::mt19937 rng(20240601);
+    Corpus corpus;
+    corpus.docs = makeDocs(rng, 400);
+    for (auto& doc : corpus.docs) {
+        for (const auto& occurrence : corpus.index.analyzeContent(doc.data)) {
+            doc.terms.insert(occurrence.term);
+        }
+        corpus.index.addFile(doc.data);
+    }
+
+    testNegation(corpus, rng);
+    testRandomQueries(corpus, 7);
+    // The same queries again, now answered from the result cache
+    testRandomQueries(corpus, 7);
+    return checkResult("query_test");
+}
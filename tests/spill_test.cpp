@@ -0,0 +1,278 @@
+// Spill_test.cpp
+// Spilled postings: mergeTermSources() over run files and an in-memory tail,
+// damaged runs, and an Index that spills under a small budget answering
+// queries like one that never did once its runs are merged back.
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "cachefile.h"
+#include "check.h"
+#include "index.h"
+#include "spill.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// The in-memory tail of a merge
+class VectorSource : public TermSource {
+public:
+    explicit VectorSource(std::vector<SpilledTerm> terms) : m_terms(std::move(terms)) {}
+
+    bool next(SpilledTerm& out) override {
+        if (m_next == m_terms.size()) return false;
+        out = m_terms[m_next++];
+        return true;
+    }
+
+private:
+    std::vector<SpilledTerm> m_terms;
+    size_t m_next{0};
+};
+
+// Counts are derived from the doc ID so a merge that mixes them up shows
+SpilledTerm term(const std::string& text, std::vector<size_t> docs) {
+    SpilledTerm result{text, std::move(docs), {}, {}};
+    for (size_t doc : result.docs) {
+        result.offsets.push_back(static_cast<uint32_t>(doc * 10));
+        result.counts.push_back(static_cast<uint16_t>(doc % 7 + 1));
+    }
+    return result;
+}
+
+fs::path writeRun(const fs::path& path, const std::vector<SpilledTerm>& terms) {
+    SpillRunWriter writer(path);
+    for (const auto& entry : terms) {
+        writer.write(entry.term, entry.docs, entry.offsets, entry.counts);
+    }
+    writer.close();
+    return path;
+}
+
+std::vector<SpilledTerm> merge(const std::vector<TermSource*>& sources) {
+    std::vector<SpilledTerm> merged;
+    mergeTermSources(sources, [&](SpilledTerm& entry) { merged.push_back(entry); });
+    return merged;
+}
+
+bool sameTerm(const SpilledTerm& a, const SpilledTerm& b) {
+    return a.term == b.term && a.docs == b.docs && a.offsets == b.offsets && a.counts == b.counts;
+}
+
+void testMerge(const fs::path& dir) {
+    fs::path first = writeRun(dir / "first.run", {term("apple", {1, 2}), term("cherry", {3}), term("fig", {4})});
+    fs::path second = writeRun(dir / "second.run", {term("apple", {5}), term("banana", {6, 7}), term("fig", {8})});
+    fs::path empty = writeRun(dir / "empty.run", {});
+    VectorSource tail({term("apple", {9, 12}), term("date", {10}), term("fig", {11})});
+
+    SpillRunReader firstReader(first);
+    SpillRunReader emptyReader(empty);
+    SpillRunReader secondReader(second);
+    std::vector<SpilledTerm> merged = merge({&firstReader, &emptyReader, &secondReader, &tail});
+
+    const std::vector<SpilledTerm> expected = {
+        term("apple", {1, 2, 5, 9, 12}), term("banana", {6, 7}), term("cherry", {3}),
+        term("date", {10}),              term("fig", {4, 8, 11}),
+    };
+    CHECK_EQ(merged.size(), expected.size());
+    for (size_t i = 0; i < std::min(merged.size(), expected.size()); ++i) {
+        if (!sameTerm(merged[i], expected[i])) {
+            checkFailed(__FILE__, __LINE__, "merged term " + std::to_string(i) + " is '" + merged[i].term +
+                                                "' with " + std::to_string(merged[i].docs.size()) +
+                                                " docs, expected '" + expected[i].term + "'");
+        }
+    }
+
+    // Nothing to merge
+    CHECK(merge({}).empty());
+    VectorSource nothing({});
+    CHECK(merge({&nothing}).empty());
+}
+
+bool overlapDetected(const std::vector<SpilledTerm>& earlier, const std::vector<SpilledTerm>& later) {
+    VectorSource first(earlier);
+    VectorSource second(later);
+    try {
+        merge({&first, &second});
+    } catch (const CacheFormatError& e) {
+        return std::string(e.what()).find("overlap") != std::string::npos;
+    }
+    return false;
+}
+
+void testOverlap() {
+    CHECK(overlapDetected({term("apple", {1, 5})}, {term("apple", {3})}));
+    CHECK(overlapDetected({term("apple", {1, 5})}, {term("apple", {5, 6})}));
+    CHECK(overlapDetected({term("a", {1}), term("b", {9})}, {term("b", {2})}));
+    CHECK(!overlapDetected({term("apple", {1, 5})}, {term("apple", {6})}));
+    // Different terms may hold the same docs in any order
+    CHECK(!overlapDetected({term("apple", {5})}, {term("banana", {1})}));
+}
+
+std::string readAll(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void writeAll(const fs::path& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+// Reads the whole run; false if it turned out damaged
+bool readsCleanly(const fs::path& path) {
+    try {
+        SpillRunReader reader(path);
+        SpilledTerm entry;
+        while (reader.next(entry)) {
+        }
+        return true;
+    } catch (const CacheFormatError&) {
+        return false;
+    }
+}
+
+void testDamagedRun(const fs::path& dir) {
+    fs::path run = writeRun(dir / "damaged.run", {term("apple", {1, 300, 70000}), term("banana", {2}), term("cherry", {3, 4})});
+    const std::string original = readAll(run);
+    CHECK(readsCleanly(run));
+
+    // Records are a u32 length and that many bytes; a run cut between two
+    // records is just a shorter run, anywhere else it is truncated
+    std::vector<size_t> boundaries = {0};
+    while (boundaries.back() < original.size()) {
+        BinaryReader length(original.data() + boundaries.back(), 4);
+        boundaries.push_back(boundaries.back() + 4 + length.u32());
+    }
+    CHECK_EQ(boundaries.back(), original.size());
+    for (size_t length = 1; length < original.size(); ++length) {
+        bool boundary = std::find(boundaries.begin(), boundaries.end(), length) != boundaries.end();
+        writeAll(run, original.substr(0, length));
+        if (readsCleanly(run) != boundary) {
+            checkFailed(__FILE__, __LINE__, "run cut to " + std::to_string(length) + " bytes " +
+                                                (boundary ? "was rejected" : "was read"));
+        }
+    }
+
+    // A record with bytes left over after its last count
+    std::string padded = original;
+    padded[0] = static_cast<char>(padded[0] + 1);
+    padded.insert(boundaries[1], 1, '\0');
+    writeAll(run, padded);
+    CHECK(!readsCleanly(run));
+
+    // A damaged run fails the merge it's part of
+    writeAll(run, original.substr(0, original.size() - 1));
+    SpillRunReader reader(run);
+    VectorSource tail({term("date", {5})});
+    bool thrown = false;
+    try {
+        merge({&reader, &tail});
+    } catch (const CacheFormatError&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    CHECK(!readsCleanly(dir / "missing.run"));
+}
+
+// ---------------------------------------------------------------------------
+// Index
+// ---------------------------------------------------------------------------
+
+const char* const WORDS[] = {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+                             "india", "juliet", "kilo", "lima", "mike", "november", "oscar", "papa"};
+
+void addFiles(Index& index, unsigned seed) {
+    std::mt19937 rng(seed);
+    for (int i = 0; i < 300; ++i) {
+        FileMetadata data;
+        data.filename = "file" + std::to_string(i) + ".txt";
+        data.path = "/t/" + data.filename;
+        data.extension = "txt";
+        data.last_modified = fs::file_time_type::clock::now();
+        for (int word = 0; word < 12; ++word) {
+            data.content += WORDS[rng() % std::size(WORDS)];
+            data.content += ' ';
+            data.content += "w" + std::to_string(rng() % 500) + " ";
+        }
+        data.size = data.content.size();
+        index.addFile(data);
+    }
+}
+
+std::vector<std::string> ranked(const Index& index, const std::string& query) {
+    std::string error;
+    std::vector<std::string> paths;
+    for (const auto& file : index.search(query, SortBy::RELEVANCE, 20, &error)) {
+        paths.push_back(file.path.string());
+    }
+    if (!error.empty()) paths.push_back("error: " + error);
+    return paths;
+}
+
+size_t filesIn(const fs::path& dir) {
+    return static_cast<size_t>(std::distance(fs::directory_iterator(dir), fs::directory_iterator()));
+}
+
+void testIndexMergesRuns(const fs::path& dir) {
+    Index reference;
+    addFiles(reference, 3);
+
+    fs::path runs = dir / "index-runs";
+    fs::create_directories(runs);
+    Index spilled;
+    spilled.setSpillBudget(8 * 1024, runs);
+    addFiles(spilled, 3);
+    CHECK(spilled.spilledRunCount() > 1);
+    CHECK_EQ(filesIn(runs), spilled.spilledRunCount());
+    CHECK(ranked(spilled, "alpha").size() == 1); // just the error
+
+    CHECK(spilled.mergeSpilledRuns());
+    CHECK_EQ(spilled.spilledRunCount(), size_t(0));
+    CHECK_EQ(filesIn(runs), size_t(0));
+    CHECK_EQ(spilled.termCount(), reference.termCount());
+    CHECK_EQ(ranked(reference, "alpha").size(), size_t(20));
+    for (const char* query : {"alpha", "bravo OR w17", "charlie -delta", "w250", "echo foxtrot golf"}) {
+        if (ranked(spilled, query) != ranked(reference, query)) {
+            checkFailed(__FILE__, __LINE__, std::string("'") + query + "' ranks differently after spilling");
+        }
+    }
+
+    // A run that can't be read leaves no postings rather than some of them
+    Index damaged;
+    damaged.setSpillBudget(8 * 1024, runs);
+    addFiles(damaged, 3);
+    if (damaged.spilledRunCount() == 0) {
+        checkFailed(__FILE__, __LINE__, "nothing was spilled");
+        return;
+    }
+    fs::path victim = *fs::directory_iterator(runs);
+    std::string data = readAll(victim);
+    writeAll(victim, data.substr(0, data.size() / 2));
+    CHECK(!damaged.mergeSpilledRuns());
+    CHECK_EQ(filesIn(runs), size_t(0));
+    CHECK_EQ(damaged.termCount(), size_t(0));
+    CHECK(ranked(damaged, "alpha").empty());
+}
+
+} // namespace
+
+int main() {
+    fs::path dir = fs::temp_directory_path() / ("fsidx-spill-test-" + std::to_string(std::random_device()()));
+    fs::create_directories(dir);
+
+    testMerge(dir);
+    testOverlap();
+    testDamagedRun(dir);
+    testIndexMergesRuns(dir);
+
+    std::error_code ec;
+    fs::remove_all(dir, ec);
+    return checkResult("spill_test");
+}
@@ -1,8 +1,24 @@
 // rie.cpp
-#include "Trie.h"
+#include "trie.h"
+#include <algorithm>
 #include <iostream>
 #include <functional> 
 
+namespace {
+
+bool betterEntry(const TrieEntry& a, const TrieEntry& b) {
+    return a.key != b.key ? a.key > b.key : a.fileIndex < b.fileIndex;
+}
+
+// Keeps best sorted and at most Trie::BEST_SLOTS long
+void offer(std::vector<TrieEntry>& best, const TrieEntry& entry) {
+    if (best.size() == Trie::BEST_SLOTS && !betterEntry(entry, best.back())) return;
+    best.insert(std::upper_bound(best.begin(), best.end(), entry, betterEntry), entry);
+    if (best.size() > Trie::BEST_SLOTS) best.pop_back();
+}
+
+} // namespace
+
 Trie::Trie() {
     root = new TrieNode();
 }
@@ -11,7 +27,16 @@ Trie::~Trie() {
     clearRecursive(root);
 }
 
-void Trie::insert(const std::string& word, size_t fileIndex) {
+void Trie::insert(const std::string& word, size_t fileIndex, int64_t mtime, uint64_t size) {
+    // Flipping the sign bit orders signed mtimes as unsigned keys
+    uint64_t keys[] = {static_cast<uint64_t>(mtime) ^ (uint64_t(1) << 63), size};
+    for (size_t rank = 0; rank < m_keys.size(); ++rank) {
+        if (m_keys[rank].size() <= fileIndex) m_keys[rank].resize(fileIndex + 1);
+        m_keys[rank][fileIndex] = keys[rank];
+    }
+
+    std::vector<TrieNode*> path{root};
+    path.reserve(word.size() + 1);
     TrieNode* current = root;
 
     for (char c : word) {
@@ -19,10 +44,42 @@ void Trie::insert(const std::string& word, size_t fileIndex) {
             current->children[c] = new TrieNode();
         }
         current = current->children[c];
+        path.push_back(current);
     }
 
     current->isEndOfWord = true;
     current->fileIndices.push_back(fileIndex);
+
+    for (TrieNode* node : path) {
+        node->subtreeSize++;
+        if (node->best) {
+            for (size_t rank = 0; rank < m_keys.size(); ++rank) {
+                offer((*node->best)[rank], TrieEntry{keys[rank], fileIndex});
+            }
+        } else if (node->subtreeSize > BEST_SLOTS) {
+            // Just outgrew direct ranking; the subtree has BEST_SLOTS + 1 files
+            node->best.reset(new TrieBest());
+            for (size_t rank = 0; rank < m_keys.size(); ++rank) {
+                (*node->best)[rank] = rankSubtree(node, static_cast<TrieRank>(rank), BEST_SLOTS);
+            }
+        }
+    }
+}
+
+std::vector<TrieEntry> Trie::rankSubtree(const TrieNode* node, TrieRank rank, size_t k) const {
+    std::vector<size_t> indices;
+    collectIndicesRecursive(node, indices);
+    const std::vector<uint64_t>& keys = m_keys[static_cast<size_t>(rank)];
+
+    std::vector<TrieEntry> entries;
+    entries.reserve(indices.size());
+    for (size_t index : indices) {
+        entries.push_back({keys[index], index});
+    }
+    k = std::min(k, entries.size());
+    std::partial_sort(entries.begin(), entries.begin() + k, entries.end(), betterEntry);
+    entries.resize(k);
+    return entries;
 }
 
 std::vector<size_t> Trie::searchPrefix(const std::string& prefix) const {
@@ -56,6 +113,17 @@ std::vector<size_t> Trie::searchPrefix(const std::string& prefix) const {
 void Trie::clear() {
     clearRecursive(root);
     root = new TrieNode();
+    m_epoch++;
+    for (auto& keys : m_keys) {
+        std::vector<uint64_t>().swap(keys);
+    }
+}
+
+void Trie::collectIndicesRecursive(const TrieNode* node, std::vector<size_t>& results) const {
+    results.insert(results.end(), node->fileIndices.begin(), node->fileIndices.end());
+    for (const auto& child : node->children) {
+        collectIndicesRecursive(child.second, results);
+    }
 }
 
 
@@ -69,3 +137,78 @@ void Trie::clearRecursive(TrieNode* node) {
     delete node;
 }
 
+PrefixCursor::PrefixCursor(const Trie& trie) : m_trie(&trie), m_path{trie.root}, m_epoch(trie.m_epoch) {}
+
+void PrefixCursor::sync() const {
+    if (m_epoch == m_trie->m_epoch) return;
+    m_epoch = m_trie->m_epoch;
+    m_path.assign(1, m_trie->root);
+    for (char c : m_prefix) {
+        auto it = m_path.back()->children.find(c);
+        if (it == m_path.back()->children.end()) break;
+        m_path.push_back(it->second);
+    }
+}
+
+// The node for the whole prefix, or null if no word has it
+const TrieNode* PrefixCursor::node() const {
+    sync();
+    return m_path.size() == m_prefix.size() + 1 ? m_path.back() : nullptr;
+}
+
+void PrefixCursor::push(char c) {
+    // Past a dead end every longer prefix is dead too, so only the text grows
+    if (const TrieNode* current = node()) {
+        auto it = current->children.find(c);
+        if (it != current->children.end()) m_path.push_back(it->second);
+    }
+    m_prefix.push_back(c);
+}
+
+void PrefixCursor::pop() {
+    if (m_prefix.empty()) return;
+    if (node()) m_path.pop_back();
+    m_prefix.pop_back();
+}
+
+void PrefixCursor::seek(const std::string& prefix) {
+    size_t shared = std::mismatch(m_prefix.begin(), m_prefix.begin() + std::min(m_prefix.size(), prefix.size()),
+                                  prefix.begin()).first - m_prefix.begin();
+    sync();
+    m_prefix.resize(shared);
+    if (m_path.size() > shared + 1) m_path.resize(shared + 1);
+    for (size_t i = shared; i < prefix.size(); ++i) {
+        push(prefix[i]);
+    }
+}
+
+bool PrefixCursor::matches() const {
+    return node() != nullptr;
+}
+
+bool PrefixCursor::top(size_t k, TrieRank rank, std::vector<size_t>& results) const {
+    results.clear();
+    const TrieNode* current = node();
+    if (!current) return true;
+
+    if (!current->best) {
+        for (const TrieEntry& entry : m_trie->rankSubtree(current, rank, k)) {
+            results.push_back(entry.fileIndex);
+        }
+        return true;
+    }
+    if (k > Trie::BEST_SLOTS) return false;
+    const std::vector<TrieEntry>& best = (*current->best)[static_cast<size_t>(rank)];
+    for (size_t i = 0; i < best.size() && i < k; ++i) {
+        results.push_back(best[i].fileIndex);
+    }
+    return true;
+}
+
+std::vector<size_t> PrefixCursor::all() const {
+    std::vector<size_t> results;
+    if (const TrieNode* current = node()) {
+        m_trie->collectIndicesRecursive(current, results);
+    }
+    return results;
+}
@@ -2,15 +2,38 @@
 #ifndef TRIE_H
 #define TRIE_H
 
+#include <array>
+#include <cstdint>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 #include <string>
 #include <functional>
 
+// The orders completion can take straight from a node: newest mtime first and
+// largest size first, ties broken by the smaller file index
+enum class TrieRank {
+    RECENT,
+    LARGEST,
+    COUNT
+};
+
+struct TrieEntry {
+    uint64_t key; // higher is better
+    size_t fileIndex;
+};
+
+// Per TrieRank, the best Trie::BEST_SLOTS entries of a subtree, best first
+using TrieBest = std::array<std::vector<TrieEntry>, static_cast<size_t>(TrieRank::COUNT)>;
+
 struct TrieNode {
     std::unordered_map<char, TrieNode*> children;
     bool isEndOfWord = false;
+    uint32_t subtreeSize = 0; // files at or below this node
     std::vector<size_t> fileIndices;
+    // Only for subtrees of more than Trie::BEST_SLOTS files; smaller ones are
+    // cheap to rank directly, and most nodes are in long single-file chains
+    std::unique_ptr<TrieBest> best;
 
     template<class Archive>
     void serialize(Archive& ar, const unsigned int version) {
@@ -20,10 +43,14 @@ struct TrieNode {
 
 class Trie {
 public:
+    // Entries cached per node and ranking
+    static const size_t BEST_SLOTS = 16;
+
     Trie();
     ~Trie();
 
-    void insert(const std::string& word, size_t fileIndex);
+    // mtime and size feed the cached best entries of every node along the word
+    void insert(const std::string& word, size_t fileIndex, int64_t mtime, uint64_t size);
     std::vector<size_t> searchPrefix(const std::string& prefix) const;
     void clear(); 
 
@@ -34,10 +61,53 @@ public:
     }
 
 private:
+    friend class PrefixCursor;
+
     TrieNode* root;
+    uint64_t m_epoch{0}; // bumped by clear(), which frees every node
+    // Per TrieRank, each file index's key
+    std::array<std::vector<uint64_t>, static_cast<size_t>(TrieRank::COUNT)> m_keys;
 
     void clearRecursive(TrieNode* node);
-    void collectIndicesRecursive(TrieNode* node, std::vector<size_t>& results) const;
+    void collectIndicesRecursive(const TrieNode* node, std::vector<size_t>& results) const;
+    // The best k entries of node's subtree, from its file indices and their keys
+    std::vector<TrieEntry> rankSubtree(const TrieNode* node, TrieRank rank, size_t k) const;
+};
+
+// Search-as-you-type: remembers the path of nodes for the text typed so far,
+// so typing or deleting a character moves one node instead of walking down
+// from the root again. Reads the trie without locking, like searchPrefix();
+// after Trie::clear() it finds its way back from the root on the next call.
+class PrefixCursor {
+public:
+    explicit PrefixCursor(const Trie& trie);
+
+    void push(char c);
+    // Drops the last character; does nothing at the empty prefix
+    void pop();
+    // Pops back to what prefix shares with the current one and pushes the rest
+    void seek(const std::string& prefix);
+    const std::string& prefix() const { return m_prefix; }
+    // Whether any word starts with the prefix
+    bool matches() const;
+
+    // The best k file indices under the prefix, in O(k) from the node's cached
+    // entries (or its few files); false if k > Trie::BEST_SLOTS and the cache
+    // can't tell
+    bool top(size_t k, TrieRank rank, std::vector<size_t>& results) const;
+    // Every file index under the prefix, in O(subtree)
+    std::vector<size_t> all() const;
+
+private:
+    const Trie* m_trie;
+    std::string m_prefix;
+    // m_path[i] is the node for the first i characters of m_prefix; it stops
+    // early once no word has the prefix
+    mutable std::vector<const TrieNode*> m_path;
+    mutable uint64_t m_epoch;
+
+    void sync() const;
+    const TrieNode* node() const;
 };
 
 #endif 
@@ -1,10 +1,32 @@
 // utils.cpp
 #include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <exception>
 #include <fstream>
+#include <mutex>
 #include <sstream>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 
 
 std::string readFileContent(const std::filesystem::path& file_path) {
+#ifdef _WIN32
     std::ifstream file(file_path, std::ios::binary);
     if (!file) {
         return "";
@@ -13,5 +35,218 @@ std::string readFileContent(const std::filesystem::path& file_path) {
     std::stringstream buffer;
     buffer << file.rdbuf();
     return buffer.str();
+#else
+    // One allocation of the size fstat reports and straight read()s into it,
+    // instead of copying through a stream buffer and a stringstream
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return "";
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return "";
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // The file may grow or shrink while it is read; take what is there
+    std::string content(st.st_size > 0 ? static_cast<size_t>(st.st_size) : 0, '\0');
+    size_t done = 0;
+    char probe[4096];
+    for (;;) {
+        // Once the expected size is in, a small read usually just confirms the end
+        bool full = done == content.size();
+        ssize_t n = full ? ::read(fd, probe, sizeof(probe)) : ::read(fd, &content[done], content.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            ::close(fd);
+            return "";
+        }
+        if (n == 0) break;
+        if (full) content.append(probe, static_cast<size_t>(n));
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    content.resize(done);
+    return content;
+#endif
+}
+
+bool locateFile(const std::filesystem::path& file_path, bool physical, FileLocation& out) {
+#ifdef _WIN32
+    (void)file_path;
+    (void)physical;
+    (void)out;
+    return false;
+#else
+    struct stat st;
+    if (::stat(file_path.c_str(), &st) != 0) return false;
+    out.device = static_cast<uint64_t>(st.st_dev);
+    out.inode = static_cast<uint64_t>(st.st_ino);
+    out.physical = 0;
+#ifdef __linux__
+    if (physical && st.st_size > 0) {
+        int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            // Room for the header and a single extent, which is all the ordering needs
+            union {
+                struct fiemap map;
+                char bytes[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+            } request = {};
+            request.map.fm_start = 0;
+            request.map.fm_length = FIEMAP_MAX_OFFSET;
+            request.map.fm_extent_count = 1;
+            // Fails on filesystems without extents (tmpfs, some network mounts)
+            if (::ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents > 0 &&
+                !(request.map.fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN)) {
+                out.physical = request.map.fm_extents[0].fe_physical;
+            }
+            ::close(fd);
+        }
+    }
+#else
+    (void)physical;
+#endif
+    return true;
+#endif
 }
 
+void prefetchFile(const std::filesystem::path& file_path, uint64_t length) {
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    // Starts the read asynchronously; the pages stay cached after the close
+    ::posix_fadvise(fd, 0, static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+    ::close(fd);
+#else
+    (void)file_path;
+    (void)length;
+#endif
+}
+
+bool readFileRange(const std::filesystem::path& file_path, uint64_t offset, size_t length, std::string& out) {
+    out.assign(length, '\0');
+    size_t done = 0;
+#ifdef _WIN32
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file) return false;
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(&out[0], static_cast<std::streamsize>(length));
+    if (file.bad()) return false;
+    done = static_cast<size_t>(file.gcount());
+#else
+    // pread doesn't move a shared file position, and one call usually suffices
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    while (done < length) {
+        ssize_t n = ::pread(fd, &out[done], length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            ::close(fd);
+            return false;
+        }
+        if (n == 0) break;
+        done += static_cast<size_t>(n);
+    }
+    ::close(fd);
+#endif
+    out.resize(done);
+    return true;
+}
+
+bool globMatch(const std::string& pattern, const std::string& text) {
+    size_t p = 0;
+    size_t t = 0;
+    size_t star = std::string::npos;
+    size_t resume = 0;
+
+    // Greedy match; on a mismatch retry from the most recent '*' one character later
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            p++;
+            t++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = t;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            t = ++resume;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+std::string jsonEscape(const std::string& text) {
+    std::string escaped;
+    escaped.reserve(text.size() + 2);
+    for (unsigned char c : text) {
+        switch (c) {
+        case '"':  escaped += "\\\""; break;
+        case '\\': escaped += "\\\\"; break;
+        case '\n': escaped += "\\n"; break;
+        case '\r': escaped += "\\r"; break;
+        case '\t': escaped += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                escaped += buffer;
+            } else {
+                escaped += static_cast<char>(c);
+            }
+        }
+    }
+    return escaped;
+}
+
+int64_t toUnixSeconds(std::filesystem::file_time_type time) {
+    // No clock_cast before C++20, so translate through the offset between the two clocks' "now"
+    auto systemTime = std::chrono::system_clock::now() +
+                      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                          time - std::filesystem::file_time_type::clock::now());
+    return std::chrono::duration_cast<std::chrono::seconds>(systemTime.time_since_epoch()).count();
+}
+
+void parallelFor(size_t count, const std::function<void(size_t)>& task) {
+    size_t threads = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) task(i);
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::exception_ptr failure;
+    std::mutex failureMutex;
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            try {
+                task(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(failureMutex);
+                if (!failure) failure = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    try {
+        for (size_t i = 1; i < threads; ++i) {
+            pool.emplace_back(worker);
+        }
+    } catch (const std::system_error&) {
+        // Out of threads: carry on with the ones already running rather than
+        // destroying them unjoined
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    if (failure) std::rethrow_exception(failure);
+}
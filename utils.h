@@ -2,10 +2,36 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstdint>
 #include <filesystem>
+#include <functional>
 #include <string>
 
 std::string readFileContent(const std::filesystem::path& file_path);
+// Where a file's data lives, for ordering reads to cut disk seeks
+struct FileLocation {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    // Disk offset of the first extent; 0 if unknown or the file has none
+    uint64_t physical = 0;
+};
+// Fills in device and inode, and with physical the first extent (Linux FIEMAP
+// only); false if the file can't be examined or the platform has no inodes
+bool locateFile(const std::filesystem::path& file_path, bool physical, FileLocation& out);
+// Asks the kernel to start reading the first length bytes in the background;
+// a no-op where posix_fadvise is unavailable
+void prefetchFile(const std::filesystem::path& file_path, uint64_t length);
+// Reads up to length bytes at offset (fewer at end of file) with positioned reads; false on error
+bool readFileRange(const std::filesystem::path& file_path, uint64_t offset, size_t length, std::string& out);
+// Shell-style match where '*' is any run of characters and '?' is any single one
+bool globMatch(const std::string& pattern, const std::string& text);
+// Escapes quotes, backslashes and control characters for use inside a JSON string
+std::string jsonEscape(const std::string& text);
+// Seconds since the Unix epoch; file_time_type's epoch is implementation-defined
+int64_t toUnixSeconds(std::filesystem::file_time_type time);
+// Runs task(0) .. task(count - 1) on up to hardware_concurrency threads and
+// rethrows the first exception once all of them have finished
+void parallelFor(size_t count, const std::function<void(size_t)>& task);
 
 #endif 
 